@@ -170,7 +170,7 @@ void readahead_tree_block(struct btrfs_root *root, u64 bytenr, u32 blocksize,
 	    !btrfs_map_block(&root->fs_info->mapping_tree, READ,
 			     bytenr, &length, &multi, 0, NULL)) {
 		device = multi->stripes[0].dev;
-		device->total_ios++;
+		__sync_fetch_and_add(&device->total_ios, 1);
 		blocksize = min(blocksize, (u32)(64 * 1024));
 		readahead(device->fd, multi->stripes[0].physical, blocksize);
 	}
@@ -236,7 +236,7 @@ int read_whole_eb(struct btrfs_fs_info *info, struct extent_buffer *eb, int mirr
 			}
 
 			eb->fd = device->fd;
-			device->total_ios++;
+			__sync_fetch_and_add(&device->total_ios, 1);
 			eb->dev_bytenr = multi->stripes[0].physical;
 			kfree(multi);
 			multi = NULL;
@@ -249,7 +249,7 @@ int read_whole_eb(struct btrfs_fs_info *info, struct extent_buffer *eb, int mirr
 
 			eb->fd = device->fd;
 			eb->dev_bytenr = eb->start;
-			device->total_ios++;
+			__sync_fetch_and_add(&device->total_ios, 1);
 		}
 
 		if (read_len > bytes_left)
@@ -289,12 +289,14 @@ struct extent_buffer* read_tree_block_fs_info(
 		    check_tree_block(fs_info, eb) == 0 &&
 		    verify_parent_transid(eb->tree, eb, parent_transid, ignore)
 		    == 0) {
+			pthread_mutex_lock(&eb->tree->lock);
 			if (eb->flags & EXTENT_BAD_TRANSID &&
 			    list_empty(&eb->recow)) {
 				list_add_tail(&eb->recow,
 					      &fs_info->recow_ebs);
 				eb->refs++;
 			}
+			pthread_mutex_unlock(&eb->tree->lock);
 			btrfs_set_buffer_uptodate(eb);
 			return eb;
 		}
@@ -156,6 +156,11 @@ int write_and_map_eb(struct btrfs_trans_handle *trans, struct btrfs_root *root,
 		     struct extent_buffer *eb);
 
 /* raid6.c */
+void raid6_init(void);
 void raid6_gen_syndrome(int disks, size_t bytes, void **ptrs);
+void raid5_recov(int disks, size_t bytes, int faila, void **ptrs);
+int raid6_2data_recov(int disks, size_t bytes, int faila, int failb,
+		      void **ptrs);
+int raid6_datap_recov(int disks, size_t bytes, int faila, void **ptrs);
 
 #endif
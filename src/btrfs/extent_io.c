@@ -35,6 +35,7 @@ void extent_io_tree_init(struct extent_io_tree *tree)
 	cache_tree_init(&tree->cache);
 	INIT_LIST_HEAD(&tree->lru);
 	tree->cache_size = 0;
+	pthread_mutex_init(&tree->lock, NULL);
 }
 
 static struct extent_state *alloc_extent_state(void)
@@ -77,6 +78,7 @@ void extent_io_tree_cleanup(struct extent_io_tree *tree)
 	}
 
 	cache_tree_free_extents(&tree->state, free_extent_state_func);
+	pthread_mutex_destroy(&tree->lock);
 }
 
 static inline void update_extent_state(struct extent_state *state)
@@ -579,11 +581,9 @@ static struct extent_buffer *__alloc_extent_buffer(struct extent_io_tree *tree,
 	return eb;
 }
 
-void free_extent_buffer(struct extent_buffer *eb)
+/* caller holds eb->tree->lock */
+static void __free_extent_buffer(struct extent_buffer *eb)
 {
-	if (!eb || IS_ERR(eb))
-		return;
-
 	eb->refs--;
 	if (eb->refs == 0) {
 		struct extent_io_tree *tree = eb->tree;
@@ -597,12 +597,26 @@ void free_extent_buffer(struct extent_buffer *eb)
 	}
 }
 
+void free_extent_buffer(struct extent_buffer *eb)
+{
+	struct extent_io_tree *tree;
+
+	if (!eb || IS_ERR(eb))
+		return;
+
+	tree = eb->tree;
+	pthread_mutex_lock(&tree->lock);
+	__free_extent_buffer(eb);
+	pthread_mutex_unlock(&tree->lock);
+}
+
 struct extent_buffer *find_extent_buffer(struct extent_io_tree *tree,
 					 u64 bytenr, u32 blocksize)
 {
 	struct extent_buffer *eb = NULL;
 	struct cache_extent *cache;
 
+	pthread_mutex_lock(&tree->lock);
 	cache = lookup_cache_extent(&tree->cache, bytenr, blocksize);
 	if (cache && cache->start == bytenr &&
 	    cache->size == blocksize) {
@@ -610,6 +624,7 @@ struct extent_buffer *find_extent_buffer(struct extent_io_tree *tree,
 		list_move_tail(&eb->lru, &tree->lru);
 		eb->refs++;
 	}
+	pthread_mutex_unlock(&tree->lock);
 	return eb;
 }
 
@@ -619,12 +634,14 @@ struct extent_buffer *find_first_extent_buffer(struct extent_io_tree *tree,
 	struct extent_buffer *eb = NULL;
 	struct cache_extent *cache;
 
+	pthread_mutex_lock(&tree->lock);
 	cache = search_cache_extent(&tree->cache, start);
 	if (cache) {
 		eb = container_of(cache, struct extent_buffer, cache_node);
 		list_move_tail(&eb->lru, &tree->lru);
 		eb->refs++;
 	}
+	pthread_mutex_unlock(&tree->lock);
 	return eb;
 }
 
@@ -634,6 +651,7 @@ struct extent_buffer *alloc_extent_buffer(struct extent_io_tree *tree,
 	struct extent_buffer *eb;
 	struct cache_extent *cache;
 
+	pthread_mutex_lock(&tree->lock);
 	cache = lookup_cache_extent(&tree->cache, bytenr, blocksize);
 	if (cache && cache->start == bytenr &&
 	    cache->size == blocksize) {
@@ -646,19 +664,22 @@ struct extent_buffer *alloc_extent_buffer(struct extent_io_tree *tree,
 		if (cache) {
 			eb = container_of(cache, struct extent_buffer,
 					  cache_node);
-			free_extent_buffer(eb);
+			__free_extent_buffer(eb);
 		}
 		eb = __alloc_extent_buffer(tree, bytenr, blocksize);
 		if (!eb)
-			return NULL;
+			goto out;
 		ret = insert_cache_extent(&tree->cache, &eb->cache_node);
 		if (ret) {
 			free(eb);
-			return NULL;
+			eb = NULL;
+			goto out;
 		}
 		list_add_tail(&eb->lru, &tree->lru);
 		tree->cache_size += blocksize;
 	}
+out:
+	pthread_mutex_unlock(&tree->lock);
 	return eb;
 }
 
@@ -19,6 +19,7 @@
 #ifndef __BTRFS_EXTENT_IO_H__
 #define __BTRFS_EXTENT_IO_H__
 
+#include <pthread.h>
 #include <btrfs/kerncompat.h>
 #include <btrfs/extent-cache.h>
 #include <btrfs/list.h>
@@ -50,6 +51,8 @@ struct extent_io_tree {
 	struct cache_tree cache;
 	struct list_head lru;
 	u64 cache_size;
+	/* guards cache, lru, cache_size and the refs of its buffers */
+	pthread_mutex_t lock;
 };
 
 struct extent_state {
@@ -77,7 +80,9 @@ struct extent_buffer {
 
 static inline void extent_buffer_get(struct extent_buffer *eb)
 {
+	pthread_mutex_lock(&eb->tree->lock);
 	eb->refs++;
+	pthread_mutex_unlock(&eb->tree->lock);
 }
 
 void extent_io_tree_init(struct extent_io_tree *tree);
@@ -18,7 +18,10 @@
  * This file was postprocessed using unroll.pl and then ported to userspace
  */
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <btrfs/kerncompat.h>
 #include "ctree.h"
 #include "disk-io.h"
@@ -71,7 +74,7 @@ static inline __attribute_const__ unative_t MASK(unative_t v)
 }
 
 
-void raid6_gen_syndrome(int disks, size_t bytes, void **ptrs)
+static void raid6_int1_gen_syndrome(int disks, size_t bytes, void **ptrs)
 {
 	uint8_t **dptr = (uint8_t **)ptrs;
 	uint8_t *p, *q;
@@ -98,3 +101,349 @@ void raid6_gen_syndrome(int disks, size_t bytes, void **ptrs)
 		*(unative_t *)&q[d+NSIZE*0] = wq0;
 	}
 }
+
+/*
+ * GF(2^8) tables for the 0x11d polynomial, built once at runtime instead
+ * of by mktables
+ */
+static uint8_t raid6_gfmul[256][256];	/* a*b */
+static uint8_t raid6_gfexp[256];	/* 2^x */
+static uint8_t raid6_gfinv[256];	/* 1/x */
+static uint8_t raid6_gfexi[256];	/* 1/(2^x + 1) */
+
+static uint8_t gfmul(uint8_t a, uint8_t b)
+{
+	uint8_t v = 0;
+
+	while (b) {
+		if (b & 1)
+			v ^= a;
+		a = (a << 1) ^ (a & 0x80 ? 0x1d : 0);
+		b >>= 1;
+	}
+	return v;
+}
+
+static void raid6_gen_tables(void)
+{
+	int i, j;
+	uint8_t v = 1;
+
+	for (i = 0; i < 256; i++)
+		for (j = 0; j < 256; j++)
+			raid6_gfmul[i][j] = gfmul(i, j);
+	for (i = 0; i < 256; i++) {
+		raid6_gfexp[i] = v;
+		v = gfmul(v, 2);
+	}
+	raid6_gfinv[0] = 0;
+	for (i = 1; i < 256; i++)
+		for (j = 1; j < 256; j++)
+			if (raid6_gfmul[i][j] == 1) {
+				raid6_gfinv[i] = j;
+				break;
+			}
+	for (i = 0; i < 256; i++)
+		raid6_gfexi[i] = raid6_gfinv[raid6_gfexp[i] ^ 1];
+}
+
+/*
+ * Recovery inner loops, dp/dq hold the syndrome of the surviving data
+ *
+ * 2data: px = p ^ dp, db = pbmul*px ^ qmul*(q ^ dq), da = db ^ px
+ * datap: da = qmul*(q ^ dq), p ^= da
+ */
+static void raid6_int1_2data_loop(size_t bytes, const uint8_t *p,
+				  const uint8_t *q, uint8_t *dp, uint8_t *dq,
+				  uint8_t pbc, uint8_t qc)
+{
+	const uint8_t *pbmul = raid6_gfmul[pbc];
+	const uint8_t *qmul = raid6_gfmul[qc];
+	uint8_t px, db;
+
+	while (bytes--) {
+		px = *p++ ^ *dp;
+		db = pbmul[px] ^ qmul[*q++ ^ *dq];
+		*dq++ = db;
+		*dp++ = db ^ px;
+	}
+}
+
+static void raid6_int1_datap_loop(size_t bytes, uint8_t *p, const uint8_t *q,
+				  uint8_t *dq, uint8_t qc)
+{
+	const uint8_t *qmul = raid6_gfmul[qc];
+
+	while (bytes--) {
+		*dq = qmul[*q++ ^ *dq];
+		*p++ ^= *dq++;
+	}
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+/*
+ * Vector kernels, built with per-function target attributes so the rest
+ * of the tree keeps the baseline instruction set.  Every buffer length is
+ * a multiple of the sector size, the tails below are never hit for real
+ * stripes but keep odd sizes correct.
+ */
+__attribute__((target("sse2")))
+static void raid6_sse2_gen_syndrome(int disks, size_t bytes, void **ptrs)
+{
+	uint8_t **dptr = (uint8_t **)ptrs;
+	uint8_t *p, *q;
+	int z, z0 = disks - 3;
+	size_t d;
+	__m128i wd, wp, wq, t;
+	const __m128i x1d = _mm_set1_epi8(0x1d);
+	const __m128i zero = _mm_setzero_si128();
+
+	p = dptr[z0 + 1];
+	q = dptr[z0 + 2];
+	for (d = 0; d + 16 <= bytes; d += 16) {
+		wq = wp = _mm_loadu_si128((__m128i *)&dptr[z0][d]);
+		for (z = z0 - 1; z >= 0; z--) {
+			wd = _mm_loadu_si128((__m128i *)&dptr[z][d]);
+			wp = _mm_xor_si128(wp, wd);
+			t = _mm_cmpgt_epi8(zero, wq);
+			wq = _mm_add_epi8(wq, wq);
+			t = _mm_and_si128(t, x1d);
+			wq = _mm_xor_si128(wq, t);
+			wq = _mm_xor_si128(wq, wd);
+		}
+		_mm_storeu_si128((__m128i *)&p[d], wp);
+		_mm_storeu_si128((__m128i *)&q[d], wq);
+	}
+	if (d < bytes) {
+		void *tail[disks];
+
+		for (z = 0; z < disks; z++)
+			tail[z] = dptr[z] + d;
+		raid6_int1_gen_syndrome(disks, bytes - d, tail);
+	}
+}
+
+__attribute__((target("avx2")))
+static void raid6_avx2_gen_syndrome(int disks, size_t bytes, void **ptrs)
+{
+	uint8_t **dptr = (uint8_t **)ptrs;
+	uint8_t *p, *q;
+	int z, z0 = disks - 3;
+	size_t d;
+	__m256i wd, wp, wq, t;
+	const __m256i x1d = _mm256_set1_epi8(0x1d);
+	const __m256i zero = _mm256_setzero_si256();
+
+	p = dptr[z0 + 1];
+	q = dptr[z0 + 2];
+	for (d = 0; d + 32 <= bytes; d += 32) {
+		wq = wp = _mm256_loadu_si256((__m256i *)&dptr[z0][d]);
+		for (z = z0 - 1; z >= 0; z--) {
+			wd = _mm256_loadu_si256((__m256i *)&dptr[z][d]);
+			wp = _mm256_xor_si256(wp, wd);
+			t = _mm256_cmpgt_epi8(zero, wq);
+			wq = _mm256_add_epi8(wq, wq);
+			t = _mm256_and_si256(t, x1d);
+			wq = _mm256_xor_si256(wq, t);
+			wq = _mm256_xor_si256(wq, wd);
+		}
+		_mm256_storeu_si256((__m256i *)&p[d], wp);
+		_mm256_storeu_si256((__m256i *)&q[d], wq);
+	}
+	if (d < bytes) {
+		void *tail[disks];
+
+		for (z = 0; z < disks; z++)
+			tail[z] = dptr[z] + d;
+		raid6_int1_gen_syndrome(disks, bytes - d, tail);
+	}
+}
+
+/* c*v for every byte of v, from the products of c with both nibbles */
+#define AVX2_GFMUL(lo, hi, v, mask)					\
+	_mm256_xor_si256(						\
+		_mm256_shuffle_epi8(lo, _mm256_and_si256(v, mask)),	\
+		_mm256_shuffle_epi8(hi, _mm256_and_si256(		\
+			_mm256_srli_epi16(v, 4), mask)))
+
+__attribute__((target("avx2")))
+static __m256i avx2_nibble_table(uint8_t c, int shift)
+{
+	uint8_t tbl[32];
+	int i;
+
+	for (i = 0; i < 16; i++)
+		tbl[i] = tbl[i + 16] = raid6_gfmul[c][i << shift];
+	return _mm256_loadu_si256((__m256i *)tbl);
+}
+
+__attribute__((target("avx2")))
+static void raid6_avx2_2data_loop(size_t bytes, const uint8_t *p,
+				  const uint8_t *q, uint8_t *dp, uint8_t *dq,
+				  uint8_t pbc, uint8_t qc)
+{
+	const __m256i mask = _mm256_set1_epi8(0x0f);
+	const __m256i pblo = avx2_nibble_table(pbc, 0);
+	const __m256i pbhi = avx2_nibble_table(pbc, 4);
+	const __m256i qlo = avx2_nibble_table(qc, 0);
+	const __m256i qhi = avx2_nibble_table(qc, 4);
+	__m256i px, qx, db;
+	size_t d;
+
+	for (d = 0; d + 32 <= bytes; d += 32) {
+		px = _mm256_xor_si256(_mm256_loadu_si256((__m256i *)&p[d]),
+				      _mm256_loadu_si256((__m256i *)&dp[d]));
+		qx = _mm256_xor_si256(_mm256_loadu_si256((__m256i *)&q[d]),
+				      _mm256_loadu_si256((__m256i *)&dq[d]));
+		db = _mm256_xor_si256(AVX2_GFMUL(pblo, pbhi, px, mask),
+				      AVX2_GFMUL(qlo, qhi, qx, mask));
+		_mm256_storeu_si256((__m256i *)&dq[d], db);
+		_mm256_storeu_si256((__m256i *)&dp[d], _mm256_xor_si256(db, px));
+	}
+	raid6_int1_2data_loop(bytes - d, p + d, q + d, dp + d, dq + d, pbc, qc);
+}
+
+__attribute__((target("avx2")))
+static void raid6_avx2_datap_loop(size_t bytes, uint8_t *p, const uint8_t *q,
+				  uint8_t *dq, uint8_t qc)
+{
+	const __m256i mask = _mm256_set1_epi8(0x0f);
+	const __m256i qlo = avx2_nibble_table(qc, 0);
+	const __m256i qhi = avx2_nibble_table(qc, 4);
+	__m256i qx, da;
+	size_t d;
+
+	for (d = 0; d + 32 <= bytes; d += 32) {
+		qx = _mm256_xor_si256(_mm256_loadu_si256((__m256i *)&q[d]),
+				      _mm256_loadu_si256((__m256i *)&dq[d]));
+		da = AVX2_GFMUL(qlo, qhi, qx, mask);
+		_mm256_storeu_si256((__m256i *)&dq[d], da);
+		_mm256_storeu_si256((__m256i *)&p[d],
+			_mm256_xor_si256(_mm256_loadu_si256((__m256i *)&p[d]), da));
+	}
+	raid6_int1_datap_loop(bytes - d, p + d, q + d, dq + d, qc);
+}
+#endif
+
+static struct {
+	void (*gen_syndrome)(int disks, size_t bytes, void **ptrs);
+	void (*recov_2data)(size_t bytes, const uint8_t *p, const uint8_t *q,
+			    uint8_t *dp, uint8_t *dq, uint8_t pbc, uint8_t qc);
+	void (*recov_datap)(size_t bytes, uint8_t *p, const uint8_t *q,
+			    uint8_t *dq, uint8_t qc);
+} raid6_call = {
+	raid6_int1_gen_syndrome,
+	raid6_int1_2data_loop,
+	raid6_int1_datap_loop,
+};
+static pthread_once_t raid6_once = PTHREAD_ONCE_INIT;
+
+static void raid6_select(void)
+{
+	raid6_gen_tables();
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		raid6_call.gen_syndrome = raid6_avx2_gen_syndrome;
+		raid6_call.recov_2data = raid6_avx2_2data_loop;
+		raid6_call.recov_datap = raid6_avx2_datap_loop;
+	} else if (__builtin_cpu_supports("sse2")) {
+		raid6_call.gen_syndrome = raid6_sse2_gen_syndrome;
+	}
+#endif
+}
+
+/* pick the kernels for this cpu, safe to call from any thread */
+void raid6_init(void)
+{
+	pthread_once(&raid6_once, raid6_select);
+}
+
+void raid6_gen_syndrome(int disks, size_t bytes, void **ptrs)
+{
+	raid6_init();
+	raid6_call.gen_syndrome(disks, bytes, ptrs);
+}
+
+/* rebuild ptrs[faila] as the xor of every other block, P included */
+void raid5_recov(int disks, size_t bytes, int faila, void **ptrs)
+{
+	uint8_t *dst = ptrs[faila];
+	size_t i;
+	int z, first = 1;
+
+	for (z = 0; z < disks; z++) {
+		if (z == faila)
+			continue;
+		if (first) {
+			memcpy(dst, ptrs[z], bytes);
+			first = 0;
+			continue;
+		}
+		for (i = 0; i + sizeof(unsigned long) <= bytes;
+		     i += sizeof(unsigned long))
+			*(unsigned long *)(dst + i) ^=
+				*(unsigned long *)((uint8_t *)ptrs[z] + i);
+		for (; i < bytes; i++)
+			dst[i] ^= ((uint8_t *)ptrs[z])[i];
+	}
+}
+
+/* two data blocks lost, faila < failb, P and Q intact */
+int raid6_2data_recov(int disks, size_t bytes, int faila, int failb,
+		      void **ptrs)
+{
+	uint8_t *p, *q, *dp, *dq, *zero;
+
+	raid6_init();
+	zero = calloc(1, bytes);
+	if (!zero)
+		return -ENOMEM;
+	p = ptrs[disks - 2];
+	q = ptrs[disks - 1];
+
+	/* syndrome of the surviving data lands in the dead blocks */
+	dp = ptrs[faila];
+	dq = ptrs[failb];
+	ptrs[faila] = zero;
+	ptrs[failb] = zero;
+	ptrs[disks - 2] = dp;
+	ptrs[disks - 1] = dq;
+	raid6_call.gen_syndrome(disks, bytes, ptrs);
+	ptrs[faila] = dp;
+	ptrs[failb] = dq;
+	ptrs[disks - 2] = p;
+	ptrs[disks - 1] = q;
+
+	raid6_call.recov_2data(bytes, p, q, dp, dq,
+		raid6_gfexi[failb - faila],
+		raid6_gfinv[raid6_gfexp[faila] ^ raid6_gfexp[failb]]);
+	free(zero);
+	return 0;
+}
+
+/* a data block and P lost, Q intact; P is rebuilt as well */
+int raid6_datap_recov(int disks, size_t bytes, int faila, void **ptrs)
+{
+	uint8_t *q, *dq, *zero;
+
+	raid6_init();
+	zero = calloc(1, bytes);
+	if (!zero)
+		return -ENOMEM;
+	q = ptrs[disks - 1];
+
+	dq = ptrs[faila];
+	ptrs[faila] = zero;
+	ptrs[disks - 1] = dq;
+	raid6_call.gen_syndrome(disks, bytes, ptrs);
+	ptrs[faila] = dq;
+	ptrs[disks - 1] = q;
+
+	raid6_call.recov_datap(bytes, ptrs[disks - 2], q, dq,
+			       raid6_gfinv[raid6_gfexp[faila]]);
+	free(zero);
+	return 0;
+}
@@ -1,6 +1,13 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 #define PART_BYTES_PER_LONG ((int)sizeof(unsigned long))
 #define PART_BITS_PER_BYTE  (8)
@@ -8,6 +15,12 @@
 #define BITS_TO_BYTES(bits) (((bits)+PART_BITS_PER_BYTE-1)/PART_BITS_PER_BYTE)
 #define BITS_TO_LONGS(bits) (((bits)+PART_BITS_PER_LONG-1)/PART_BITS_PER_LONG)
 
+/// bitmaps above this size are backed by an unlinked file instead of the heap
+#define PART_BITMAP_MMAP_THRESHOLD  (64ULL << 20)
+#define PART_BITMAP_MMAP_DIR        "/var/tmp"
+#define PART_BITMAP_HEAP            0
+#define PART_BITMAP_MMAP            1
+
 typedef unsigned long long ull;
 static inline int
 pc_test_bit(ull nr, unsigned long *bitmap,ull total)
@@ -63,9 +76,188 @@ pc_clear_bit(ull nr, unsigned long *bitmap,ull total)
     return TRUE;
 }
 
+static inline void
+pc_fill_range(ull start, ull end, unsigned long *bitmap, gboolean set)
+{
+    ull first = start / PART_BITS_PER_LONG;
+    ull last  = end / PART_BITS_PER_LONG;
+    unsigned int  end_bit = end & (PART_BITS_PER_LONG - 1);
+    unsigned long head = ~0UL << (start & (PART_BITS_PER_LONG - 1));
+    unsigned long tail = end_bit ? ~0UL >> (PART_BITS_PER_LONG - end_bit) : 0;
+
+    if (start >= end)
+        return;
+    if (first == last)
+    {
+        /// start and end inside the same word
+        head &= tail;
+        bitmap[first] = set ? bitmap[first] | head : bitmap[first] & ~head;
+        return;
+    }
+    bitmap[first] = set ? bitmap[first] | head : bitmap[first] & ~head;
+    if (last > first + 1)
+        memset(bitmap + first + 1, set ? 0xFF : 0x00, (last - first - 1) * PART_BYTES_PER_LONG);
+    if (tail)
+        bitmap[last] = set ? bitmap[last] | tail : bitmap[last] & ~tail;
+}
+
+/// mark blocks [start, start + count) as used
+static inline gboolean
+pc_set_range(ull start, ull count, unsigned long *bitmap, ull total)
+{
+    if (!bitmap)
+        return FALSE;
+    if (start > total || count > total - start)
+    {
+        g_warning("set range %llu+%llu out of boundary(%llu)\n", start, count, total);
+        if (start < total)
+            pc_fill_range(start, total, bitmap, TRUE);
+        return FALSE;
+    }
+    pc_fill_range(start, start + count, bitmap, TRUE);
+
+    return TRUE;
+}
+
+/// mark blocks [start, start + count) as free
+static inline gboolean
+pc_clear_range(ull start, ull count, unsigned long *bitmap, ull total)
+{
+    if (!bitmap)
+        return FALSE;
+    if (start > total || count > total - start)
+    {
+        g_warning("clear range %llu+%llu out of boundary(%llu)\n", start, count, total);
+        if (start < total)
+            pc_fill_range(start, total, bitmap, FALSE);
+        return FALSE;
+    }
+    pc_fill_range(start, start + count, bitmap, FALSE);
+
+    return TRUE;
+}
+
+/// load up to one word of an LSB-first byte bitmap (the ext2fs layout)
+static inline unsigned long pc_load_le_word(const unsigned char *src, unsigned int nbytes)
+{
+    unsigned long word = 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(&word, src, nbytes);
+#else
+    unsigned int i;
+
+    for (i = 0; i < nbytes; i++)
+        word |= (unsigned long)src[i] << (8 * i);
+#endif
+    return word;
+}
+
+/*
+ * Copy nbits of an LSB-first byte bitmap into bitmap at bit start,
+ * overwriting what was there, one word per step.  Returns the number of
+ * set bits copied.
+ */
+static inline ull
+pc_copy_bits(ull start, const unsigned char *src, ull nbits, unsigned long *bitmap, ull total)
+{
+    ull copied, used = 0;
+
+    if (!bitmap || start >= total)
+        return 0;
+    if (nbits > total - start)
+        nbits = total - start;
+
+    for (copied = 0; copied < nbits; copied += PART_BITS_PER_LONG)
+    {
+        ull           pos   = start + copied;
+        ull           idx   = pos / PART_BITS_PER_LONG;
+        unsigned int  shift = pos & (PART_BITS_PER_LONG - 1);
+        unsigned int  n     = nbits - copied < (ull)PART_BITS_PER_LONG ?
+                              nbits - copied : PART_BITS_PER_LONG;
+        unsigned long mask  = n == PART_BITS_PER_LONG ? ~0UL : (1UL << n) - 1;
+        unsigned long word;
+
+        word = pc_load_le_word(src + copied / PART_BITS_PER_BYTE,
+                               BITS_TO_BYTES(n)) & mask;
+        used += __builtin_popcountl(word);
+
+        bitmap[idx] = (bitmap[idx] & ~(mask << shift)) | (word << shift);
+        if (shift && shift + n > PART_BITS_PER_LONG)
+        {
+            unsigned int back = PART_BITS_PER_LONG - shift;
+
+            bitmap[idx + 1] = (bitmap[idx + 1] & ~(mask >> back)) | (word >> back);
+        }
+    }
+
+    return used;
+}
+
+/*
+ * Every bitmap is preceded by two header words: the backend it came from
+ * and the length of the mapping.  Large bitmaps live in a sparse, unlinked
+ * file under PART_BITMAP_MMAP_DIR, so the kernel can write their pages back
+ * and drop them instead of keeping the whole map resident; untouched
+ * (all-free) regions never take any space at all.  Without such a file a
+ * large bitmap is only allocated when free memory can hold it, and NULL
+ * is returned otherwise.
+ */
 static inline unsigned long* pc_alloc_bitmap(ull bits)
 {
-	return (unsigned long*)calloc(PART_BYTES_PER_LONG, BITS_TO_LONGS(bits));
+    ull            size = (ull)PART_BYTES_PER_LONG * (BITS_TO_LONGS(bits) + 2);
+    unsigned long *map;
+    int            fd;
+
+    if (size > PART_BITMAP_MMAP_THRESHOLD)
+    {
+        fd = open(PART_BITMAP_MMAP_DIR, O_TMPFILE | O_RDWR | O_EXCL, S_IRUSR | S_IWUSR);
+        if (fd >= 0)
+        {
+            map = MAP_FAILED;
+            if (ftruncate(fd, size) == 0)
+                map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            close(fd);
+            if (map != MAP_FAILED)
+            {
+                map[0] = PART_BITMAP_MMAP;
+                map[1] = size;
+                return map + 2;
+            }
+        }
+        /// check_memory_size left this one out, it has to fit in free memory now
+        if (size > (ull)sysconf(_SC_AVPHYS_PAGES) * sysconf(_SC_PAGESIZE))
+        {
+            g_warning("bitmap of %llu bytes has no file to back it and does not fit in memory\n", size);
+            return NULL;
+        }
+        g_warning("bitmap of %llu bytes falls back to memory\n", size);
+    }
+    map = (unsigned long*)calloc(PART_BYTES_PER_LONG, BITS_TO_LONGS(bits) + 2);
+    if (map == NULL)
+        return NULL;
+    map[0] = PART_BITMAP_HEAP;
+    map[1] = size;
+
+    return map + 2;
+}
+
+static inline void pc_free_bitmap(unsigned long* bitmap)
+{
+    unsigned long *map;
+
+    if (!bitmap)
+        return;
+    map = bitmap - 2;
+    if (map[0] == PART_BITMAP_MMAP)
+        munmap(map, map[1]);
+    else
+        free(map);
+}
+
+/// whether a bitmap of this many bits has to fit in memory
+static inline gboolean pc_bitmap_in_memory(ull bits)
+{
+    return (ull)PART_BYTES_PER_LONG * (BITS_TO_LONGS(bits) + 2) <= PART_BITMAP_MMAP_THRESHOLD;
 }
 
 static inline void pc_init_bitmap(unsigned long* bitmap, char value, unsigned long bits)
@@ -74,3 +266,107 @@ static inline void pc_init_bitmap(unsigned long* bitmap, char value, unsigned lo
 
 	memset(bitmap, value, byte_count);
 }
+
+/*
+ * Return the first bit >= start whose value differs from the 'skip' pattern
+ * (0UL looks for set bits, ~0UL looks for zero bits), or total if there is
+ * none.  Whole words equal to the pattern are skipped without testing
+ * individual bits.
+ */
+static inline ull
+pc_find_next_bit(const unsigned long *bitmap, ull total, ull start, unsigned long skip)
+{
+    ull idx, nwords;
+    unsigned long word;
+
+    if (!bitmap || start >= total)
+        return total;
+
+    nwords = BITS_TO_LONGS(total);
+    idx = start / PART_BITS_PER_LONG;
+    word = (bitmap[idx] ^ skip) & (~0UL << (start & (PART_BITS_PER_LONG - 1)));
+    while (!word)
+    {
+        if (++idx >= nwords)
+            return total;
+#if defined(__AVX2__) && defined(__LP64__)
+        /// long runs: compare 256 bits at a time
+        while (idx + 4 <= nwords)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(bitmap + idx));
+
+            if (skip ? !_mm256_testc_si256(v, _mm256_set1_epi64x(-1))
+                     : !_mm256_testz_si256(v, v))
+                break;
+            idx += 4;
+        }
+        if (idx >= nwords)
+            return total;
+#endif
+        word = bitmap[idx] ^ skip;
+    }
+    start = idx * PART_BITS_PER_LONG + __builtin_ctzl(word);
+
+    return start < total ? start : total;
+}
+
+/// first used block >= start, total if none
+static inline ull
+pc_find_next_set(const unsigned long *bitmap, ull total, ull start)
+{
+    return pc_find_next_bit(bitmap, total, start, 0UL);
+}
+
+/// first free block >= start, total if none
+static inline ull
+pc_find_next_zero(const unsigned long *bitmap, ull total, ull start)
+{
+    return pc_find_next_bit(bitmap, total, start, ~0UL);
+}
+
+/// number of used blocks in [0, total)
+static inline ull
+pc_count_bits(const unsigned long *bitmap, ull total)
+{
+    ull idx = 0, nwords, used = 0;
+    unsigned long rest;
+
+    if (!bitmap)
+        return 0;
+
+    nwords = total / PART_BITS_PER_LONG;
+#if defined(__AVX2__) && defined(__LP64__)
+    if (nwords >= 4)
+    {
+        /// nibble lookup popcount, summed per 64-bit lane with vpsadbw
+        const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3,
+                                                1, 2, 2, 3, 2, 3, 3, 4,
+                                                0, 1, 1, 2, 1, 2, 2, 3,
+                                                1, 2, 2, 3, 2, 3, 3, 4);
+        const __m256i low_mask = _mm256_set1_epi8(0x0f);
+        __m256i acc = _mm256_setzero_si256();
+
+        for (; idx + 4 <= nwords; idx += 4)
+        {
+            __m256i v  = _mm256_loadu_si256((const __m256i *)(bitmap + idx));
+            __m256i lo = _mm256_and_si256(v, low_mask);
+            __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+            __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+                                          _mm256_shuffle_epi8(lookup, hi));
+
+            acc = _mm256_add_epi64(acc, _mm256_sad_epu8(cnt, _mm256_setzero_si256()));
+        }
+        used += (ull)_mm256_extract_epi64(acc, 0) + (ull)_mm256_extract_epi64(acc, 1) +
+                (ull)_mm256_extract_epi64(acc, 2) + (ull)_mm256_extract_epi64(acc, 3);
+    }
+#endif
+    for (; idx < nwords; idx++)
+        used += __builtin_popcountl(bitmap[idx]);
+
+    /// the bits after total in the last word are not blocks
+    rest = total & (PART_BITS_PER_LONG - 1);
+    if (rest)
+        used += __builtin_popcountl(bitmap[idx] & ((1UL << rest) - 1));
+
+    return used;
+}
@@ -35,57 +35,183 @@ static const char *sysbak_error_message[10] =
 	"Failed to read bitmap",
 	"Not enough disk  space",
 	"Write header information failed",
-	"Failed reading and writing data"
+	"Failed reading and writing data",
 	"Failed reading image header"
 };
-static ull copied_count;
-struct btrfs_fs_info *info;
-struct btrfs_root *root;
-struct btrfs_path path;
-int block_size = 0;
-uint64_t dev_size = 0;
-unsigned long long total_block = 0;
+/// walker and reader threads of one job share its context
+typedef struct
+{
+    struct btrfs_fs_info *info;
+    struct btrfs_root    *root;
+    int                   block_size;
+    uint64_t              dev_size;
+    ull                   total_block;
+    gboolean              skip_dup_copies;  /// DUP copies come from the copy table
+    GArray               *mirror_ranges;    /// mirror_range sorted by physical
+    GPtrArray            *mirror_readers;
+    GArray               *copy_ranges;      /// image_copy_range of the DUP copies left out
+    GPtrArray            *parity_chunks;    /// parity_chunk sorted by physical
+    GMutex                bitmap_lock;
+    GMutex                visited_lock;
+} BtrfsContext;
+
+/// the job this thread works for, set by the job and each of its threads
+static __thread BtrfsContext *ctx;
 
 ///set useb block
 static void set_bitmap(unsigned long* bitmap, uint64_t pos, uint64_t length){
-    uint64_t block;
     uint64_t pos_block;
     uint64_t block_end;
 
-    if (pos > dev_size) {
+    if (pos > ctx->dev_size) {
 	return;
     }
-    pos_block = pos/block_size;
-    block_end = (pos+length)/block_size;
-    if ((pos+length)%block_size > 0)
+    pos_block = pos/ctx->block_size;
+    block_end = (pos+length)/ctx->block_size;
+    if ((pos+length)%ctx->block_size > 0)
 	block_end++;
 
-    for(block = pos_block; block < block_end; block++){
-	pc_set_bit(block, bitmap, total_block);
-    }
+    pc_set_range(pos_block, block_end - pos_block, bitmap, ctx->total_block);
 }
 
-static int check_extent_bitmap(unsigned long* bitmap, u64 bytenr, u64 *num_bytes, int type)
+/// chunk mapping of the last extent, sorted extents mostly stay in one chunk
+typedef struct
 {
-    struct btrfs_multi_bio *multi = NULL;
-    int mirror = 0;
-    u64 maxlen;
-    
-    if (*num_bytes % root->sectorsize)
-	return -EINVAL;
+    struct map_lookup *map;
+    u64                devid;     /// only stripes on the source device are marked
+    u64                run_start; /// pending logical run, merged until a gap
+    u64                run_len;
+} chunk_cursor;
+/// one per walker thread, runs meet the shared bitmap under bitmap_lock
+static __thread chunk_cursor cursor;
+
+static void cursor_reset(void)
+{
+    cursor.map = NULL;
+    cursor.devid = btrfs_stack_device_id(&ctx->info->super_copy->dev_item);
+    cursor.run_start = 0;
+    cursor.run_len = 0;
+}
+static struct map_lookup *cursor_find_chunk(u64 logical)
+{
+    struct cache_extent *ce;
 
-    if (type == 1){
-	maxlen = *num_bytes;
+    if (cursor.map != NULL &&
+        logical >= cursor.map->ce.start &&
+        logical <  cursor.map->ce.start + cursor.map->ce.size)
+    {
+        return cursor.map;
+    }
+    ce = search_cache_extent(&ctx->info->mapping_tree.cache_tree, logical);
+    if (ce == NULL || ce->start > logical)
+    {
+        return NULL;
     }
+    cursor.map = container_of(ce, struct map_lookup, ce);
+    return cursor.map;
+}
+/// mark one piece that does not cross a stripe boundary
+static void mark_chunk_piece(ul *bitmap, struct map_lookup *map, u64 offset, u64 length)
+{
+    u64 stripe_nr = offset / map->stripe_len;
+    u64 stripe_offset = offset % map->stripe_len;
+    u64 physical = offset;
+    int first = 0;
+    int count = map->num_stripes;
+    int factor;
+    int nr_data;
+    int i;
 
-    btrfs_map_block(&info->mapping_tree, READ, bytenr, num_bytes,
-	    &multi, mirror, NULL);
+    if (map->type & BTRFS_BLOCK_GROUP_RAID0)
+    {
+        first = stripe_nr % map->num_stripes;
+        count = 1;
+        physical = stripe_nr / map->num_stripes * map->stripe_len + stripe_offset;
+    }
+    else if (map->type & BTRFS_BLOCK_GROUP_RAID10)
+    {
+        factor = map->num_stripes / map->sub_stripes;
+        first = (stripe_nr % factor) * map->sub_stripes;
+        count = map->sub_stripes;
+        physical = stripe_nr / factor * map->stripe_len + stripe_offset;
+    }
+    else if (map->type & (BTRFS_BLOCK_GROUP_RAID5 | BTRFS_BLOCK_GROUP_RAID6))
+    {
+        /// the whole row on every device, parity rotates across them
+        nr_data = map->num_stripes - ((map->type & BTRFS_BLOCK_GROUP_RAID6) ? 2 : 1);
+        physical = stripe_nr / nr_data * map->stripe_len + stripe_offset;
+    }
+    else if ((map->type & BTRFS_BLOCK_GROUP_DUP) && ctx->skip_dup_copies)
+    {
+        count = 1;      /// the second copy is rebuilt from the copy table
+    }
+    /// single, DUP and RAID1 keep the same offset in every copy
 
-    if (type == 1){
-        *num_bytes = maxlen;
+    for (i = first; i < first + count; i++)
+    {
+        if (map->stripes[i].dev == NULL ||
+            map->stripes[i].dev->devid != cursor.devid)
+        {
+            continue;
+        }
+        set_bitmap(bitmap, map->stripes[i].physical + physical, length);
+    }
+}
+static void mark_logical_range(ul *bitmap, u64 logical, u64 length)
+{
+    struct map_lookup *map;
+    u64 offset;
+    u64 piece;
+    u64 chunk_left;
+
+    while (length > 0)
+    {
+        map = cursor_find_chunk(logical);
+        if (map == NULL)
+        {
+            return;
+        }
+        offset = logical - map->ce.start;
+        chunk_left = map->ce.size - offset;
+        piece = MIN(length, chunk_left);
+        if (map->type & (BTRFS_BLOCK_GROUP_RAID0 | BTRFS_BLOCK_GROUP_RAID10 |
+                         BTRFS_BLOCK_GROUP_RAID5 | BTRFS_BLOCK_GROUP_RAID6))
+        {
+            piece = MIN(piece, map->stripe_len - offset % map->stripe_len);
+        }
+        mark_chunk_piece(bitmap, map, offset, piece);
+        logical += piece;
+        length -= piece;
+    }
+}
+/// map the pending run, call once more after the last extent
+static void flush_extent_run(ul *bitmap)
+{
+    if (cursor.run_len > 0)
+    {
+        g_mutex_lock(&ctx->bitmap_lock);
+        mark_logical_range(bitmap, cursor.run_start, cursor.run_len);
+        g_mutex_unlock(&ctx->bitmap_lock);
     }
+    cursor.run_len = 0;
+}
+/// queue a logical extent, touching or overlapping extents become one run
+static int check_extent_bitmap(ul *bitmap, u64 bytenr, u64 num_bytes)
+{
+    u64 run_end = cursor.run_start + cursor.run_len;
+
+    if (num_bytes == 0 || num_bytes % ctx->root->sectorsize)
+	return -EINVAL;
 
-    set_bitmap(bitmap, multi->stripes[0].physical, *num_bytes);
+    if (cursor.run_len > 0 && bytenr >= cursor.run_start && bytenr <= run_end)
+    {
+        if (bytenr + num_bytes > run_end)
+            cursor.run_len = bytenr + num_bytes - cursor.run_start;
+        return 0;
+    }
+    flush_extent_run(bitmap);
+    cursor.run_start = bytenr;
+    cursor.run_len = num_bytes;
     return 0;
 }
 
@@ -96,84 +222,315 @@ static void dump_file_extent_item(unsigned long* bitmap, struct extent_buffer *e
 {
 	int extent_type = btrfs_file_extent_type(eb, fi);
 
+	u64 disk_bytenr;
+	u64 num_bytes;
+
 	if (extent_type == BTRFS_FILE_EXTENT_INLINE) {
 	    return;
 	}
-	set_bitmap(bitmap, (unsigned long long)btrfs_file_extent_disk_bytenr(eb, fi),
-		                   (unsigned long long)btrfs_file_extent_disk_num_bytes(eb, fi) );
+	/// disk_bytenr is a logical address, 0 is a hole
+	disk_bytenr = btrfs_file_extent_disk_bytenr(eb, fi);
+	num_bytes = btrfs_file_extent_disk_num_bytes(eb, fi);
+	if (disk_bytenr == 0)
+	    return;
+	check_extent_bitmap(bitmap, disk_bytenr, num_bytes);
 }
-static void dump_start_leaf(ul    *bitmap, 
-                            struct btrfs_root *btr_root, 
-                            struct extent_buffer *eb, 
-                            int    follow)
+#define BTRFS_WALK_MAX_THREADS 8
+
+/// one level of the tree walk, the node and the next child to visit
+typedef struct
+{
+    struct extent_buffer *eb;
+    u32                   slot;
+} walk_frame;
+
+/// remember a tree block, FALSE when an earlier root already reached it
+static gboolean visit_tree_block(GHashTable *visited, u64 bytenr)
+{
+    gint64  *key;
+    gboolean first;
+
+    key = g_new(gint64, 1);
+    *key = (gint64)bytenr;
+    g_mutex_lock(&ctx->visited_lock);
+    first = g_hash_table_add(visited, key);
+    g_mutex_unlock(&ctx->visited_lock);
+
+    return first;
+}
+static gboolean tree_block_visited(GHashTable *visited, u64 bytenr)
 {
+    gboolean found;
+
+    g_mutex_lock(&ctx->visited_lock);
+    found = g_hash_table_contains(visited, &bytenr);
+    g_mutex_unlock(&ctx->visited_lock);
 
+    return found;
+}
+/// start reading every child of a node before the walk descends into it
+static void readahead_children(struct btrfs_root    *btr_root,
+                               struct extent_buffer *eb,
+                               GHashTable           *visited)
+{
     u64 bytenr;
-    u64 size;
+    u32 nr;
+    u32 i;
+
+    if (btrfs_is_leaf(eb))
+        return;
+    nr = btrfs_header_nritems(eb);
+    for (i = 0; i < nr; i++)
+    {
+        bytenr = btrfs_node_blockptr(eb, i);
+        if (tree_block_visited(visited, bytenr))
+            continue;
+        readahead_tree_block(btr_root, bytenr, btr_root->nodesize,
+                             btrfs_node_ptr_generation(eb, i));
+    }
+}
+static void mark_tree_block(ul *bitmap, u64 bytenr)
+{
+    u64 size = (u64)ctx->root->nodesize;
+
+    check_extent_bitmap(bitmap, bytenr, size);
+}
+static void dump_leaf_items(ul *bitmap, struct extent_buffer *eb)
+{
     u64 objectid;
     u64 offset;
-    u64 parent_transid;
     u32 type;
     u32 nr;
     uint i;
     struct btrfs_item *item;
     struct btrfs_disk_key disk_key;
     struct btrfs_file_extent_item *fi;
-    struct extent_buffer *next;
-    u32 leaf_size;
 
-    if (!eb)
-	return;
     nr = btrfs_header_nritems(eb);
-    if (btrfs_is_leaf(eb)) 
+    for (i = 0 ; i < nr ; i++) 
     {
-	    size = (u64)root->nodesize;
-	    bytenr = (unsigned long long)btrfs_header_bytenr(eb);
-	    check_extent_bitmap(bitmap, bytenr, &size, 0);
-        for (i = 0 ; i < nr ; i++) 
+        item = btrfs_item_nr(i);
+        btrfs_item_key(eb, &disk_key, i);
+        type = btrfs_disk_key_type(&disk_key);
+        if (type == BTRFS_EXTENT_DATA_KEY)
         {
-	        item = btrfs_item_nr(i);
-	        btrfs_item_key(eb, &disk_key, i);
-	        type = btrfs_disk_key_type(&disk_key);
-	        if (type == BTRFS_EXTENT_DATA_KEY)
-            {
-		        fi = btrfs_item_ptr(eb, i,
-			                        struct btrfs_file_extent_item);
-		        dump_file_extent_item(bitmap, eb, item, i, fi);
-	        }
-	        if (type == BTRFS_EXTENT_ITEM_KEY)
-            {
-		        objectid = btrfs_disk_key_objectid(&disk_key);
-		        offset = btrfs_disk_key_offset(&disk_key);
-		        check_extent_bitmap(bitmap, objectid, &offset, 1);
-	        }
-	    }
-	    return;
+            fi = btrfs_item_ptr(eb, i,
+                                struct btrfs_file_extent_item);
+            dump_file_extent_item(bitmap, eb, item, i, fi);
+        }
+        if (type == BTRFS_EXTENT_ITEM_KEY)
+        {
+            objectid = btrfs_disk_key_objectid(&disk_key);
+            offset = btrfs_disk_key_offset(&disk_key);
+            check_extent_bitmap(bitmap, objectid, offset);
+        }
     }
-    if (!follow)
-	    return;
-    leaf_size = btr_root->nodesize;
-    for (i = 0; i < nr; i++) 
+}
+/******************************************************************************
+ * Function:              walk_subtree      
+ *        
+ * Explain: Walk the tree below eb depth first with an explicit stack.
+ *          Snapshots share their subtrees, so every block goes through
+ *          the visited set and a shared subtree is read and walked once
+ *          for all the roots that point at it.  The children of a node
+ *          are read ahead before the first of them is read.
+ *        
+ * Input:   @bitmap       image bitmap
+ *          @btr_root     root the tree belongs to
+ *          @eb           top of the tree, already visited and marked
+ *          @visited      tree block bytenrs already walked in this job
+ ******************************************************************************/
+static void walk_subtree(ul                   *bitmap, 
+                         struct btrfs_root    *btr_root, 
+                         struct extent_buffer *eb, 
+                         GHashTable           *visited)
+{
+    walk_frame            stack[BTRFS_MAX_LEVEL + 1];
+    walk_frame           *frame;
+    struct extent_buffer *next;
+    u64                   bytenr;
+    u64                   parent_transid;
+    int                   depth = 0;
+
+    stack[0].eb = eb;
+    stack[0].slot = 0;
+    readahead_children(btr_root, eb, visited);
+
+    while (depth >= 0)
     {
-	    bytenr = (unsigned long long)btrfs_header_bytenr(eb);
-	    check_extent_bitmap(bitmap, bytenr, &size, 0);
-	    bytenr = btrfs_node_blockptr(eb, i);
-        parent_transid = btrfs_node_ptr_generation(eb, i);
-        next = read_tree_block(btr_root,bytenr,leaf_size,parent_transid);
-	    bytenr = (unsigned long long)btrfs_header_bytenr(next);
-	    check_extent_bitmap(bitmap, bytenr, &size, 0);
-	    if (!extent_buffer_uptodate(next)) 
+        frame = &stack[depth];
+        if (btrfs_is_leaf(frame->eb) || 
+            frame->slot >= btrfs_header_nritems(frame->eb) ||
+            depth == BTRFS_MAX_LEVEL)
         {
-	        continue;
-	    }
-	    dump_start_leaf(bitmap, btr_root, next, 1);
-	    free_extent_buffer(next);
+            if (btrfs_is_leaf(frame->eb))
+                dump_leaf_items(bitmap, frame->eb);
+            if (depth > 0)
+                free_extent_buffer(frame->eb);
+            depth--;
+            continue;
+        }
+        bytenr = btrfs_node_blockptr(frame->eb, frame->slot);
+        parent_transid = btrfs_node_ptr_generation(frame->eb, frame->slot);
+        frame->slot++;
+        if (!visit_tree_block(visited, bytenr))
+            continue;
+        mark_tree_block(bitmap, bytenr);
+        next = read_tree_block(btr_root, bytenr, btr_root->nodesize, parent_transid);
+        if (!extent_buffer_uptodate(next)) 
+        {
+            free_extent_buffer(next);
+            continue;
+        }
+        readahead_children(btr_root, next, visited);
+        depth++;
+        stack[depth].eb = next;
+        stack[depth].slot = 0;
     }
+}
+/// walk a whole tree from its root node, owned by the caller
+static void dump_start_leaf(ul                   *bitmap, 
+                            struct btrfs_root    *btr_root, 
+                            struct extent_buffer *eb, 
+                            GHashTable           *visited)
+{
+    if (!eb || !visit_tree_block(visited, btrfs_header_bytenr(eb)))
+        return;
+    mark_tree_block(bitmap, btrfs_header_bytenr(eb));
+    walk_subtree(bitmap, btr_root, eb, visited);
+}
+
+/// a subtree handed to a walker thread
+typedef struct
+{
+    u64 bytenr;
+    u64 transid;
+} walk_job;
+
+typedef struct
+{
+    BtrfsContext      *ctx;
+    ul                *bitmap;
+    struct btrfs_root *btr_root;
+    GHashTable        *visited;
+    GArray            *jobs;
+    gint               next_job;
+} BtrfsTreeWalk;
 
+static void add_walk_job(GArray *jobs, u64 bytenr, u64 transid)
+{
+    walk_job job;
+
+    job.bytenr = bytenr;
+    job.transid = transid;
+    g_array_append_val(jobs, job);
 }
+static gpointer walk_tree_thread (gpointer data)
+{
+    BtrfsTreeWalk        *walk = data;
+    walk_job             *job;
+    struct extent_buffer *eb;
+    gint                  n;
 
-/// open device
-static gboolean fs_open(char* device)
+    ctx = walk->ctx;
+    cursor_reset();
+    while (1)
+    {
+        n = g_atomic_int_add(&walk->next_job, 1);
+        if (n >= (gint)walk->jobs->len)
+            break;
+        job = &g_array_index(walk->jobs, walk_job, n);
+        if (!visit_tree_block(walk->visited, job->bytenr))
+            continue;
+        mark_tree_block(walk->bitmap, job->bytenr);
+        eb = read_tree_block(walk->btr_root, job->bytenr, 
+                             walk->btr_root->nodesize, job->transid);
+        if (extent_buffer_uptodate(eb))
+            walk_subtree(walk->bitmap, walk->btr_root, eb, walk->visited);
+        free_extent_buffer(eb);
+    }
+    flush_extent_run(walk->bitmap);
+
+    return NULL;
+}
+/******************************************************************************
+ * Function:              walk_trees_parallel      
+ *        
+ * Explain: Walk the trees whose root nodes are in roots with worker
+ *          threads.  Root nodes are read here and their children become
+ *          the jobs, so a single big fs tree is still spread over all
+ *          the workers.  Readahead of the whole next level keeps the
+ *          device busy while the workers wait on their own blocks.
+ *        
+ * Input:   @bitmap       image bitmap
+ *          @btr_root     root used to read the blocks
+ *          @roots        u64 bytenrs of the root nodes
+ *          @visited      tree block bytenrs already walked in this job
+ ******************************************************************************/
+static void walk_trees_parallel(ul                *bitmap, 
+                                struct btrfs_root *btr_root, 
+                                GArray            *roots,
+                                GHashTable        *visited)
+{
+    BtrfsTreeWalk         walk;
+    GThread              *threads[BTRFS_WALK_MAX_THREADS];
+    struct extent_buffer *eb;
+    u64                   bytenr;
+    guint                 nthreads;
+    guint                 i;
+    u32                   slot;
+
+    for (i = 0; i < roots->len; i++)
+    {
+        readahead_tree_block(btr_root, g_array_index(roots, u64, i), 
+                             btr_root->nodesize, 0);
+    }
+    walk.ctx = ctx;
+    walk.bitmap = bitmap;
+    walk.btr_root = btr_root;
+    walk.visited = visited;
+    walk.next_job = 0;
+    walk.jobs = g_array_new(FALSE, FALSE, sizeof(walk_job));
+    for (i = 0; i < roots->len; i++)
+    {
+        bytenr = g_array_index(roots, u64, i);
+        if (!visit_tree_block(visited, bytenr))
+            continue;
+        mark_tree_block(bitmap, bytenr);
+        eb = read_tree_block(btr_root, bytenr, btr_root->nodesize, 0);
+        if (!extent_buffer_uptodate(eb))
+        {
+            free_extent_buffer(eb);
+            continue;
+        }
+        if (btrfs_is_leaf(eb))
+        {
+            dump_leaf_items(bitmap, eb);
+        }
+        else
+        {
+            readahead_children(btr_root, eb, visited);
+            for (slot = 0; slot < btrfs_header_nritems(eb); slot++)
+            {
+                add_walk_job(walk.jobs, btrfs_node_blockptr(eb, slot),
+                             btrfs_node_ptr_generation(eb, slot));
+            }
+        }
+        free_extent_buffer(eb);
+    }
+    /// the main thread's runs must reach the bitmap before workers start
+    flush_extent_run(bitmap);
+
+    nthreads = MIN(walk.jobs->len, BTRFS_WALK_MAX_THREADS);
+    for (i = 0; i < nthreads; i++)
+        threads[i] = g_thread_new("btrfs-walk", walk_tree_thread, &walk);
+    for (i = 0; i < nthreads; i++)
+        g_thread_join(threads[i]);
+    g_array_free(walk.jobs, TRUE);
+}
+
+/// open device, the tree stays open for the whole job
+static gboolean fs_open(const char* device)
 {
     struct cache_tree root_cache;
     u64 bytenr = 0;
@@ -181,17 +538,16 @@ static gboolean fs_open(char* device)
 
     btrfs_radix_tree_init();
     cache_tree_init(&root_cache);
-    info = open_ctree_fs_info(device, bytenr, 0, 0, ctree_flags);
-    root = info->fs_root;
-
-    if (!info || !root) 
+    ctx->info = open_ctree_fs_info(device, bytenr, 0, 0, ctree_flags);
+    if (!ctx->info || !ctx->info->fs_root) 
     {
 	    return FALSE;
     }
+    ctx->root = ctx->info->fs_root;
 
-    if (!extent_buffer_uptodate(info->tree_root->node) ||
-	    !extent_buffer_uptodate(info->dev_root->node) ||
-	    !extent_buffer_uptodate(info->chunk_root->node)) 
+    if (!extent_buffer_uptodate(ctx->info->tree_root->node) ||
+	    !extent_buffer_uptodate(ctx->info->dev_root->node) ||
+	    !extent_buffer_uptodate(ctx->info->chunk_root->node)) 
     {
 	    return FALSE;
     }
@@ -202,11 +558,613 @@ static gboolean fs_open(char* device)
 /// close device
 static void fs_close(void)
 {
-    close_ctree(root);
+    if (ctx->root != NULL)
+    {
+        close_ctree(ctx->root);
+    }
+    ctx->info = NULL;
+    ctx->root = NULL;
+}
+/// another member device holding the same bytes as a range of the source
+typedef struct
+{
+    ull   physical;     /// range on the source device
+    ull   length;
+    guint reader;       /// index of the mirror_reader holding the copy
+    ull   mirror;       /// physical offset of the copy on that device
+} mirror_range;
+
+/// one reader thread per member device, reader 0 is the source device
+typedef struct
+{
+    int          fd;
+    u64          devid;
+    GThreadPool *pool;
+    gint         load;  /// pieces queued, the least loaded copy is read
+} mirror_reader;
+
+typedef struct
+{
+    BtrfsContext *ctx;
+    GMutex        lock;
+    GCond         cond;
+    gint          pending;
+    gboolean      failed;
+} read_batch;
+
+typedef struct
+{
+    read_batch    *batch;
+    mirror_reader *reader;
+    char          *buffer;
+    ull            offset;
+    ull            length;
+} read_piece;
+
+#define MIRROR_PIECE_SIZE  (256 * 1024)
+
+
+/// a RAID5/6 chunk striped over the source device, to rebuild failed reads
+typedef struct
+{
+    ull   physical;         /// stripe of the source device
+    ull   length;
+    int   num_stripes;
+    int   nr_parity;
+    int   stripe_len;
+    int   self;             /// stripe index of the source device
+    struct
+    {
+        guint reader;       /// G_MAXUINT when the member is missing
+        ull   physical;
+    } stripes[];
+} parity_chunk;
+
+static gboolean read_device_range (int fd, char *buffer, ull length, ull offset)
+{
+    ull     done = 0;
+    ssize_t size;
+
+    while (done < length)
+    {
+        size = pread(fd, buffer + done, length - done, (off_t)(offset + done));
+        if (size <= 0)
+            return FALSE;
+        done += size;
+    }
+    return TRUE;
+}
+/******************************************************************************
+ * Function:              rebuild_parity_block      
+ *        
+ * Explain: Rebuild a block of the source device from the rest of its
+ *          full stripe.  The other members are read, the lost blocks
+ *          (the source one and any member that is missing or fails) are
+ *          recovered from P, or from P and Q for RAID6.
+ *        
+ * Input:   @chunk        parity chunk holding the block
+ *          @offset       source device offset, within one stripe_len
+ *          @buffer       receives the block
+ ******************************************************************************/
+static gboolean rebuild_parity_block (parity_chunk *chunk, ull offset,
+                                      char *buffer, ull length)
+{
+    mirror_reader *reader;
+    void          *ptrs[chunk->num_stripes];
+    int            lost[chunk->num_stripes];
+    int            nlost = 0;
+    int            nr_data = chunk->num_stripes - chunk->nr_parity;
+    int            num = chunk->num_stripes;
+    int            rot, role, k;
+    ull            o = offset - chunk->physical;
+    gboolean       ret = FALSE;
+
+    /// the roles rotate by one device every full stripe
+    rot = (o / chunk->stripe_len) % num;
+    for (k = 0; k < num; k++)
+    {
+        role = (k - rot + num) % num;
+        if (k == chunk->self)
+        {
+            ptrs[role] = buffer;
+            lost[nlost++] = role;
+            continue;
+        }
+        ptrs[role] = g_malloc(length);
+        if (chunk->stripes[k].reader == G_MAXUINT)
+        {
+            lost[nlost++] = role;
+            continue;
+        }
+        reader = g_ptr_array_index(ctx->mirror_readers, chunk->stripes[k].reader);
+        if (!read_device_range(reader->fd, ptrs[role], length, 
+                               chunk->stripes[k].physical + o))
+        {
+            lost[nlost++] = role;
+        }
+    }
+    if (nlost > chunk->nr_parity)
+        goto out;
+    if (nlost == 2 && lost[0] > lost[1])
+    {
+        k = lost[0];
+        lost[0] = lost[1];
+        lost[1] = k;
+    }
+    if (chunk->nr_parity == 1)
+    {
+        raid5_recov(num, length, lost[0], ptrs);
+    }
+    else if (nlost == 1 && lost[0] == nr_data + 1)
+    {
+        raid6_gen_syndrome(num, length, ptrs);
+    }
+    else if (nlost == 1 || lost[1] == nr_data + 1)
+    {
+        /// data or P from the xor of the others, then Q if it was lost
+        raid5_recov(num - 1, length, lost[0], ptrs);
+        if (nlost == 2)
+            raid6_gen_syndrome(num, length, ptrs);
+    }
+    else if (lost[1] == nr_data)
+    {
+        if (raid6_datap_recov(num, length, lost[0], ptrs) != 0)
+            goto out;
+    }
+    else if (raid6_2data_recov(num, length, lost[0], lost[1], ptrs) != 0)
+    {
+        goto out;
+    }
+    ret = TRUE;
+out:
+    for (k = 0; k < num; k++)
+    {
+        if (ptrs[k] != buffer)
+            g_free(ptrs[k]);
+    }
+    return ret;
+}
+/// rebuild a failed read of the source device that lies in RAID5/6 chunks
+static gboolean rebuild_parity_range (ull offset, char *buffer, ull length)
+{
+    parity_chunk *chunk = NULL;
+    ull           size;
+    guint         i;
+
+    while (length > 0)
+    {
+        for (i = 0; i < ctx->parity_chunks->len; i++)
+        {
+            chunk = g_ptr_array_index(ctx->parity_chunks, i);
+            if (offset >= chunk->physical && offset < chunk->physical + chunk->length)
+                break;
+        }
+        if (i == ctx->parity_chunks->len)
+            return FALSE;
+        size = MIN(length, chunk->stripe_len - (offset - chunk->physical) % chunk->stripe_len);
+        size = MIN(size, chunk->physical + chunk->length - offset);
+        if (!rebuild_parity_block(chunk, offset, buffer, size))
+            return FALSE;
+        buffer += size;
+        offset += size;
+        length -= size;
+    }
+    return TRUE;
+}
+static void read_piece_func (gpointer data, gpointer user_data)
+{
+    read_piece *piece = data;
+    gboolean    done;
+
+    /// the pool threads are shared, the piece says which job it is for
+    ctx = piece->batch->ctx;
+    done = read_device_range(piece->reader->fd, piece->buffer, 
+                             piece->length, piece->offset);
+    /// a bad sector of the source is rebuilt from the rest of its stripe
+    if (!done && piece->reader == g_ptr_array_index(ctx->mirror_readers, 0))
+        done = rebuild_parity_range(piece->offset, piece->buffer, piece->length);
+    g_atomic_int_add(&piece->reader->load, -1);
+    g_mutex_lock(&piece->batch->lock);
+    if (!done)
+        piece->batch->failed = TRUE;
+    piece->batch->pending--;
+    g_cond_signal(&piece->batch->cond);
+    g_mutex_unlock(&piece->batch->lock);
+    g_free(piece);
+}
+static guint get_mirror_reader (struct btrfs_device *dev)
+{
+    mirror_reader *reader;
+    guint          i;
+
+    for (i = 0; i < ctx->mirror_readers->len; i++)
+    {
+        reader = g_ptr_array_index(ctx->mirror_readers, i);
+        if (reader->devid == dev->devid)
+            return i;
+    }
+    reader = g_new0(mirror_reader, 1);
+    reader->fd = dup(dev->fd);      /// outlives close_ctree
+    reader->devid = dev->devid;
+    reader->pool = g_thread_pool_new(read_piece_func, NULL, 1, FALSE, NULL);
+    g_ptr_array_add(ctx->mirror_readers, reader);
+
+    return ctx->mirror_readers->len - 1;
+}
+static gint compare_mirror_range (gconstpointer a, gconstpointer b)
+{
+    const mirror_range *ra = a;
+    const mirror_range *rb = b;
+
+    if (ra->physical != rb->physical)
+        return ra->physical < rb->physical ? -1 : 1;
+    return 0;
+}
+static void add_chunk_mirrors (struct map_lookup *map, u64 devid, ull stripe_size)
+{
+    mirror_range range;
+    int          group = map->num_stripes;
+    int          i, j;
+
+    if (map->type & BTRFS_BLOCK_GROUP_RAID10)
+        group = map->sub_stripes;
+    for (i = 0; i < map->num_stripes; i++)
+    {
+        if (map->stripes[i].dev == NULL || map->stripes[i].dev->devid != devid)
+            continue;
+        for (j = i - i % group; j < i - i % group + group; j++)
+        {
+            if (j == i || map->stripes[j].dev == NULL ||
+                map->stripes[j].dev->devid == devid ||
+                map->stripes[j].dev->fd <= 0)
+            {
+                continue;
+            }
+            range.physical = map->stripes[i].physical;
+            range.length = stripe_size;
+            range.reader = get_mirror_reader(map->stripes[j].dev);
+            range.mirror = map->stripes[j].physical;
+            g_array_append_val(ctx->mirror_ranges, range);
+        }
+    }
+}
+static void add_parity_chunk (struct map_lookup *map, u64 devid, ull stripe_size)
+{
+    parity_chunk *chunk;
+    int           i;
+
+    chunk = g_malloc0(sizeof(parity_chunk) + map->num_stripes * sizeof(chunk->stripes[0]));
+    chunk->self = -1;
+    chunk->num_stripes = map->num_stripes;
+    chunk->nr_parity = (map->type & BTRFS_BLOCK_GROUP_RAID6) ? 2 : 1;
+    chunk->stripe_len = map->stripe_len;
+    chunk->length = stripe_size;
+    for (i = 0; i < map->num_stripes; i++)
+    {
+        chunk->stripes[i].physical = map->stripes[i].physical;
+        chunk->stripes[i].reader = G_MAXUINT;
+        if (map->stripes[i].dev == NULL)
+            continue;
+        if (map->stripes[i].dev->devid == devid)
+        {
+            chunk->self = i;
+            chunk->physical = map->stripes[i].physical;
+            chunk->stripes[i].reader = 0;
+        }
+        else if (map->stripes[i].dev->fd > 0)
+        {
+            chunk->stripes[i].reader = get_mirror_reader(map->stripes[i].dev);
+        }
+    }
+    if (chunk->self < 0)
+    {
+        g_free(chunk);
+        return;
+    }
+    g_ptr_array_add(ctx->parity_chunks, chunk);
+}
+/******************************************************************************
+ * Function:              build_chunk_layout      
+ *        
+ * Explain: Record where the bytes of the source device are duplicated.
+ *          RAID1 and RAID10 copies on other member devices become extra
+ *          read sources for the copy phase, and RAID5/6 members let a
+ *          failed read of the source be rebuilt from parity.  With lean
+ *          set, the second copy of every DUP chunk is left out of the
+ *          bitmap and kept as a copy range, so restore writes it from
+ *          the first copy.
+ *        
+ * Input:   @source_fd    source device opened for the copy phase
+ *          @lean         leave the DUP copies out
+ ******************************************************************************/
+static void build_chunk_layout (int source_fd, gboolean lean)
+{
+    struct cache_extent *ce;
+    struct map_lookup   *map;
+    mirror_reader       *reader;
+    image_copy_range     copy;
+    u64                  devid;
+    int                  nr_data;
+
+    devid = btrfs_stack_device_id(&ctx->info->super_copy->dev_item);
+    ctx->mirror_ranges = g_array_new(FALSE, FALSE, sizeof(mirror_range));
+    ctx->copy_ranges = g_array_new(FALSE, FALSE, sizeof(image_copy_range));
+    ctx->mirror_readers = g_ptr_array_new();
+    ctx->parity_chunks = g_ptr_array_new_with_free_func(g_free);
+    reader = g_new0(mirror_reader, 1);
+    reader->fd = source_fd;
+    reader->devid = devid;
+    reader->pool = g_thread_pool_new(read_piece_func, NULL, 1, FALSE, NULL);
+    g_ptr_array_add(ctx->mirror_readers, reader);
+
+    for (ce = first_cache_extent(&ctx->info->mapping_tree.cache_tree); ce != NULL; 
+         ce = next_cache_extent(ce))
+    {
+        map = container_of(ce, struct map_lookup, ce);
+        if (map->type & BTRFS_BLOCK_GROUP_RAID1)
+        {
+            add_chunk_mirrors(map, devid, ce->size);
+        }
+        else if (map->type & BTRFS_BLOCK_GROUP_RAID10)
+        {
+            add_chunk_mirrors(map, devid, 
+                              ce->size * map->sub_stripes / map->num_stripes);
+        }
+        else if (map->type & (BTRFS_BLOCK_GROUP_RAID5 | BTRFS_BLOCK_GROUP_RAID6))
+        {
+            nr_data = map->num_stripes - ((map->type & BTRFS_BLOCK_GROUP_RAID6) ? 2 : 1);
+            add_parity_chunk(map, devid, ce->size / nr_data);
+        }
+        else if (lean && (map->type & BTRFS_BLOCK_GROUP_DUP) && 
+                 map->num_stripes == 2 &&
+                 map->stripes[0].dev && map->stripes[0].dev->devid == devid &&
+                 map->stripes[1].dev && map->stripes[1].dev->devid == devid)
+        {
+            copy.target = map->stripes[1].physical;
+            copy.source = map->stripes[0].physical;
+            copy.length = ce->size;
+            g_array_append_val(ctx->copy_ranges, copy);
+        }
+    }
+    g_array_sort(ctx->mirror_ranges, compare_mirror_range);
+    ctx->skip_dup_copies = ctx->copy_ranges->len > 0;
 }
-static gboolean read_bitmap_info (char* device, file_system_info fs_info, ul *bitmap)
+static void free_chunk_layout (void)
 {
+    mirror_reader *reader;
+    guint          i;
 
+    if (ctx->mirror_readers != NULL)
+    {
+        for (i = 0; i < ctx->mirror_readers->len; i++)
+        {
+            reader = g_ptr_array_index(ctx->mirror_readers, i);
+            g_thread_pool_free(reader->pool, FALSE, TRUE);
+            if (i > 0 && reader->fd > 0)
+                close(reader->fd);
+            g_free(reader);
+        }
+        g_ptr_array_free(ctx->mirror_readers, TRUE);
+    }
+    if (ctx->mirror_ranges != NULL)
+        g_array_free(ctx->mirror_ranges, TRUE);
+    if (ctx->copy_ranges != NULL)
+        g_array_free(ctx->copy_ranges, TRUE);
+    if (ctx->parity_chunks != NULL)
+        g_ptr_array_free(ctx->parity_chunks, TRUE);
+    ctx->parity_chunks = NULL;
+    ctx->mirror_readers = NULL;
+    ctx->mirror_ranges = NULL;
+    ctx->copy_ranges = NULL;
+    ctx->skip_dup_copies = FALSE;
+}
+/// every job starts on an empty context of its own
+static void context_init (BtrfsContext *context)
+{
+    memset(context, 0, sizeof(BtrfsContext));
+    g_mutex_init(&context->bitmap_lock);
+    g_mutex_init(&context->visited_lock);
+    ctx = context;
+}
+static void context_clear (BtrfsContext *context)
+{
+    g_mutex_clear(&context->bitmap_lock);
+    g_mutex_clear(&context->visited_lock);
+    ctx = NULL;
+}
+/// superblocks differ per device, cut the piece so they come from the source
+static gboolean clip_super_block (ull offset, ull *size)
+{
+    ull sb_offset;
+    int mirror;
+
+    for (mirror = 0; mirror < BTRFS_SUPER_MIRROR_MAX; mirror++)
+    {
+        sb_offset = btrfs_sb_offset(mirror);
+        if (offset >= sb_offset && offset < sb_offset + BTRFS_SUPER_INFO_SIZE)
+        {
+            *size = MIN(*size, sb_offset + BTRFS_SUPER_INFO_SIZE - offset);
+            return TRUE;
+        }
+        if (offset < sb_offset && offset + *size > sb_offset)
+            *size = sb_offset - offset;
+    }
+    return FALSE;
+}
+/// first mirror range that ends past offset
+static guint find_mirror_range (ull offset)
+{
+    mirror_range *range;
+    guint         low = 0, high = ctx->mirror_ranges->len, mid;
+
+    while (low < high)
+    {
+        mid = (low + high) / 2;
+        range = &g_array_index(ctx->mirror_ranges, mirror_range, mid);
+        if (range->physical + range->length <= offset)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+/******************************************************************************
+ * Function:              read_source_blocks      
+ *        
+ * Explain: Read [offset, offset + length) of the source device.  Pieces
+ *          that are mirrored on other member devices go to whichever
+ *          device has the fewest pieces queued, and every device reads
+ *          on its own thread, so a mirrored array is read at the speed
+ *          of all its disks.
+ *        
+ * Output:  success      :TRUE
+ *          fail         :FALSE, a piece could not be read in full
+ ******************************************************************************/
+static gboolean read_source_blocks (int *dfr, char *buffer, ull offset, ull length)
+{
+    read_batch     batch;
+    read_piece    *piece;
+    mirror_reader *reader, *best;
+    mirror_range  *range;
+    ull            size, device_offset;
+    guint          first, i;
+
+    if (ctx->mirror_ranges == NULL || ctx->mirror_ranges->len == 0)
+    {
+        if (read_device_range(*dfr, buffer, length, offset))
+            return TRUE;
+        return ctx->parity_chunks != NULL && rebuild_parity_range(offset, buffer, length);
+    }
+    batch.ctx = ctx;
+    g_mutex_init(&batch.lock);
+    g_cond_init(&batch.cond);
+    batch.pending = 0;
+    batch.failed = FALSE;
+    while (length > 0)
+    {
+        size = MIN(length, MIRROR_PIECE_SIZE);
+        best = g_ptr_array_index(ctx->mirror_readers, 0);
+        device_offset = offset;
+        first = clip_super_block(offset, &size) ? ctx->mirror_ranges->len 
+                                                : find_mirror_range(offset);
+        if (first < ctx->mirror_ranges->len)
+        {
+            range = &g_array_index(ctx->mirror_ranges, mirror_range, first);
+            if (range->physical > offset)
+                size = MIN(size, range->physical - offset);
+        }
+        for (i = first; i < ctx->mirror_ranges->len; i++)
+        {
+            range = &g_array_index(ctx->mirror_ranges, mirror_range, i);
+            if (range->physical > offset)
+                break;
+            size = MIN(size, range->physical + range->length - offset);
+            reader = g_ptr_array_index(ctx->mirror_readers, range->reader);
+            if (g_atomic_int_get(&reader->load) < g_atomic_int_get(&best->load))
+            {
+                best = reader;
+                device_offset = range->mirror + (offset - range->physical);
+            }
+        }
+        piece = g_new(read_piece, 1);
+        piece->batch = &batch;
+        piece->reader = best;
+        piece->buffer = buffer;
+        piece->offset = device_offset;
+        piece->length = size;
+        g_atomic_int_inc(&best->load);
+        g_mutex_lock(&batch.lock);
+        batch.pending++;
+        g_mutex_unlock(&batch.lock);
+        g_thread_pool_push(best->pool, piece, NULL);
+        buffer += size;
+        offset += size;
+        length -= size;
+    }
+    g_mutex_lock(&batch.lock);
+    while (batch.pending > 0)
+        g_cond_wait(&batch.cond, &batch.lock);
+    g_mutex_unlock(&batch.lock);
+    g_cond_clear(&batch.cond);
+    g_mutex_clear(&batch.lock);
+
+    return !batch.failed;
+}
+/******************************************************************************
+ * Function:              scan_extent_tree      
+ *        
+ * Explain: Build the used bitmap from the allocator's own records.  Every
+ *          allocated data extent is an EXTENT_ITEM and every tree block an
+ *          EXTENT_ITEM or (skinny metadata) METADATA_ITEM in the extent
+ *          tree, so one pass over its leaves covers all trees, snapshots
+ *          included, at a cost that follows the number of extents.
+ *        
+ * Output:  success      :TRUE
+ *          fail         :FALSE, the extent tree could not be read
+ ******************************************************************************/
+static gboolean scan_extent_tree(ul *bitmap)
+{
+    struct btrfs_root    *extent_root = ctx->info->extent_root;
+    struct btrfs_path     ext_path;
+    struct btrfs_key      key;
+    struct extent_buffer *leaf;
+    u64                   num_bytes;
+    int                   ret;
+
+    if (!extent_root || !extent_buffer_uptodate(extent_root->node))
+        return FALSE;
+
+    btrfs_init_path(&ext_path);
+    ext_path.reada = 2;     /// read ahead every sibling leaf of the node
+    key.objectid = 0;
+    key.type = 0;
+    key.offset = 0;
+    ret = btrfs_search_slot(NULL, extent_root, &key, &ext_path, 0, 0);
+    if (ret < 0)
+    {
+        btrfs_release_path(&ext_path);
+        return FALSE;
+    }
+    while (1)
+    {
+        leaf = ext_path.nodes[0];
+        if (ext_path.slots[0] >= btrfs_header_nritems(leaf))
+        {
+            ret = btrfs_next_leaf(extent_root, &ext_path);
+            if (ret != 0)
+                break;
+            continue;
+        }
+        btrfs_item_key_to_cpu(leaf, &key, ext_path.slots[0]);
+        ext_path.slots[0]++;
+        if (key.type == BTRFS_EXTENT_ITEM_KEY)
+            num_bytes = key.offset;
+        else if (key.type == BTRFS_METADATA_ITEM_KEY)
+            num_bytes = (u64)ctx->root->nodesize;   /// offset holds the level
+        else
+            continue;
+        check_extent_bitmap(bitmap, key.objectid, num_bytes);
+    }
+    btrfs_release_path(&ext_path);
+
+    return ret > 0;
+}
+/// tree log blocks are not in the extent tree until the log is replayed
+static void walk_log_tree(ul *bitmap, GHashTable *visited)
+{
+    struct extent_buffer *buf;
+    u64 log_bytenr = btrfs_super_log_root(ctx->info->super_copy);
+
+    if (log_bytenr == 0)
+        return;
+    buf = read_tree_block(ctx->info->tree_root, log_bytenr, ctx->root->nodesize, 0);
+    if (extent_buffer_uptodate(buf))
+        dump_start_leaf(bitmap, ctx->info->tree_root, buf, visited);
+    free_extent_buffer(buf);
+}
+/// walk every tree from the root tree, used when the extent tree is unreadable
+static void walk_fs_trees(ul *bitmap, GHashTable *visited)
+{
     int ret;
     struct btrfs_root *tree_root_scan;
     struct btrfs_key key;
@@ -214,35 +1172,29 @@ static gboolean read_bitmap_info (char* device, file_system_info fs_info, ul *bi
     struct btrfs_key found_key;
     struct extent_buffer *leaf;
     struct btrfs_root_item ri;
+    struct btrfs_path path;
     ul offset;
-    struct extent_buffer *buf;
+    GArray *roots;
     uint slot;
     u64 bsize;
+    u64 root_bytenr;
 
-    total_block = fs_info.totalblock;
-    if (!fs_open(device))
-    {
-        return FALSE;
-    }    
-    dev_size = fs_info.device_size;
-    block_size  = btrfs_super_nodesize(info->super_copy);
-    bsize = (u64)block_size;
-    set_bitmap(bitmap, 0, BTRFS_SUPER_INFO_OFFSET); // some data like mbr maybe in
-    set_bitmap(bitmap, BTRFS_SUPER_INFO_OFFSET, block_size);
-    check_extent_bitmap(bitmap, btrfs_root_bytenr(&info->extent_root->root_item), &bsize, 0);
-    check_extent_bitmap(bitmap, btrfs_root_bytenr(&info->csum_root->root_item), &bsize, 0);
-    check_extent_bitmap(bitmap, btrfs_root_bytenr(&info->dev_root->root_item), &bsize, 0);
-    check_extent_bitmap(bitmap, btrfs_root_bytenr(&info->fs_root->root_item), &bsize, 0);
+    roots = g_array_new(FALSE, FALSE, sizeof(u64));
+    bsize = (u64)ctx->root->nodesize;
+    check_extent_bitmap(bitmap, btrfs_root_bytenr(&ctx->info->extent_root->root_item), bsize);
+    check_extent_bitmap(bitmap, btrfs_root_bytenr(&ctx->info->csum_root->root_item), bsize);
+    check_extent_bitmap(bitmap, btrfs_root_bytenr(&ctx->info->dev_root->root_item), bsize);
+    check_extent_bitmap(bitmap, btrfs_root_bytenr(&ctx->info->fs_root->root_item), bsize);
 
-    if (info->tree_root->node) 
+    if (ctx->info->tree_root->node) 
     {
-	    dump_start_leaf(bitmap, info->tree_root, info->tree_root->node, 1);
+	    dump_start_leaf(bitmap, ctx->info->tree_root, ctx->info->tree_root->node, visited);
     }
-    if (info->chunk_root->node) 
+    if (ctx->info->chunk_root->node) 
     {
-	    dump_start_leaf(bitmap, info->chunk_root, info->chunk_root->node, 1);
+	    dump_start_leaf(bitmap, ctx->info->chunk_root, ctx->info->chunk_root->node, visited);
     }
-    tree_root_scan = info->tree_root;
+    tree_root_scan = ctx->info->tree_root;
     btrfs_init_path(&path);
     if (!extent_buffer_uptodate(tree_root_scan->node))
 	goto no_node;
@@ -268,35 +1220,59 @@ static gboolean read_bitmap_info (char* device, file_system_info fs_info, ul *bi
 
 	    offset = btrfs_item_ptr_offset(leaf, slot);
 	    read_extent_buffer(leaf, &ri, offset, sizeof(ri));
-	    buf = read_tree_block(tree_root_scan,
-		    btrfs_root_bytenr(&ri),
-		    root->nodesize,
-		    0);
-	    if (!extent_buffer_uptodate(buf))
-		    goto next;
-	    dump_start_leaf(bitmap, tree_root_scan, buf, 1);
-	    free_extent_buffer(buf);
+	    root_bytenr = btrfs_root_bytenr(&ri);
+	    if (!tree_block_visited(visited, root_bytenr))
+		    g_array_append_val(roots, root_bytenr);
 	}
-next:
 	path.slots[0]++;
     }
+    walk_trees_parallel(bitmap, tree_root_scan, roots, visited);
 no_node:
     btrfs_release_path(&path);
+    g_array_free(roots, TRUE);
+}
+static gboolean read_bitmap_info (file_system_info fs_info, ul *bitmap)
+{
+    GHashTable *visited;
+    int         mirror;
+    u64         sb_offset;
+
+    ctx->total_block = fs_info.totalblock;
+    ctx->dev_size = fs_info.device_size;
+    ctx->block_size  = btrfs_super_sectorsize(ctx->info->super_copy);
+    set_bitmap(bitmap, 0, BTRFS_SUPER_INFO_OFFSET); // some data like mbr maybe in
+    for (mirror = 0; mirror < BTRFS_SUPER_MIRROR_MAX; mirror++)
+    {
+        sb_offset = btrfs_sb_offset(mirror);
+        if (sb_offset + BTRFS_SUPER_INFO_SIZE > ctx->dev_size)
+            break;
+        set_bitmap(bitmap, sb_offset, BTRFS_SUPER_INFO_SIZE);
+    }
+
+    cursor_reset();
+    visited = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, NULL);
+    if (scan_extent_tree(bitmap))
+    {
+        walk_log_tree(bitmap, visited);
+    }
+    else
+    {
+        walk_fs_trees(bitmap, visited);
+    }
+    flush_extent_run(bitmap);
+    g_hash_table_destroy(visited);
+
     return TRUE;
 }
 
-static gboolean read_super_blocks(const char* device, file_system_info* fs_info)
+static gboolean read_super_blocks(file_system_info* fs_info)
 {
-    if (!fs_open(device))
-    {
-        return FALSE;
-    }    
     strncpy(fs_info->fs, btrfs_MAGIC, FS_MAGIC_SIZE);
-    fs_info->block_size  = btrfs_super_nodesize(root->fs_info->super_copy);
-    fs_info->usedblocks  = btrfs_super_bytes_used(root->fs_info->super_copy) / fs_info->block_size;
-    fs_info->device_size = btrfs_super_total_bytes(root->fs_info->super_copy);
+    /// data extents are sector aligned, tree blocks cover nodesize/sectorsize blocks
+    fs_info->block_size  = btrfs_super_sectorsize(ctx->root->fs_info->super_copy);
+    fs_info->usedblocks  = btrfs_super_bytes_used(ctx->root->fs_info->super_copy) / fs_info->block_size;
+    fs_info->device_size = btrfs_super_total_bytes(ctx->root->fs_info->super_copy);
     fs_info->totalblock  = fs_info->device_size / fs_info->block_size;
-    fs_close();
 
     return TRUE;
 }
@@ -338,31 +1314,22 @@ static gboolean check_system_space (file_system_info *fs_info,
  ******************************************************************************/
 static ull get_read_blocks_size (file_system_info *fs_info,ull *block_id,ul *bitmap)
 {
-    ull blocks_skip,blocks_read;
+    ull read_end;
     const ull  blocks_total = fs_info->totalblock;
+    const uint block_size = fs_info->block_size;
     const uint buffer_capacity = DEFAULT_BUFFER_SIZE > block_size ? DEFAULT_BUFFER_SIZE / block_size : 1;
 
     /// skip unused blocks
-    for (blocks_skip = 0;
-        *block_id + blocks_skip < blocks_total &&
-        !pc_test_bit(*block_id + blocks_skip, bitmap, blocks_total);
-         blocks_skip++);
-    if (*block_id + blocks_skip == blocks_total)
+    *block_id = pc_find_next_set(bitmap, blocks_total, *block_id);
+    if (*block_id >= blocks_total)
     {
         return 0;
     }
+    /// read blocks size < buffer_capacity && Current block has data
+    read_end = *block_id + buffer_capacity < blocks_total ?
+               *block_id + buffer_capacity : blocks_total;
 
-    if (blocks_skip)
-    {    
-        *block_id += blocks_skip;
-    }
-    /// read blocks size < 256 && Current block has data
-    for (blocks_read = 0;
-        *block_id + blocks_read < blocks_total && blocks_read < buffer_capacity &&
-         pc_test_bit(*block_id + blocks_read, bitmap,blocks_total);
-       ++blocks_read);
-
-    return blocks_read;
+    return pc_find_next_zero(bitmap, read_end, *block_id) - *block_id;
 
 }    
 static gboolean read_write_data_ptf (SysbakGdbus      *object,
@@ -372,12 +1339,14 @@ static gboolean read_write_data_ptf (SysbakGdbus      *object,
                                      int              *dfr,
                                      int              *dfw)
 {
+    const uint block_size = fs_info->block_size;
     const uint buffer_capacity = DEFAULT_BUFFER_SIZE > block_size ? 
                                  DEFAULT_BUFFER_SIZE / block_size : 1; // in blocks
     guchar checksum[img_opt->checksum_size];
     uint  blocks_in_cs = 0, blocks_per_cs, write_size;
     char *read_buffer, *write_buffer;
     ull   block_id = 0;	
+    ull   copied_count = 0;
     int   r_size, w_size;	
     progress_bar  prog;
     progress_data pdata;
@@ -406,20 +1375,20 @@ static gboolean read_write_data_ptf (SysbakGdbus      *object,
         ull i,blocks_read;
         int cs_added = 0, write_offset = 0;
         off_t offset;
+        if (!job_continue (object))
+        {
+            goto ERROR;
+        }
         blocks_read = get_read_blocks_size (fs_info,&block_id,bitmap);
         if (blocks_read == 0)
             break;
 
         offset = (off_t)(block_id * block_size);
-        if (lseek(*dfr, offset, SEEK_SET) == (off_t)-1)
-        {
-            goto ERROR;
-        }
-        r_size = write_read_io_all (dfr, read_buffer, blocks_read * block_size,READ);
-        if (r_size != (int)(blocks_read * block_size)) 
+        if (!read_source_blocks(dfr, read_buffer, offset, blocks_read * block_size))
         {
             goto ERROR;
         }
+        r_size = blocks_read * block_size;
         for (i = 0; i < blocks_read; ++i) 
         {
             memcpy(write_buffer + write_offset,
@@ -447,10 +1416,10 @@ static gboolean read_write_data_ptf (SysbakGdbus      *object,
         {
             pdata.percent=100.0;
         }
-        sysbak_gdbus_emit_sysbak_progress (object,
-                                           pdata.percent,
-                                           pdata.speed,
-                                           pdata.elapsed);
+        emit_sysbak_progress (object,
+                              pdata.percent,
+                              pdata.speed,
+                              pdata.elapsed);
         if (r_size + cs_added * img_opt->checksum_size != w_size)
         {
             goto ERROR;
@@ -483,8 +1452,10 @@ gboolean gdbus_sysbak_btrfs_ptf (SysbakGdbus           *object,
                                  GDBusMethodInvocation *invocation,
 								 const gchar           *source,
 								 const gchar           *target,
-                                 gboolean               overwrite)
+                                 gboolean               overwrite,
+                                 gboolean               lean)
 {
+    BtrfsContext     context;
     file_system_info fs_info;   /// description of the file system
     image_options    img_opt;
     unsigned long   *bitmap = NULL;
@@ -492,6 +1463,7 @@ gboolean gdbus_sysbak_btrfs_ptf (SysbakGdbus           *object,
     int              e_code;
     gint             dfr = 0,dfw = 0;
 
+    context_init(&context);
     dfr = open_source_device(source,BACK_PTF);
     if (dfr <= 0 ) 
     {
@@ -514,8 +1486,8 @@ gboolean gdbus_sysbak_btrfs_ptf (SysbakGdbus           *object,
     init_file_system_info(&fs_info);
     init_image_options(&img_opt);
     
-    // get Super Block information from partition
-    if (!read_super_blocks(source, &fs_info))
+    // the file system is opened once and serves every probe below
+    if (!fs_open(source) || !read_super_blocks(&fs_info))
     {
         e_code = 3;
         goto ERROR;
@@ -535,25 +1507,37 @@ gboolean gdbus_sysbak_btrfs_ptf (SysbakGdbus           *object,
         e_code = 4;
         goto ERROR;
     }
-    if (!read_bitmap_info(source, fs_info, bitmap))
+    build_chunk_layout(dfr, lean);
+    if (!read_bitmap_info(fs_info, bitmap))
     {
         e_code = 5;
         goto ERROR;
     }    
+    fs_close();
     update_used_blocks_count(&fs_info, bitmap);
     if (!check_system_space (&fs_info,target,&img_opt))
     {
         e_code = 6;
         goto ERROR;
     }    
+    if (ctx->copy_ranges->len > 0)
+    {
+        set_image_fs_flags(&img_opt, IMAGE_FS_COPIES);
+    }
     if (!write_image_desc(&dfw, fs_info,img_opt))
     {
         e_code = 7;
         goto ERROR;
     }    
-    write_image_bitmap(&dfw, fs_info, bitmap);
-    copied_count = 0;
-    sysbak_gdbus_complete_sysbak_btrfs_ptf (object,invocation); 
+    if (!write_image_bitmap(&dfw, fs_info, bitmap) ||
+        (ctx->copy_ranges->len > 0 && !write_image_copies(&dfw, ctx->copy_ranges)))
+    {
+        e_code = 7;
+        goto ERROR;
+    }
+    if (invocation != NULL)
+        sysbak_gdbus_complete_sysbak_btrfs_ptf (object,invocation);
+    invocation = NULL;
     if (!read_write_data_ptf (object,&fs_info,&img_opt,bitmap,&dfr,&dfw))
     {
         e_code = 8;
@@ -561,20 +1545,25 @@ gboolean gdbus_sysbak_btrfs_ptf (SysbakGdbus           *object,
     } 
 
     fsync(dfw);
-	sysbak_gdbus_emit_sysbak_finished (object,
-                                       fs_info.totalblock,
-                                       fs_info.usedblocks,
-                                       fs_info.block_size);
-    free(bitmap);
+    free_chunk_layout();
+	emit_sysbak_finished (object,
+                          fs_info.totalblock,
+                          fs_info.usedblocks,
+                          fs_info.block_size);
+    pc_free_bitmap(bitmap);
+    context_clear(&context);
     close (dfw);
     close (dfr);
     return TRUE;
 ERROR:
-	sysbak_gdbus_complete_sysbak_btrfs_ptf (object,invocation); 
-	sysbak_gdbus_emit_sysbak_error (object,
-                                    sysbak_error_message[e_code],
-                                    e_code);
-    free(bitmap);
+	if (invocation != NULL)
+	    sysbak_gdbus_complete_sysbak_btrfs_ptf (object,invocation);
+	emit_sysbak_error (object,
+                       sysbak_error_message[e_code],
+                       e_code);
+    pc_free_bitmap(bitmap);
+    fs_close();
+    free_chunk_layout();
     if (dfr > 0)
     {    
         close (dfr);
@@ -583,6 +1572,7 @@ ERROR:
     {    
         close (dfw);
     }    
+    context_clear(&context);
     return FALSE;
 }   
 
@@ -592,11 +1582,12 @@ static gboolean read_write_data_ptp (SysbakGdbus      *object,
                                      int              *dfr,
                                      int              *dfw)
 {
+    const uint block_size = fs_info->block_size;
     const uint buffer_capacity = DEFAULT_BUFFER_SIZE > block_size ? 
                                  DEFAULT_BUFFER_SIZE / block_size : 1; // in blocks
     char *buffer;
     ull   block_id = 0;	
-    int   r_size, w_size;	
+    int   w_size;	
     progress_bar  prog;
     progress_data pdata;
 
@@ -616,21 +1607,20 @@ static gboolean read_write_data_ptp (SysbakGdbus      *object,
         ull blocks_read;
         off_t offset;
 
+        if (!job_continue (object))
+        {
+            goto ERROR;
+        }
         blocks_read = get_read_blocks_size (fs_info,&block_id,bitmap);
         if (blocks_read == 0)
             break;
 
         offset = (off_t)(block_id * block_size);
-        if (lseek(*dfr, offset, SEEK_SET) == (off_t)-1)
-        {
-            goto ERROR;
-        }
         if (lseek(*dfw, offset, SEEK_SET) == (off_t)-1)
         {
             goto ERROR;
         }
-        r_size = write_read_io_all (dfr, buffer, blocks_read * block_size,READ);
-        if (r_size != (int)(blocks_read * block_size)) 
+        if (!read_source_blocks(dfr, buffer, offset, blocks_read * block_size))
         {
             goto ERROR;
         }
@@ -644,10 +1634,10 @@ static gboolean read_write_data_ptp (SysbakGdbus      *object,
         {
             pdata.percent=100.0;
         }
-		sysbak_gdbus_emit_sysbak_progress (object,
-                                           pdata.percent,
-                                           pdata.speed,
-                                           pdata.elapsed);
+		emit_sysbak_progress (object,
+                              pdata.percent,
+                              pdata.speed,
+                              pdata.elapsed);
     } while (1);
 
     free(buffer);
@@ -663,8 +1653,10 @@ gboolean gdbus_sysbak_btrfs_ptp (SysbakGdbus           *object,
                                  GDBusMethodInvocation *invocation,
                                  const gchar           *source,
                                  const gchar           *target,
-                                 gboolean               overwrite)
+                                 gboolean               overwrite,
+                                 gboolean               lean)
 {
+    BtrfsContext     context;
     file_system_info fs_info;   /// description of the file system
     image_options    img_opt;
     ul              *bitmap = NULL;
@@ -673,6 +1665,7 @@ gboolean gdbus_sysbak_btrfs_ptp (SysbakGdbus           *object,
     gint             e_code;
     gint             dfr = 0,dfw = 0;
 
+    context_init(&context);
     dfr = open_source_device(source,BACK_PTP);
     if (dfr <= 0 ) 
     {
@@ -688,8 +1681,8 @@ gboolean gdbus_sysbak_btrfs_ptp (SysbakGdbus           *object,
 
     init_file_system_info(&fs_info);
     init_image_options(&img_opt);
-    // get Super Block information from partition
-    if (!read_super_blocks(source, &fs_info))
+    // the file system is opened once and serves every probe below
+    if (!fs_open(source) || !read_super_blocks(&fs_info))
     {
         e_code = 3;
         goto ERROR;
@@ -712,19 +1705,22 @@ gboolean gdbus_sysbak_btrfs_ptp (SysbakGdbus           *object,
         goto ERROR;
     }
 
-    if (!read_bitmap_info(source, fs_info, bitmap))
+    build_chunk_layout(dfr, lean);
+    if (!read_bitmap_info(fs_info, bitmap))
     {
         e_code = 5;
         goto ERROR;
     }    
+    fs_close();
     free_space = get_partition_free_space(&dfw);
     if (free_space < fs_info.device_size)
     {
         e_code = 6;
         goto ERROR;
     }   
-    copied_count = 0;
-    sysbak_gdbus_complete_sysbak_btrfs_ptp (object,invocation); 
+    if (invocation != NULL)
+        sysbak_gdbus_complete_sysbak_btrfs_ptp (object,invocation);
+    invocation = NULL;
     if (!read_write_data_ptp (object,
                              &fs_info,
                               bitmap,
@@ -734,19 +1730,29 @@ gboolean gdbus_sysbak_btrfs_ptp (SysbakGdbus           *object,
         e_code = 8;
         goto ERROR;
     }
+    if (!rebuild_copy_ranges(&dfw, fs_info, bitmap, ctx->copy_ranges))
+    {
+        e_code = 8;
+        goto ERROR;
+    }
 
     fsync(dfw);
-    free(bitmap);
+    free_chunk_layout();
+    context_clear(&context);
+    pc_free_bitmap(bitmap);
     close (dfr);
     close (dfw);
-    sysbak_gdbus_emit_sysbak_finished (object,
-                                       fs_info.totalblock,
-                                       fs_info.usedblocks,
-                                       fs_info.block_size);
+    emit_sysbak_finished (object,
+                          fs_info.totalblock,
+                          fs_info.usedblocks,
+                          fs_info.block_size);
     return TRUE;
 ERROR:
-    sysbak_gdbus_complete_sysbak_btrfs_ptp (object,invocation); 
-    free(bitmap);
+    if (invocation != NULL)
+        sysbak_gdbus_complete_sysbak_btrfs_ptp (object,invocation);
+    pc_free_bitmap(bitmap);
+    fs_close();
+    free_chunk_layout();
     if (dfr > 0)
     {    
         close (dfr);
@@ -755,8 +1761,9 @@ ERROR:
     {    
         close (dfw);
     }    
-    sysbak_gdbus_emit_sysbak_error (object,
-                                    sysbak_error_message[e_code],
-                                    e_code);
+    context_clear(&context);
+    emit_sysbak_error (object,
+                       sysbak_error_message[e_code],
+                       e_code);
     return FALSE;
 }  
@@ -37,12 +37,14 @@ gboolean      gdbus_sysbak_btrfs_ptf      (SysbakGdbus           *object,
                                            GDBusMethodInvocation *invocation,
                                            const gchar           *source,
                                            const gchar           *target,
-                                           gboolean               overwrite);
+                                           gboolean               overwrite,
+                                           gboolean               lean);
 
 gboolean      gdbus_sysbak_btrfs_ptp      (SysbakGdbus           *object,
                                            GDBusMethodInvocation *invocation,
                                            const gchar           *source,
                                            const gchar           *target,
-                                           gboolean               overwrite);
+                                           gboolean               overwrite,
+                                           gboolean               lean);
 
 #endif
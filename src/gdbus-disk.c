@@ -22,6 +22,7 @@
 #include <sys/statvfs.h>
 #include <sys/ioctl.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include "gdbus-share.h"
 #include "gdbus-disk.h"
@@ -60,26 +61,65 @@ gboolean gdbus_restore_partition_table (SysbakGdbus           *object,
 ERROR:
     g_free (cmd);
     sysbak_gdbus_complete_restore_partition_table (object,invocation,FALSE);
-    sysbak_gdbus_emit_sysbak_error (object,
-                                    standard_error,
-                                    1);
+    emit_sysbak_error (object,
+                       standard_error,
+                       1);
     g_error_free (error);
     return FALSE;
 }  
-static const gchar *get_backup_cmd_option (const char *s,const char *t)
+/******************************************************************************
+ * Function:              run_command      
+ *        
+ * Explain: Run a tool to the end, off the main loop as well as on it.
+ *        
+ * Input:   @argv             the tool and its arguments
+ *          @standard_output  receives what it printed, or NULL
+ *          @message          receives why it failed, free it
+ *        
+ * Output:  success      :TRUE
+ *          fail         :FALSE
+ ******************************************************************************/
+static gboolean run_command (const gchar **argv,
+                             gchar       **standard_output,
+                             gchar       **message)
+{
+    gint         status;
+    GError      *error = NULL;
+    gchar       *standard_error = NULL;
+
+    if (!g_spawn_sync (NULL, (gchar**)argv, NULL, 0, NULL, NULL, standard_output, &standard_error, &status, &error))
+        goto ERROR;
+
+    if (!g_spawn_check_exit_status (status, &error))
+        goto ERROR;
+
+    g_free (standard_error);
+    return TRUE;
+ERROR:
+    /// the tool tells why better than its exit status
+    if (standard_error != NULL && standard_error[0] != '\0')
+    {
+        *message = standard_error;
+    }
+    else
+    {
+        *message = g_strdup (error->message);
+        g_free (standard_error);
+    }
+    g_error_free (error);
+    return FALSE;
+}
+static gchar *get_backup_cmd_option (const char *s,const char *t)
 {
     return g_strdup_printf ("/usr/bin/sfdisk -d %s > %s",s,t);
 }    
-gboolean gdbus_backup_partition_table (SysbakGdbus           *object,
-                                       GDBusMethodInvocation *invocation,
-								       const gchar           *source,
-								       const gchar           *target)
+gboolean save_partition_table (const gchar *source,
+                               const gchar *target,
+                               gchar      **message)
 {
     const gchar *argv[4];
-    gint         status;
-    GError      *error = NULL;
-    const gchar *cmd;
-    gchar       *standard_error;
+    gchar       *cmd;
+    gboolean     ret;
 
     cmd = get_backup_cmd_option (source,target);
 
@@ -88,34 +128,37 @@ gboolean gdbus_backup_partition_table (SysbakGdbus           *object,
     argv[2] = cmd;
     argv[3] = NULL;
     
-    if (!g_spawn_sync (NULL, (gchar**)argv, NULL, 0, NULL, NULL, NULL, &standard_error, &status, &error))
-        goto ERROR;
+    ret = run_command (argv, NULL, message);
+    g_free (cmd);
+    return ret;
+}
+gboolean gdbus_backup_partition_table (SysbakGdbus           *object,
+                                       GDBusMethodInvocation *invocation,
+								       const gchar           *source,
+								       const gchar           *target)
+{
+    gchar       *message = NULL;
 
-    if (!g_spawn_check_exit_status (status, &error))
+    if (!save_partition_table (source, target, &message))
         goto ERROR;
 
     sysbak_gdbus_complete_backup_partition_table (object,invocation,TRUE); 
-    g_free (cmd);
     return TRUE;
 ERROR:
-    g_free (cmd);
     sysbak_gdbus_complete_backup_partition_table (object,invocation,FALSE);
-    sysbak_gdbus_emit_sysbak_error (object,
-                                    standard_error,
-                                    1);
-    g_error_free (error);
+    emit_sysbak_error (object,
+                       message,
+                       1);
+    g_free (message);
     return FALSE;
 }  
-gboolean gdbus_backup_disk_mbr (SysbakGdbus           *object,
-                                GDBusMethodInvocation *invocation,
-							    const gchar           *source,
-							    const gchar           *target)
+gboolean save_disk_mbr (const gchar *source,
+                        const gchar *target,
+                        gchar      **message)
 {
-    const gchar *argv[40];
-    gint         status;
-    GError      *error = NULL;
-    gchar       *standard_error;
-    const gchar *s,*t;
+    const gchar *argv[6];
+    gchar       *s,*t;
+    gboolean     ret;
     
     s = g_strdup_printf ("if=%s",source);
     t = g_strdup_printf ("of=%s",target);
@@ -126,25 +169,29 @@ gboolean gdbus_backup_disk_mbr (SysbakGdbus           *object,
     argv[4] = "count=1";
     argv[5] = NULL;
 
-    if (!g_spawn_sync (NULL, (gchar**)argv, NULL, 0, NULL, NULL, NULL,&standard_error, &status, &error))
-        goto ERROR;
-    
-    if (!g_spawn_check_exit_status (status, &error))
-        goto ERROR;
+    ret = run_command (argv, NULL, message);
+    g_free (s);
+    g_free (t);
+    return ret;
+}
+gboolean gdbus_backup_disk_mbr (SysbakGdbus           *object,
+                                GDBusMethodInvocation *invocation,
+							    const gchar           *source,
+							    const gchar           *target)
+{
+    gchar       *message = NULL;
 
+    if (!save_disk_mbr (source, target, &message))
+        goto ERROR;
 
     sysbak_gdbus_complete_backup_disk_mbr (object,invocation,TRUE); 
-    g_free (s);
-    g_free (t);
     return TRUE;
 ERROR:
-    g_free (s);
-    g_free (t);
     sysbak_gdbus_complete_backup_disk_mbr (object,invocation,FALSE);
-    sysbak_gdbus_emit_sysbak_error (object,
-                                    standard_error,
-                                    1);
-    g_error_free (error);
+    emit_sysbak_error (object,
+                       message,
+                       1);
+    g_free (message);
     return FALSE;
 }   
 gboolean gdbus_restore_lvm_meta (SysbakGdbus           *object,
@@ -172,45 +219,47 @@ gboolean gdbus_restore_lvm_meta (SysbakGdbus           *object,
     return TRUE;
 ERROR:
     sysbak_gdbus_complete_restore_lvm_meta (object,invocation,FALSE);
-    sysbak_gdbus_emit_sysbak_error (object,
-                                    "vgcfgrestore failed",
-                                    1);
+    emit_sysbak_error (object,
+                       "vgcfgrestore failed",
+                       1);
     g_error_free (error);
     return FALSE;
 }  
-gboolean gdbus_backup_lvm_meta (SysbakGdbus           *object,
-                                GDBusMethodInvocation *invocation,
-							    const gchar           *target)
+/// vgcfgbackup writes one file per volume group, prefix-vgname
+gboolean save_lvm_meta (const gchar *prefix,
+                        gchar      **message)
 {
     const gchar *argv[5];
-    gint         status;
-    GError      *error = NULL;
-    gchar       *standard_error;
-    const char  *s;
-    const char  *base = "%s";
+    gchar       *s;
+    gboolean     ret;
 
-    s = g_strdup_printf ("%s-%s",target,base);
+    s = g_strdup_printf ("%s-%%s",prefix);
     argv[0] = "/sbin/vgcfgbackup";
     argv[1] = "-f";
     argv[2] = s;
 	argv[3] = NULL;
     
-    if (!g_spawn_sync (NULL, (gchar**)argv, NULL, 0, NULL, NULL, NULL, &standard_error, &status, &error))
-        goto ERROR;
+    ret = run_command (argv, NULL, message);
+    g_free (s);
+    return ret;
+}
+gboolean gdbus_backup_lvm_meta (SysbakGdbus           *object,
+                                GDBusMethodInvocation *invocation,
+							    const gchar           *target)
+{
+    gchar       *message = NULL;
 
-    if (!g_spawn_check_exit_status (status, &error))
+    if (!save_lvm_meta (target, &message))
         goto ERROR;
 
     sysbak_gdbus_complete_backup_lvm_meta (object,invocation,TRUE); 
-    g_free (s);
     return TRUE;
 ERROR:
-    g_free (s);
     sysbak_gdbus_complete_backup_lvm_meta (object,invocation,FALSE);
-    sysbak_gdbus_emit_sysbak_error (object,
-                                    standard_error,
-                                    1);
-    g_error_free (error);
+    emit_sysbak_error (object,
+                       message,
+                       1);
+    g_free (message);
     return FALSE;
 }  
 gboolean gdbus_create_pv (SysbakGdbus           *object,
@@ -242,9 +291,9 @@ gboolean gdbus_create_pv (SysbakGdbus           *object,
     return TRUE;
 ERROR:
     sysbak_gdbus_complete_create_pv (object,invocation,FALSE);
-    sysbak_gdbus_emit_sysbak_error (object,
-                                    "create pv failed",
-                                    1);
+    emit_sysbak_error (object,
+                       "create pv failed",
+                       1);
     g_error_free (error);
     return FALSE;
 
@@ -279,9 +328,9 @@ gboolean gdbus_restart_vg (SysbakGdbus           *object,
     return TRUE;
 ERROR:
     sysbak_gdbus_complete_restart_vg (object,invocation,FALSE);
-    sysbak_gdbus_emit_sysbak_error (object,
-                                    "restart VG failed",
-                                    1);
+    emit_sysbak_error (object,
+                       "restart VG failed",
+                       1);
     g_error_free (error);
     return FALSE;
 
@@ -307,9 +356,9 @@ gboolean gdbus_get_disk_size (SysbakGdbus           *object,
     return TRUE;
 ERROR:
     sysbak_gdbus_complete_get_disk_size (object,invocation,0);
-    sysbak_gdbus_emit_sysbak_error (object,
-                                    "get disk size failed",
-                                    1);
+    emit_sysbak_error (object,
+                       "get disk size failed",
+                       1);
     
     return FALSE;
 }
@@ -388,9 +437,9 @@ gboolean gdbus_get_source_use_size (SysbakGdbus           *object,
 ERROR:
     g_strfreev (str);
     sysbak_gdbus_complete_get_source_use_size (object,invocation,0);
-    sysbak_gdbus_emit_sysbak_error (object,
-                                    "get source use size failed",
-                                    1);
+    emit_sysbak_error (object,
+                       "get source use size failed",
+                       1);
     
     return FALSE;
 }   
@@ -536,3 +585,167 @@ SEXIT:
     
     return ret;
 }    
+void free_disk_partition (gpointer data)
+{
+    disk_partition *part = data;
+
+    g_free (part->name);
+    g_free (part->path);
+    g_free (part->fstype);
+    g_free (part->uuid);
+    g_free (part->mountpoint);
+    g_free (part);
+}
+/// one line of lsblk -P, NAME="sda1" FSTYPE="ext4" ...
+static disk_partition *parse_layout_line (const gchar *line)
+{
+    disk_partition *part;
+    gchar         **argv = NULL;
+    gchar          *value;
+    int             i;
+
+    if (line[0] == '\0' || !g_shell_parse_argv (line, NULL, &argv, NULL))
+    {
+        return NULL;
+    }
+    part = g_new0 (disk_partition, 1);
+    for (i = 0; argv[i] != NULL; i++)
+    {
+        value = strchr (argv[i], '=');
+        if (value == NULL)
+            continue;
+        *value++ = '\0';
+        if (g_strcmp0 (argv[i], "NAME") == 0)
+            part->name = g_strdup (value);
+        else if (g_strcmp0 (argv[i], "FSTYPE") == 0)
+            part->fstype = g_strdup (value);
+        else if (g_strcmp0 (argv[i], "UUID") == 0)
+            part->uuid = g_strdup (value);
+        else if (g_strcmp0 (argv[i], "MOUNTPOINT") == 0)
+            part->mountpoint = g_strdup (value);
+        else if (g_strcmp0 (argv[i], "SIZE") == 0)
+            part->size = g_ascii_strtoull (value, NULL, 10);
+    }
+    g_strfreev (argv);
+    if (part->name == NULL)
+    {
+        free_disk_partition (part);
+        return NULL;
+    }
+    /// logical volumes are named vg-lv
+    if (strchr (part->name, '-') != NULL)
+        part->path = g_strconcat ("/dev/mapper/", part->name, NULL);
+    else
+        part->path = g_strconcat ("/dev/", part->name, NULL);
+
+    return part;
+}
+static void set_disk_info_value (GKeyFile    *kconfig,
+                                 const gchar *group,
+                                 const gchar *key,
+                                 const gchar *value,
+                                 const gchar *empty)
+{
+    if (value != NULL && value[0] != '\0')
+        g_key_file_set_string (kconfig, group, key, value);
+    else if (empty != NULL)
+        g_key_file_set_string (kconfig, group, key, empty);
+}
+/******************************************************************************
+ * Function:              save_disk_info      
+ *        
+ * Explain: List what lives on a disk and record it in disk-info.ini for
+ *          the restore.  Partitions come first, grouped by their number
+ *          (sda1 is [1]), then an [end] group, then the logical volumes
+ *          grouped by their name.
+ *        
+ * Input:   @disk         disk device
+ *          @config_name  the ini file to write
+ *          @message      receives why it failed, free it
+ *        
+ * Output:  disk_partition of each partition and volume, not the disk
+ *          fail         :NULL
+ ******************************************************************************/
+GPtrArray *save_disk_info (const gchar *disk,
+                           const gchar *config_name,
+                           gchar      **message)
+{
+    const gchar    *argv[7];
+    gchar          *layout = NULL;
+    gchar         **lines;
+    GKeyFile       *kconfig;
+    GPtrArray      *parts;
+    GError         *error = NULL;
+    disk_partition *part;
+    disk_partition *whole;
+    const gchar    *group;
+    guint           i;
+
+    argv[0] = "/usr/bin/lsblk";
+    argv[1] = "-b";
+    argv[2] = "-P";
+    argv[3] = "-o";
+    argv[4] = "NAME,FSTYPE,UUID,SIZE,MOUNTPOINT";
+    argv[5] = disk;
+    argv[6] = NULL;
+    if (!run_command (argv, &layout, message))
+    {
+        g_free (layout);
+        return NULL;
+    }
+    parts = g_ptr_array_new_with_free_func (free_disk_partition);
+    lines = g_strsplit (layout, "\n", -1);
+    for (i = 0; lines[i] != NULL; i++)
+    {
+        part = parse_layout_line (lines[i]);
+        if (part != NULL)
+            g_ptr_array_add (parts, part);
+    }
+    g_strfreev (lines);
+    g_free (layout);
+    if (parts->len == 0)
+    {
+        *message = g_strdup_printf ("lsblk did not list %s", disk);
+        g_ptr_array_free (parts, TRUE);
+        return NULL;
+    }
+
+    /// lsblk lists the disk itself first
+    whole = g_ptr_array_index (parts, 0);
+    kconfig = g_key_file_new ();
+    for (i = 1; i < parts->len; i++)
+    {
+        part = g_ptr_array_index (parts, i);
+        if (strchr (part->name, '-') != NULL)
+            continue;
+        group = part->name;
+        if (g_str_has_prefix (group, whole->name))
+            group += strlen (whole->name);
+        set_disk_info_value (kconfig, group, "name", part->name, NULL);
+        set_disk_info_value (kconfig, group, "fstype", part->fstype, "free");
+        set_disk_info_value (kconfig, group, "uuid", part->uuid, "free");
+    }
+    g_key_file_set_string (kconfig, "end", "name", "lvm");
+    g_key_file_set_string (kconfig, "end", "fstype", "lvm");
+    for (i = 1; i < parts->len; i++)
+    {
+        part = g_ptr_array_index (parts, i);
+        if (strchr (part->name, '-') == NULL)
+            continue;
+        set_disk_info_value (kconfig, part->name, "name", part->name, NULL);
+        set_disk_info_value (kconfig, part->name, "fstype", part->fstype, NULL);
+        set_disk_info_value (kconfig, part->name, "uuid", part->uuid, NULL);
+    }
+    if (!g_key_file_save_to_file (kconfig, config_name, &error))
+    {
+        *message = g_strdup (error->message);
+        g_error_free (error);
+        g_key_file_free (kconfig);
+        g_ptr_array_free (parts, TRUE);
+        return NULL;
+    }
+    g_key_file_free (kconfig);
+    g_ptr_array_remove_index (parts, 0);
+
+    return parts;
+}
@@ -22,6 +22,17 @@
 #include <gio/gio.h>
 #include "sysbak-admin-generated.h"
 
+/// a partition or logical volume of a disk, as lsblk lists it
+typedef struct
+{
+    gchar    *name;         /// sda1, or vg-lv for a logical volume
+    gchar    *path;         /// device node
+    gchar    *fstype;       /// empty for free space and extended partitions
+    gchar    *uuid;
+    gchar    *mountpoint;   /// empty when not mounted
+    guint64   size;         /// bytes
+} disk_partition;
+
 gboolean    gdbus_create_pv              (SysbakGdbus           *object,
                                           GDBusMethodInvocation *invocation,
 						                  const gchar           *file,
@@ -64,6 +75,23 @@ gboolean    gdbus_get_source_use_size    (SysbakGdbus           *object,
                                           GDBusMethodInvocation *invocation,
 						                  const gchar           *file_path);
 
+gboolean    save_partition_table         (const gchar            *source,
+                                          const gchar            *target,
+                                          gchar                 **message);
+
+gboolean    save_disk_mbr                (const gchar            *source,
+                                          const gchar            *target,
+                                          gchar                 **message);
+
+gboolean    save_lvm_meta                (const gchar            *prefix,
+                                          gchar                 **message);
+
+GPtrArray  *save_disk_info               (const gchar            *disk,
+                                          const gchar            *config_name,
+                                          gchar                 **message);
+
+void        free_disk_partition          (gpointer               data);
+
 gboolean    gdbus_remove_all_vg          (SysbakGdbus           *object,
                                           GDBusMethodInvocation *invocation,
                                           const char            *disk_name);
@@ -26,9 +26,10 @@
 #include <stdarg.h>
 #include <getopt.h>
 #include <unistd.h>
+#include <endian.h>
 
-#define in_use(m, x)    (ext2fs_test_bit ((x), (m)))
 #include "gdbus-extfs.h"
+#include "gdbus-xfsfs.h"
 #include "gdbus-share.h"
 #include "checksum.h"
 #include "gdbus-bitmap.h"
@@ -47,10 +48,9 @@ static const char *sysbak_error_message[10] =
 	"Failed to read bitmap",
 	"Not enough disk  space",
 	"Write header information failed",
-	"Failed reading and writing data"
+	"Failed reading and writing data",
 	"Failed reading image header"
 };
-static ull copied_count;
 // open device
 static ext2_filsys open_file_system (const char* device)
 {
@@ -96,15 +96,321 @@ static ext2_filsys open_file_system (const char* device)
     return fs;
 }
 
+#ifndef EXTFS_1_41
+#define EXT_SCAN_MAX_THREADS   8
+#define EXT_SCAN_MIN_GROUPS    16   /// groups per job without flex_bg
+
+typedef struct
+{
+    ext2_filsys    extfs;
+    int            fd;
+    ul            *bitmap;
+    ull            total;
+    dgrp_t         groups_per_job;
+    gint           njobs;
+    gint           next_job;
+    gint           failed;
+    unsigned char *deferred;    /// raw bitmap of the first group of each job
+    ull           *job_free;    /// free blocks counted by each job
+} ExtBitmapScan;
+
+/// BLOCK_UNINIT groups have no bitmap on disk, libext2fs trusts the flag
+/// only when the descriptor checksum is good
+static gboolean group_block_uninit (ext2_filsys extfs, dgrp_t group)
+{
+    if (!ext2fs_has_group_desc_csum(extfs))
+        return FALSE;
+    if (!(ext2fs_bg_flags(extfs, group) & EXT2_BG_BLOCK_UNINIT))
+        return FALSE;
+
+    return ext2fs_group_desc_csum_verify(extfs, group) != 0;
+}
+static ull get_group_first_block (ext2_filsys extfs, dgrp_t group)
+{
+    return extfs->super->s_first_data_block + 
+           (ull)group * extfs->super->s_blocks_per_group;
+}
+static ull get_group_blocks (ext2_filsys extfs, dgrp_t group, ull total)
+{
+    ull first = get_group_first_block(extfs, group);
+    ull count = first < total ? total - first : 0;
+
+    if (count > extfs->super->s_blocks_per_group)
+        count = extfs->super->s_blocks_per_group;
+
+    return count;
+}
+/// same blocks ext2fs_read_bitmaps marks for a BLOCK_UNINIT group
+static void mark_uninit_group_metadata (ext2_filsys extfs, 
+                                        dgrp_t      group, 
+                                        ul         *bitmap, 
+                                        ull         total)
+{
+    blk64_t super_blk = 0, old_desc_blk = 0, new_desc_blk = 0;
+    ull     old_desc_blocks;
+
+    ext2fs_super_and_bgd_loc2(extfs, group, &super_blk, &old_desc_blk, &new_desc_blk, NULL);
+
+    if (extfs->super->s_feature_incompat & EXT2_FEATURE_INCOMPAT_META_BG)
+        old_desc_blocks = extfs->super->s_first_meta_bg;
+    else
+        old_desc_blocks = extfs->desc_blocks + extfs->super->s_reserved_gdt_blocks;
+
+    if (super_blk || group == 0)
+        pc_set_bit(super_blk, bitmap, total);
+    if (old_desc_blk)
+    {
+        if (old_desc_blk + old_desc_blocks > total)
+            old_desc_blocks = old_desc_blk < total ? total - old_desc_blk : 0;
+        pc_set_range(old_desc_blk, old_desc_blocks, bitmap, total);
+    }
+    if (new_desc_blk)
+        pc_set_bit(new_desc_blk, bitmap, total);
+
+    pc_set_bit(ext2fs_block_bitmap_loc(extfs, group), bitmap, total);
+    pc_set_bit(ext2fs_inode_bitmap_loc(extfs, group), bitmap, total);
+    pc_set_range(ext2fs_inode_table_loc(extfs, group), 
+                 extfs->inode_blocks_per_group, 
+                 bitmap, 
+                 total);
+}
+/// pread the on-disk bitmaps of groups [first, last), one request per run
+/// of groups whose bitmaps are adjacent (a whole flex_bg in the usual case)
+static gboolean read_group_bitmaps (ExtBitmapScan *scan, 
+                                    dgrp_t         first, 
+                                    dgrp_t         last, 
+                                    unsigned char *buffer)
+{
+    ext2_filsys extfs = scan->extfs;
+    ull         block_size = extfs->blocksize;
+    ull         blocks_count = ext2fs_blocks_count(extfs->super);
+    dgrp_t      group = first;
+
+    while (group < last)
+    {
+        blk64_t loc;
+        dgrp_t  run = 1;
+        ssize_t bytes;
+
+        if (group_block_uninit(extfs, group))
+        {
+            group++;
+            continue;
+        }
+        loc = ext2fs_block_bitmap_loc(extfs, group);
+        while (group + run < last && 
+               !group_block_uninit(extfs, group + run) &&
+               ext2fs_block_bitmap_loc(extfs, group + run) == loc + run)
+        {
+            run++;
+        }
+        if (loc == 0 || loc + run > blocks_count)
+        {
+            return FALSE;
+        }
+        bytes = pread(scan->fd, 
+                      buffer + (ull)(group - first) * block_size, 
+                      run * block_size, 
+                      (off_t)(loc * block_size));
+        if (bytes != (ssize_t)(run * block_size))
+        {
+            return FALSE;
+        }
+        group += run;
+    }
+
+    return TRUE;
+}
+/// The first group of a job shares its edge words in the image bitmap with
+/// the previous job, so it is handed back to the caller instead of copied.
+static gboolean scan_bitmap_job (ExtBitmapScan *scan, gint job, unsigned char *buffer)
+{
+    ext2_filsys extfs = scan->extfs;
+    int         nbytes = EXT2_BLOCKS_PER_GROUP(extfs->super) / 8;
+    dgrp_t      first = (dgrp_t)job * scan->groups_per_job;
+    dgrp_t      last = first + scan->groups_per_job;
+    dgrp_t      group;
+    ull         lfree = 0;
+
+    if (last > extfs->group_desc_count)
+        last = extfs->group_desc_count;
+
+    if (!read_group_bitmaps(scan, first, last, buffer))
+        return FALSE;
+
+    memcpy(scan->deferred + (ull)job * nbytes, buffer, nbytes);
+    for (group = first + 1; group < last; group++)
+    {
+        ull start = get_group_first_block(extfs, group);
+        ull group_blocks = get_group_blocks(extfs, group, scan->total);
+        ull gfree;
+
+        if (group_block_uninit(extfs, group))
+        {
+            pc_clear_range(start, group_blocks, scan->bitmap, scan->total);
+            lfree += ext2fs_bg_free_blocks_count(extfs, group);
+            continue;
+        }
+        gfree = group_blocks - pc_copy_bits(start,
+                                            buffer + (ull)(group - first) * extfs->blocksize,
+                                            group_blocks,
+                                            scan->bitmap,
+                                            scan->total);
+        /// check free blocks in group
+        if (gfree != ext2fs_bg_free_blocks_count(extfs, group))
+        {
+            return FALSE;
+        }
+        lfree += gfree;
+    }
+    scan->job_free[job] = lfree;
+
+    return TRUE;
+}
+static gpointer scan_bitmap_thread (gpointer data)
+{
+    ExtBitmapScan *scan = data;
+    unsigned char *buffer;
+    gint           job;
+
+    buffer = malloc((ull)scan->groups_per_job * scan->extfs->blocksize);
+    if (buffer == NULL)
+    {
+        g_atomic_int_set(&scan->failed, 1);
+        return NULL;
+    }
+    while (!g_atomic_int_get(&scan->failed))
+    {
+        job = g_atomic_int_add(&scan->next_job, 1);
+        if (job >= scan->njobs)
+            break;
+        if (!scan_bitmap_job(scan, job, buffer))
+            g_atomic_int_set(&scan->failed, 1);
+    }
+    free(buffer);
+
+    return NULL;
+}
+/******************************************************************************
+ * Function:              scan_block_bitmaps      
+ *        
+ * Explain: Fill the image bitmap straight from the on-disk block bitmaps.
+ *          Inode bitmaps are never read, BLOCK_UNINIT groups cost no I/O,
+ *          and the groups are split into flex_bg sized jobs that worker
+ *          threads pread and check in parallel.
+ *        
+ * Input:   @extfs        opened file system
+ *          @device       device path, read with its own descriptor
+ *          @fs_info      file system info
+ *          @bitmap       image bitmap
+ *        
+ * Output:  success      :TRUE
+ *          fail         :FALSE
+ ******************************************************************************/
+static gboolean scan_block_bitmaps (ext2_filsys      extfs,
+                                    const char      *device, 
+                                    file_system_info fs_info, 
+                                    ul              *bitmap) 
+{
+    ExtBitmapScan scan;
+    GThread      *threads[EXT_SCAN_MAX_THREADS];
+    int           nthreads, i;
+    int           nbytes = EXT2_BLOCKS_PER_GROUP(extfs->super) / 8;
+    gint          job;
+    dgrp_t        group;
+    ull           lfree = 0;
+    gboolean      ret = FALSE;
+
+    memset(&scan, 0, sizeof(scan));
+    scan.extfs  = extfs;
+    scan.bitmap = bitmap;
+    scan.total  = fs_info.totalblock;
+    scan.groups_per_job = EXT_SCAN_MIN_GROUPS;
+    if (extfs->super->s_feature_incompat & EXT4_FEATURE_INCOMPAT_FLEX_BG &&
+        (1U << extfs->super->s_log_groups_per_flex) > scan.groups_per_job)
+    {
+        scan.groups_per_job = 1U << extfs->super->s_log_groups_per_flex;
+    }
+    scan.njobs = (extfs->group_desc_count + scan.groups_per_job - 1) / scan.groups_per_job;
+
+    scan.fd = open(device, O_RDONLY);
+    if (scan.fd < 0)
+    {
+        return FALSE;
+    }
+    scan.deferred = malloc((ull)scan.njobs * nbytes);
+    scan.job_free = calloc(scan.njobs, sizeof(ull));
+    if (scan.deferred == NULL || scan.job_free == NULL)
+    {
+        goto ERROR;
+    }
+    // initial image bitmap as 1 (all block are used)
+    pc_init_bitmap(bitmap, 0xFF, fs_info.totalblock);
+
+    nthreads = g_get_num_processors();
+    if (nthreads > EXT_SCAN_MAX_THREADS)
+        nthreads = EXT_SCAN_MAX_THREADS;
+    if (nthreads > scan.njobs)
+        nthreads = scan.njobs;
+    for (i = 0; i < nthreads; i++)
+        threads[i] = g_thread_new("ext-bitmap", scan_bitmap_thread, &scan);
+    for (i = 0; i < nthreads; i++)
+        g_thread_join(threads[i]);
+    if (scan.failed)
+    {
+        goto ERROR;
+    }
+    /// the first group of every job, now that no thread touches the bitmap
+    for (job = 0; job < scan.njobs; job++)
+    {
+        ull start, group_blocks, gfree;
+
+        group = (dgrp_t)job * scan.groups_per_job;
+        start = get_group_first_block(extfs, group);
+        group_blocks = get_group_blocks(extfs, group, scan.total);
+        lfree += scan.job_free[job];
+        if (group_block_uninit(extfs, group))
+        {
+            pc_clear_range(start, group_blocks, bitmap, scan.total);
+            lfree += ext2fs_bg_free_blocks_count(extfs, group);
+            continue;
+        }
+        gfree = group_blocks - pc_copy_bits(start,
+                                            scan.deferred + (ull)job * nbytes,
+                                            group_blocks,
+                                            bitmap,
+                                            scan.total);
+        if (gfree != ext2fs_bg_free_blocks_count(extfs, group))
+        {
+            goto ERROR;
+        }
+        lfree += gfree;
+    }
+    /// uninit groups may hold each other's metadata, mark it once all are cleared
+    for (group = 0; group < extfs->group_desc_count; group++)
+    {
+        if (group_block_uninit(extfs, group))
+            mark_uninit_group_metadata(extfs, group, bitmap, scan.total);
+    }
+    /// check all free blocks in partition
+    ret = lfree == ext2fs_free_blocks_count(extfs->super);
+ERROR:
+    free(scan.job_free);
+    free(scan.deferred);
+    close(scan.fd);
+    return ret;
+}
+#endif
+
 // reference dumpe2fs
-static gboolean read_bitmap_info (const char      *device, 
+static gboolean read_bitmap_info (ext2_filsys      extfs,
+                                  const char      *device, 
                                   file_system_info fs_info, 
                                   ul              *bitmap) 
 {
-    ext2_filsys extfs;
     errcode_t   retval;
     ul          group;
-    ull         current_block, block;
+    ull         group_blocks;
     ull         lfree, gfree;
     char       *block_bitmap = NULL;
     int         block_nbytes;
@@ -112,11 +418,14 @@ static gboolean read_bitmap_info (const char      *device,
     int         bg_flags = 0;
     int         B_UN_INIT = 0;
 
-    extfs = open_file_system(device);
-    if (extfs == NULL)
+#ifndef EXTFS_1_41
+    /// bigalloc bitmaps count clusters, leave them to libext2fs
+    if (!(extfs->super->s_feature_ro_compat & EXT4_FEATURE_RO_COMPAT_BIGALLOC) &&
+        EXT2_BLOCKS_PER_GROUP(extfs->super) >= PART_BITS_PER_LONG)
     {
-        return FALSE;
-    }    
+        return scan_block_bitmaps(extfs, device, fs_info, bitmap);
+    }
+#endif
     retval = ext2fs_read_bitmaps(extfs); /// open extfs bitmap
     if (retval)
     {
@@ -131,7 +440,6 @@ static gboolean read_bitmap_info (const char      *device,
     pc_init_bitmap(bitmap, 0xFF, fs_info.totalblock);
 
     lfree = 0;
-    current_block = 0;
     blk_itr = extfs->super->s_first_data_block;
 
     /// each group
@@ -165,31 +473,16 @@ static gboolean read_bitmap_info (const char      *device,
                 B_UN_INIT = 1;
             } 
         }
-        // each block in group
-        for (block = 0; ((block < extfs->super->s_blocks_per_group) && 
-                    (current_block < (fs_info.totalblock-1))); 
-                block++) 
-        {
-            current_block = block + blk_itr;
-
-            if (in_use (block_bitmap, block))
-            {
-                if (!pc_set_bit(current_block, bitmap, fs_info.totalblock))
-                {
-                    return FALSE;
-                }    
-            } 
-            else 
-            {
-                lfree++;
-                gfree++;
-                if (!pc_clear_bit(current_block, bitmap, fs_info.totalblock))
-                {
-                    return FALSE;
-                }    
-            }
-
-        }
+        // copy the whole group into the image bitmap
+        group_blocks = blk_itr < fs_info.totalblock ? fs_info.totalblock - blk_itr : 0;
+        if (group_blocks > extfs->super->s_blocks_per_group)
+            group_blocks = extfs->super->s_blocks_per_group;
+        gfree = group_blocks - pc_copy_bits(blk_itr,
+                                            (const unsigned char *)block_bitmap,
+                                            group_blocks,
+                                            bitmap,
+                                            fs_info.totalblock);
+        lfree += gfree;
         blk_itr += extfs->super->s_blocks_per_group;
     }
     /// check free blocks in group
@@ -201,38 +494,300 @@ static gboolean read_bitmap_info (const char      *device,
         {
 #endif
             if (!B_UN_INIT)
-                return FALSE;
+                goto ERROR;
         }
     }
     /// check all free blocks in partition
     if (lfree != ext2fs_free_blocks_count(extfs->super)) 
     {
-        return FALSE;
+        goto ERROR;
     }
+    free(block_bitmap);
 
-    ext2fs_close(extfs);
+    return TRUE;
+ERROR:
     free(block_bitmap);
+    return FALSE;
+}
+#ifndef EXTFS_1_41
+#define JBD2_MAGIC_NUMBER       0xc03b3998U
+#define JBD2_FEATURE_CSUM_V2    0x00000008
+#define JBD2_FEATURE_CSUM_V3    0x00000010
+
+#define EXT_LEAN_ITABLE         0   /// inode table blocks holding no inodes
+#define EXT_LEAN_JOURNAL        1   /// log blocks of a clean journal
+
+/// jbd2 journal superblock, all fields are big endian
+typedef struct
+{
+    uint32_t h_magic;
+    uint32_t h_blocktype;
+    uint32_t h_sequence;
+    uint32_t s_blocksize;
+    uint32_t s_maxlen;
+    uint32_t s_first;
+    uint32_t s_sequence;
+    uint32_t s_start;
+    uint32_t s_errno;
+    uint32_t s_feature_compat;
+    uint32_t s_feature_incompat;
+    uint32_t s_feature_ro_compat;
+    uint8_t  s_uuid[16];
+    uint32_t s_nr_users;
+    uint32_t s_dynsuper;
+    uint32_t s_max_transaction;
+    uint32_t s_max_trans_data;
+    uint8_t  s_checksum_type;
+    uint8_t  s_padding2[3];
+    uint32_t s_padding[42];
+    uint32_t s_checksum;
+    uint8_t  s_users[16 * 48];
+} jbd2_super;
+
+typedef void (*ExtLeanFunc) (int kind, ull start, ull count, gpointer data);
+typedef struct
+{
+    ExtLeanFunc func;
+    gpointer    data;
+    ull         start;
+    ull         count;
+} ExtLeanRun;
+
+/// find the superblock of an internal journal that needs no recovery
+static gboolean read_clean_journal (ext2_filsys extfs, blk64_t *jsb_blk, jbd2_super *jsb)
+{
+    struct ext2_super_block *super = extfs->super;
+    char                    *buffer;
+
+    if (!(super->s_feature_compat & EXT3_FEATURE_COMPAT_HAS_JOURNAL) ||
+        super->s_journal_inum == 0 ||
+        super->s_feature_incompat & EXT3_FEATURE_INCOMPAT_RECOVER)
+    {
+        return FALSE;
+    }
+    if (ext2fs_bmap2(extfs, super->s_journal_inum, NULL, NULL, 0, 0, NULL, jsb_blk) || 
+        *jsb_blk == 0)
+    {
+        return FALSE;
+    }
+    buffer = malloc(extfs->blocksize);
+    if (buffer == NULL)
+    {
+        return FALSE;
+    }
+    if (io_channel_read_blk64(extfs->io, *jsb_blk, 1, buffer))
+    {
+        free(buffer);
+        return FALSE;
+    }
+    memcpy(jsb, buffer, sizeof(jbd2_super));
+    free(buffer);
+
+    return be32toh(jsb->h_magic) == JBD2_MAGIC_NUMBER && jsb->s_start == 0;
+}
+static int lean_journal_block (ext2_filsys extfs,
+                               blk64_t    *blocknr,
+                               e2_blkcnt_t blockcnt,
+                               blk64_t     ref_blk,
+                               int         ref_offset,
+                               void       *priv)
+{
+    ExtLeanRun *run = priv;
+
+    /// block 0 is the journal superblock, it stays in the image
+    if (blockcnt < 1)
+        return 0;
+    if (run->count > 0 && run->start + run->count == *blocknr)
+    {
+        run->count++;
+        return 0;
+    }
+    if (run->count > 0)
+        run->func(EXT_LEAN_JOURNAL, run->start, run->count, run->data);
+    run->start = *blocknr;
+    run->count = 1;
+
+    return 0;
+}
+/******************************************************************************
+ * Function:              foreach_lean_range      
+ *        
+ * Explain: Call func for the blocks a lean image leaves out.  Both sides
+ *          work from the group descriptors and journal superblock, which
+ *          are always copied, so restore finds the same ranges the backup
+ *          skipped.
+ *          - groups flagged INODE_UNINIT: the whole inode table
+ *          - groups flagged INODE_ZEROED: the table past bg_itable_unused
+ *          - a clean internal journal: every log block after its superblock
+ ******************************************************************************/
+static gboolean foreach_lean_range (ext2_filsys extfs, ExtLeanFunc func, gpointer data)
+{
+    const ull   inode_size = EXT2_INODE_SIZE(extfs->super);
+    const ull   ipg = extfs->super->s_inodes_per_group;
+    dgrp_t      group;
+    ExtLeanRun  run;
+    blk64_t     jsb_blk;
+    jbd2_super  jsb;
+
+    for (group = 0; ext2fs_has_group_desc_csum(extfs) && group < extfs->group_desc_count; group++)
+    {
+        int flags = ext2fs_bg_flags(extfs, group);
+        ull used_blocks;
+
+        if (!ext2fs_group_desc_csum_verify(extfs, group))
+            continue;
+        if (flags & EXT2_BG_INODE_UNINIT)
+        {
+            used_blocks = 0;
+        }
+        else if (flags & EXT2_BG_INODE_ZEROED)
+        {
+            ull used_inodes = ipg - ext2fs_bg_itable_unused(extfs, group);
+
+            used_blocks = (used_inodes * inode_size + extfs->blocksize - 1) / extfs->blocksize;
+        }
+        else
+        {
+            continue;
+        }
+        if (used_blocks < extfs->inode_blocks_per_group)
+        {
+            func(EXT_LEAN_ITABLE,
+                 ext2fs_inode_table_loc(extfs, group) + used_blocks,
+                 extfs->inode_blocks_per_group - used_blocks,
+                 data);
+        }
+    }
+    if (read_clean_journal(extfs, &jsb_blk, &jsb))
+    {
+        memset(&run, 0, sizeof(run));
+        run.func = func;
+        run.data = data;
+        if (ext2fs_block_iterate3(extfs, 
+                                  extfs->super->s_journal_inum,
+                                  BLOCK_FLAG_READ_ONLY | BLOCK_FLAG_DATA_ONLY,
+                                  NULL,
+                                  lean_journal_block,
+                                  &run))
+        {
+            return FALSE;
+        }
+        if (run.count > 0)
+            func(EXT_LEAN_JOURNAL, run.start, run.count, data);
+    }
 
     return TRUE;
 }
-static gboolean read_super_blocks(const char* device, file_system_info* fs_info)
+static void clear_lean_range (int kind, ull start, ull count, gpointer data)
+{
+    file_system_info *fs_info = ((gpointer *)data)[0];
+    ul               *bitmap  = ((gpointer *)data)[1];
+
+    if (start < fs_info->totalblock && count > fs_info->totalblock - start)
+        count = fs_info->totalblock - start;
+    pc_clear_range(start, count, bitmap, fs_info->totalblock);
+}
+/// leave the lean ranges out of the image bitmap
+static gboolean clear_lean_blocks (ext2_filsys extfs, file_system_info *fs_info, ul *bitmap)
+{
+    gpointer    data[2] = { fs_info, bitmap };
+
+    return foreach_lean_range(extfs, clear_lean_range, data);
+}
+typedef struct
+{
+    int     *fd;
+    uint     block_size;
+    gboolean failed;
+} ExtLeanZero;
+
+static void zero_lean_range (int kind, ull start, ull count, gpointer data)
+{
+    ExtLeanZero *zero = data;
+
+    /// stale log blocks are fenced off by the new journal sequence instead
+    if (kind != EXT_LEAN_ITABLE || zero->failed)
+        return;
+    if (!zero_device_range(zero->fd, start * zero->block_size, count * zero->block_size))
+        zero->failed = TRUE;
+}
+/// give the journal a fresh sequence so whatever the target held in the
+/// log area can never look like a transaction of this file system
+static gboolean reset_journal_super (int *fd, ull offset, jbd2_super *jsb)
+{
+    uint32_t sequence = be32toh(jsb->s_sequence) ^ g_random_int();
+
+    jsb->s_sequence = htobe32(sequence ? sequence : 1);
+    jsb->s_start = 0;
+    if (be32toh(jsb->s_feature_incompat) & (JBD2_FEATURE_CSUM_V2 | JBD2_FEATURE_CSUM_V3))
+    {
+        jsb->s_checksum = 0;
+        jsb->s_checksum = htobe32(ext2fs_crc32c_le(~0U, (unsigned char *)jsb, sizeof(jbd2_super)));
+    }
+    if (lseek(*fd, (off_t)offset, SEEK_SET) == (off_t)-1)
+    {
+        return FALSE;
+    }
+
+    return write_read_io_all(fd, (char *)jsb, sizeof(jbd2_super), WRITE) == sizeof(jbd2_super);
+}
+/******************************************************************************
+ * Function:              reinit_lean_blocks      
+ *        
+ * Explain: Finish a lean restore or partition copy: zero the inode tables
+ *          the image left out and reset the journal superblock
+ *        
+ * Input:   @target       restored file system, read back through libext2fs
+ *          @fd           descriptor the data was written through
+ *        
+ * Output:  success      :TRUE
+ *          fail         :FALSE
+ ******************************************************************************/
+static gboolean reinit_lean_blocks (const char *target, int *fd)
 {
     ext2_filsys extfs;
+    ExtLeanZero zero;
+    blk64_t     jsb_blk;
+    jbd2_super  jsb;
+    gboolean    ret;
 
-    strncpy(fs_info->fs, extfs_MAGIC, FS_MAGIC_SIZE);
-    extfs = open_file_system (device);
+    extfs = open_file_system(target);
     if (extfs == NULL)
     {
         return FALSE;
-    }    
+    }
+    zero.fd = fd;
+    zero.block_size = extfs->blocksize;
+    zero.failed = FALSE;
+    ret = foreach_lean_range(extfs, zero_lean_range, &zero) && !zero.failed;
+    if (ret && read_clean_journal(extfs, &jsb_blk, &jsb))
+    {
+        ret = reset_journal_super(fd, jsb_blk * extfs->blocksize, &jsb);
+    }
+    ext2fs_close(extfs);
+
+    return ret;
+}
+#else
+/// lean images need the 64 bit group descriptor accessors
+static gboolean clear_lean_blocks (ext2_filsys extfs, file_system_info *fs_info, ul *bitmap)
+{
+    return FALSE;
+}
+static gboolean reinit_lean_blocks (const char *target, int *fd)
+{
+    return FALSE;
+}
+#endif
+static gboolean read_super_blocks(ext2_filsys extfs, file_system_info* fs_info)
+{
+    strncpy(fs_info->fs, extfs_MAGIC, FS_MAGIC_SIZE);
     fs_info->block_size  = EXT2_BLOCK_SIZE(extfs->super);
     fs_info->totalblock  = (ull)ext2fs_blocks_count(extfs->super);
     fs_info->usedblocks  = (ull)(ext2fs_blocks_count(extfs->super) - 
                                  ext2fs_free_blocks_count(extfs->super));
     fs_info->device_size = fs_info->block_size * fs_info->totalblock;
 
-    ext2fs_close(extfs);
-
     return TRUE;
 }
 static gboolean check_system_space (file_system_info *fs_info,
@@ -273,32 +828,22 @@ static gboolean check_system_space (file_system_info *fs_info,
  ******************************************************************************/
 static ull get_read_blocks_size (file_system_info *fs_info,ull *block_id,ul *bitmap)
 {
-    ull blocks_skip,blocks_read;
+    ull read_end;
     const ull  blocks_total = fs_info->totalblock;
     const uint block_size = fs_info->block_size;
     const uint buffer_capacity = DEFAULT_BUFFER_SIZE > block_size ? DEFAULT_BUFFER_SIZE / block_size : 1;
 
     /// skip unused blocks
-    for (blocks_skip = 0;
-        *block_id + blocks_skip < blocks_total &&
-        !pc_test_bit(*block_id + blocks_skip, bitmap, blocks_total);
-         blocks_skip++);
-    if (*block_id + blocks_skip == blocks_total)
+    *block_id = pc_find_next_set(bitmap, blocks_total, *block_id);
+    if (*block_id >= blocks_total)
     {
         return 0;
     }
+    /// read blocks size < buffer_capacity && Current block has data
+    read_end = *block_id + buffer_capacity < blocks_total ?
+               *block_id + buffer_capacity : blocks_total;
 
-    if (blocks_skip)
-    {    
-        *block_id += blocks_skip;
-    }
-    /// read blocks size < 256 && Current block has data
-    for (blocks_read = 0;
-        *block_id + blocks_read < blocks_total && blocks_read < buffer_capacity &&
-         pc_test_bit(*block_id + blocks_read, bitmap,blocks_total);
-       ++blocks_read);
-
-    return blocks_read;
+    return pc_find_next_zero(bitmap, read_end, *block_id) - *block_id;
 
 }    
 static gboolean read_write_data_ptf (SysbakGdbus      *object,
@@ -315,6 +860,7 @@ static gboolean read_write_data_ptf (SysbakGdbus      *object,
     uint  blocks_in_cs = 0, blocks_per_cs, write_size;
     char *read_buffer, *write_buffer;
     ull   block_id = 0;	
+    ull   copied_count = 0;
     int   r_size, w_size;	
     progress_bar  prog;
     progress_data pdata;
@@ -343,6 +889,10 @@ static gboolean read_write_data_ptf (SysbakGdbus      *object,
         ull i,blocks_read;
         int cs_added = 0, write_offset = 0;
         off_t offset;
+        if (!job_continue (object))
+        {
+            goto ERROR;
+        }
         blocks_read = get_read_blocks_size (fs_info,&block_id,bitmap);
         if (blocks_read == 0)
             break;
@@ -384,10 +934,10 @@ static gboolean read_write_data_ptf (SysbakGdbus      *object,
         {
             pdata.percent=100.0;
         }
-        sysbak_gdbus_emit_sysbak_progress (object,
-                                           pdata.percent,
-                                           pdata.speed,
-                                           pdata.elapsed);
+        emit_sysbak_progress (object,
+                              pdata.percent,
+                              pdata.speed,
+                              pdata.elapsed);
         if (r_size + cs_added * img_opt->checksum_size != w_size)
         {
             goto ERROR;
@@ -421,11 +971,13 @@ gboolean gdbus_sysbak_extfs_ptf (SysbakGdbus           *object,
                                  GDBusMethodInvocation *invocation,
 								 const gchar           *source,
 								 const gchar           *target,
-                                 gboolean               overwrite)
+                                 gboolean               overwrite,
+                                 gboolean               lean)
 {
     file_system_info fs_info;   /// description of the file system
     image_options    img_opt;
     unsigned long   *bitmap = NULL;
+    ext2_filsys      extfs = NULL;
     uint             buffer_capacity;
     int              e_code;
     gint             dfr = 0,dfw = 0;
@@ -452,8 +1004,9 @@ gboolean gdbus_sysbak_extfs_ptf (SysbakGdbus           *object,
     init_file_system_info(&fs_info);
     init_image_options(&img_opt);
     
-    // get Super Block information from partition
-    if (!read_super_blocks(source, &fs_info))
+    // the file system is opened once and serves every probe below
+    extfs = open_file_system(source);
+    if (extfs == NULL || !read_super_blocks(extfs, &fs_info))
     {
         e_code = 3;
         goto ERROR;
@@ -474,11 +1027,22 @@ gboolean gdbus_sysbak_extfs_ptf (SysbakGdbus           *object,
         e_code = 4;
         goto ERROR;
     }
-    if (!read_bitmap_info(source, fs_info, bitmap))
+    if (!read_bitmap_info(extfs, source, fs_info, bitmap))
     {
         e_code = 5;
         goto ERROR;
     }    
+    if (lean)
+    {
+        if (!clear_lean_blocks(extfs, &fs_info, bitmap))
+        {
+            e_code = 5;
+            goto ERROR;
+        }
+        set_image_fs_flags(&img_opt, IMAGE_FS_LEAN);
+    }
+    ext2fs_close(extfs);
+    extfs = NULL;
     update_used_blocks_count(&fs_info, bitmap);
     if (!check_system_space (&fs_info,target,&img_opt))
     {
@@ -491,28 +1055,34 @@ gboolean gdbus_sysbak_extfs_ptf (SysbakGdbus           *object,
         goto ERROR;
     }    
     write_image_bitmap(&dfw, fs_info, bitmap);
-    copied_count = 0;
-    sysbak_gdbus_complete_sysbak_extfs_ptf (object,invocation); 
+    if (invocation != NULL)
+        sysbak_gdbus_complete_sysbak_extfs_ptf (object,invocation);
+    invocation = NULL;      /// answered, the ERROR path must not answer it again
     if (!read_write_data_ptf (object,&fs_info,&img_opt,bitmap,&dfr,&dfw))
     {
         e_code = 8;
         goto ERROR;
     } 
 
-	sysbak_gdbus_emit_sysbak_finished (object,
-                                       fs_info.totalblock,
-                                       fs_info.usedblocks,
-                                       fs_info.block_size);
-    free(bitmap);
+	emit_sysbak_finished (object,
+                          fs_info.totalblock,
+                          fs_info.usedblocks,
+                          fs_info.block_size);
+    pc_free_bitmap(bitmap);
     close (dfw);
     close (dfr);
     return TRUE;
 ERROR:
-	sysbak_gdbus_complete_sysbak_extfs_ptf (object,invocation); 
-	sysbak_gdbus_emit_sysbak_error (object,
-                                    sysbak_error_message[e_code],
-                                    e_code);
-    free(bitmap);
+	if (invocation != NULL)
+	    sysbak_gdbus_complete_sysbak_extfs_ptf (object,invocation);
+	emit_sysbak_error (object,
+                       sysbak_error_message[e_code],
+                       e_code);
+    pc_free_bitmap(bitmap);
+    if (extfs != NULL)
+    {
+        ext2fs_close(extfs);
+    }
     if (dfr > 0)
     {    
         close (dfr);
@@ -555,6 +1125,10 @@ static gboolean read_write_data_ptp (SysbakGdbus      *object,
         ull blocks_read;
         off_t offset;
 
+        if (!job_continue (object))
+        {
+            goto ERROR;
+        }
         blocks_read = get_read_blocks_size (fs_info,&block_id,bitmap);
         if (blocks_read == 0)
             break;
@@ -583,10 +1157,10 @@ static gboolean read_write_data_ptp (SysbakGdbus      *object,
         {
             pdata.percent=100.0;
         }
-		sysbak_gdbus_emit_sysbak_progress (object,
-                                           pdata.percent,
-                                           pdata.speed,
-                                           pdata.elapsed);
+		emit_sysbak_progress (object,
+                              pdata.percent,
+                              pdata.speed,
+                              pdata.elapsed);
     } while (1);
 
     free(buffer);
@@ -603,11 +1177,13 @@ gboolean gdbus_sysbak_extfs_ptp (SysbakGdbus           *object,
                                  GDBusMethodInvocation *invocation,
                                  const gchar           *source,
                                  const gchar           *target,
-                                 gboolean               overwrite)
+                                 gboolean               overwrite,
+                                 gboolean               lean)
 {
     file_system_info fs_info;   /// description of the file system
     image_options    img_opt;
     ul              *bitmap = NULL;
+    ext2_filsys      extfs = NULL;
     uint             buffer_capacity;
     ull free_space = 0;
     gint             e_code;
@@ -628,8 +1204,9 @@ gboolean gdbus_sysbak_extfs_ptp (SysbakGdbus           *object,
 
     init_file_system_info(&fs_info);
     init_image_options(&img_opt);
-    // get Super Block information from partition
-    if (!read_super_blocks(source, &fs_info))
+    // the file system is opened once and serves every probe below
+    extfs = open_file_system(source);
+    if (extfs == NULL || !read_super_blocks(extfs, &fs_info))
     {
         e_code = 3;
         goto ERROR;
@@ -652,19 +1229,27 @@ gboolean gdbus_sysbak_extfs_ptp (SysbakGdbus           *object,
         goto ERROR;
     }
 
-    if (!read_bitmap_info(source, fs_info, bitmap))
+    if (!read_bitmap_info(extfs, source, fs_info, bitmap))
     {
         e_code = 5;
         goto ERROR;
     }    
+    if (lean && !clear_lean_blocks(extfs, &fs_info, bitmap))
+    {
+        e_code = 5;
+        goto ERROR;
+    }
+    ext2fs_close(extfs);
+    extfs = NULL;
     free_space = get_partition_free_space(&dfw);
     if (free_space < fs_info.device_size)
     {
         e_code = 6;
         goto ERROR;
     }   
-    copied_count = 0;
-    sysbak_gdbus_complete_sysbak_extfs_ptp (object,invocation); 
+    if (invocation != NULL)
+        sysbak_gdbus_complete_sysbak_extfs_ptp (object,invocation);
+    invocation = NULL;
     if (!read_write_data_ptp (object,
                              &fs_info,
                               bitmap,
@@ -674,19 +1259,29 @@ gboolean gdbus_sysbak_extfs_ptp (SysbakGdbus           *object,
         e_code = 8;
         goto ERROR;
     }
+    if (lean && !reinit_lean_blocks(target, &dfw))
+    {
+        e_code = 8;
+        goto ERROR;
+    }
 
     fsync(dfw);
-    free(bitmap);
+    pc_free_bitmap(bitmap);
     close (dfr);
     close (dfw);
-    sysbak_gdbus_emit_sysbak_finished (object,
-                                       fs_info.totalblock,
-                                       fs_info.usedblocks,
-                                       fs_info.block_size);
+    emit_sysbak_finished (object,
+                          fs_info.totalblock,
+                          fs_info.usedblocks,
+                          fs_info.block_size);
     return TRUE;
 ERROR:
-    sysbak_gdbus_complete_sysbak_extfs_ptp (object,invocation); 
-    free(bitmap);
+    if (invocation != NULL)
+        sysbak_gdbus_complete_sysbak_extfs_ptp (object,invocation);
+    pc_free_bitmap(bitmap);
+    if (extfs != NULL)
+    {
+        ext2fs_close(extfs);
+    }
     if (dfr > 0)
     {    
         close (dfr);
@@ -695,20 +1290,18 @@ ERROR:
     {    
         close (dfw);
     }    
-    sysbak_gdbus_emit_sysbak_error (object,
-                                    sysbak_error_message[e_code],
-                                    e_code);
+    emit_sysbak_error (object,
+                       sysbak_error_message[e_code],
+                       e_code);
     return FALSE;
 }  
 static ull get_blocks_used (ull blocks_total,ul *bitmap,ull usedblocks)
 {
-    ull blocks_used_fix = 0, test_block = 0;
+    ull blocks_used_fix = 0;
     ull blocks_used = usedblocks;
 
     // fix some super block record incorrect
-    for (test_block = 0; test_block < blocks_total; ++test_block)
-        if (pc_test_bit(test_block, bitmap, blocks_total))
-            blocks_used_fix++;
+    blocks_used_fix = pc_count_bits(bitmap, blocks_total);
 
     if (blocks_used_fix != blocks_used)
     {    
@@ -734,6 +1327,7 @@ static gboolean read_write_data_restore (SysbakGdbus      *object,
     guchar checksum[img_opt->checksum_size];
     char  *read_buffer = NULL, *write_buffer = NULL;
     ull    block_id;    
+    ull    copied_count = 0;
     int    r_size, w_size;  
 	progress_bar  prog;
     progress_data pdata;
@@ -772,6 +1366,10 @@ static gboolean read_write_data_restore (SysbakGdbus      *object,
             buffer_capacity : blocks_used - copied_count;
         if (!blocks_read)
             break;
+        if (!job_continue (object))
+        {
+            goto ERROR;
+        }
         read_size = convert_blocks_to_bytes(copied_count,
                                             blocks_read,
                                             block_size,
@@ -823,12 +1421,12 @@ static gboolean read_write_data_restore (SysbakGdbus      *object,
         do
         {
             uint blocks_write = 0;
+            ull  next_used, write_end;
 
             // count bytes to skip
-            for (bytes_skip = 0;
-                 block_id < blocks_total &&
-                !pc_test_bit(block_id, bitmap, fs_info->totalblock);
-                 block_id++, bytes_skip += block_size);
+            next_used  = pc_find_next_set(bitmap, blocks_total, block_id);
+            bytes_skip = (next_used - block_id) * block_size;
+            block_id   = next_used;
 
             // skip empty blocks
            if (blocks_write == 0)
@@ -839,11 +1437,10 @@ static gboolean read_write_data_restore (SysbakGdbus      *object,
                 }
             }
             // blocks to write
-            for (blocks_write = 0;
-                 block_id + blocks_write < blocks_total &&
-                 blocks_written + blocks_write < blocks_read &&
-                 pc_test_bit(block_id + blocks_write, bitmap, fs_info->totalblock);
-                 blocks_write++);
+            write_end = block_id + (blocks_read - blocks_written);
+            if (write_end > blocks_total)
+                write_end = blocks_total;
+            blocks_write = pc_find_next_zero(bitmap, write_end, block_id) - block_id;
 
             // write blocks
             if (blocks_write > 0)
@@ -865,7 +1462,7 @@ static gboolean read_write_data_restore (SysbakGdbus      *object,
 			{
 				pdata.percent=100.0;
 			}
-			sysbak_gdbus_emit_sysbak_progress (object,
+			emit_sysbak_progress (object,
 										       pdata.percent,
 									           pdata.speed,
 										       pdata.elapsed);
@@ -897,6 +1494,10 @@ gboolean gdbus_sysbak_restore (SysbakGdbus           *object,
     image_options    img_opt;
     image_head       img_head;
     ul              *bitmap = NULL;
+    GArray          *copies = NULL;
+    image_xfs_log    xlog;
+    image_tail       tail;
+    char            *tail_data = NULL;
     ull              free_space;
     int              e_code;
     gint             dfr = 0,dfw = 0;
@@ -939,14 +1540,34 @@ gboolean gdbus_sysbak_restore (SysbakGdbus           *object,
         e_code = 5;
         goto ERROR;
     }    
+    if (img_opt.fs_flags & IMAGE_FS_COPIES)
+    {
+        copies = g_array_new(FALSE, FALSE, sizeof(image_copy_range));
+        if (!read_image_copies(&dfr, copies))
+        {
+            e_code = 9;
+            goto ERROR;
+        }
+    }
+    if (img_opt.fs_flags & IMAGE_FS_XFS_LOG && !read_image_xfs_log(&dfr, &xlog))
+    {
+        e_code = 9;
+        goto ERROR;
+    }
+    if (img_opt.fs_flags & IMAGE_FS_TAIL && !read_image_tail(&dfr, fs_info, &tail, &tail_data))
+    {
+        e_code = 9;
+        goto ERROR;
+    }
     free_space = get_partition_free_space(&dfw);
     if (free_space < fs_info.device_size)
     {
         e_code = 6;
         goto ERROR;
     }  
-    copied_count = 0;
-    sysbak_gdbus_complete_sysbak_restore (object,invocation);
+    if (invocation != NULL)
+        sysbak_gdbus_complete_sysbak_restore (object,invocation);
+    invocation = NULL;
     if (!read_write_data_restore (object,
                                   &fs_info,
                                   &img_opt,
@@ -957,17 +1578,48 @@ gboolean gdbus_sysbak_restore (SysbakGdbus           *object,
         e_code = 8;
         goto ERROR;
     } 
-    free(bitmap);
+    if (img_opt.fs_flags & IMAGE_FS_LEAN && !reinit_lean_blocks(target, &dfw))
+    {
+        e_code = 8;
+        goto ERROR;
+    }
+    if (copies != NULL && !rebuild_copy_ranges(&dfw, fs_info, bitmap, copies))
+    {
+        e_code = 8;
+        goto ERROR;
+    }
+    if (img_opt.fs_flags & IMAGE_FS_XFS_LOG && !format_xfs_log(&dfw, &xlog))
+    {
+        e_code = 8;
+        goto ERROR;
+    }
+    if (tail_data != NULL && !write_device_tail(&dfw, &tail, tail_data))
+    {
+        e_code = 8;
+        goto ERROR;
+    }
+    if (copies != NULL)
+    {
+        g_array_free(copies, TRUE);
+    }
+    g_free(tail_data);
+    pc_free_bitmap(bitmap);
     close (dfw);
     close (dfr);
-    sysbak_gdbus_emit_sysbak_finished (object,
+    emit_sysbak_finished (object,
             fs_info.totalblock,
             fs_info.usedblocks,
             fs_info.block_size);
     return TRUE;
 ERROR:
-    sysbak_gdbus_complete_sysbak_restore (object,invocation);
-    free(bitmap);
+    if (invocation != NULL)
+        sysbak_gdbus_complete_sysbak_restore (object,invocation);
+    pc_free_bitmap(bitmap);
+    if (copies != NULL)
+    {
+        g_array_free(copies, TRUE);
+    }
+    g_free(tail_data);
     if (dfr > 0)
     {    
         close (dfr);
@@ -976,7 +1628,7 @@ ERROR:
     {    
         close (dfw);
     }    
-    sysbak_gdbus_emit_sysbak_error (object,
+    emit_sysbak_error (object,
             sysbak_error_message[e_code],
             e_code);
     return FALSE;
@@ -27,13 +27,15 @@ gboolean      gdbus_sysbak_extfs_ptf      (SysbakGdbus           *object,
                                            GDBusMethodInvocation *invocation,
                                            const gchar           *source,
                                            const gchar           *target,
-                                           gboolean               overwrite);
+                                           gboolean               overwrite,
+                                           gboolean               lean);
 
 gboolean      gdbus_sysbak_extfs_ptp      (SysbakGdbus           *object,
                                            GDBusMethodInvocation *invocation,
                                            const gchar           *source,
                                            const gchar           *target,
-                                           gboolean               overwrite);
+                                           gboolean               overwrite,
+                                           gboolean               lean);
 
 gboolean      gdbus_sysbak_restore        (SysbakGdbus           *object,
                                            GDBusMethodInvocation *invocation,
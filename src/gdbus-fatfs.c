@@ -26,8 +26,15 @@
 #define GET_UNALIGNED_W(f)     ( (uint16_t)f[0] | ((uint16_t)f[1]<<8) )
 #define ROUND_TO_MULTIPLE(n,m) ((n) && (m) ? (n)+(m)-1-((n)-1)%(m) : 0)
 #define MSDOS_DIR_BITS         5        /* log2(sizeof(struct msdos_dir_entry)) */
+#define FAT_CHUNK_BYTES        (3 * 256 * 1024) /* whole FAT12/16/32 entries per read */
+#define FAT12_BAD_CLUSTER      0xFF7
+#define FAT16_BAD_CLUSTER      0xFFF7
+#define FAT32_BAD_CLUSTER      0x0FFFFFF7
+#define FAT16_CLEAN_SHUTDOWN   0x8000
+#define FAT16_NO_DISK_ERROR    0x4000
+#define FAT32_CLEAN_SHUTDOWN   0x08000000
+#define FAT32_NO_DISK_ERROR    0x04000000
 
-static int FS;
 static const char *sysbak_error_message[10] = 
 {
 	"Device Busy",
@@ -38,10 +45,9 @@ static const char *sysbak_error_message[10] =
 	"Failed to read bitmap",
 	"Not enough disk  space",
 	"Write header information failed",
-	"Failed reading and writing data"
+	"Failed reading and writing data",
 	"Failed reading image header"
 };
-static ull copied_count;
 static ull get_total_sector(FatBootSector *fat_sb)
 {
     ull total_sector = 0;
@@ -95,245 +101,261 @@ static ull get_cluster_count(FatBootSector *fat_sb)
     cluster_count = data_sec / fat_sb->cluster_size;
     return cluster_count;
 }
-/// mark reserved sectors as used
-static ull mark_reserved_sectors(ul *fat_bitmap, ull block,FatBootSector *fat_sb)
+/******************************************************************************
+ * Function:              get_fat_block_size      
+ *        
+ * Explain: Image block size for a FAT volume, one cluster.  The data area
+ *          need not line up on it: a block that holds the end of the FATs
+ *          or the root directory and the start of a cluster is used, see
+ *          mark_cluster_run.  Neither need the end of the volume, the
+ *          sectors after the last whole block go in the image tail.
+ ******************************************************************************/
+static uint get_fat_block_size(FatBootSector *fat_sb)
+{
+    return (uint)fat_sb->cluster_size * fat_sb->sector_size;
+}
+/// mark sectors as used, rounded out to whole blocks
+static void mark_used_sectors(ul  *fat_bitmap, 
+                              ull  sector, 
+                              ull  count, 
+                              ull  sec_per_block,
+                              ull  total_block)
+{
+    ull first = sector / sec_per_block;
+    ull last  = (sector + count + sec_per_block - 1) / sec_per_block;
+
+    /// sectors past the last whole block are in the image tail
+    if (last > total_block)
+        last = total_block;
+    if (first < last)
+        pc_set_range(first, last - first, fat_bitmap, total_block);
+}
+/// mark reserved sectors as used, returns the first data sector
+static ull mark_reserved_sectors(ul *fat_bitmap, ull sec_per_block,FatBootSector *fat_sb)
 {
-    ull i = 0;
-    ull j = 0;
     ull sec_per_fat = 0;
     ull root_sec = 0;
     ull total_block;
+    ull sector = 0;
     
-    total_block = get_total_sector (fat_sb);
+    total_block = get_total_sector (fat_sb) / sec_per_block;
     sec_per_fat = get_sec_per_fat(fat_sb);
     root_sec = get_root_sec(fat_sb);
 
     /// A) the reserved sectors are used
-    for (i=0; i < fat_sb->reserved; i++,block++)
-        pc_set_bit(block, fat_bitmap, total_block);
+    mark_used_sectors(fat_bitmap, sector, fat_sb->reserved, sec_per_block, total_block);
+    sector += fat_sb->reserved;
 
     /// B) the FAT tables are on used sectors
-    for (j=0; j < fat_sb->fats; j++)
-        for (i=0; i < sec_per_fat ; i++,block++)
-            pc_set_bit(block, fat_bitmap, total_block);
+    mark_used_sectors(fat_bitmap, sector, fat_sb->fats * sec_per_fat, sec_per_block, total_block);
+    sector += fat_sb->fats * sec_per_fat;
 
     /// C) The rootdirectory is on used sectors
     if (root_sec > 0) /// no rootdir sectors on FAT32
-        for (i=0; i < root_sec; i++,block++)
-            pc_set_bit(block, fat_bitmap, total_block);
-    return block;
+    {
+        mark_used_sectors(fat_bitmap, sector, root_sec, sec_per_block, total_block);
+        sector += root_sec;
+    }
+    return sector;
 }
-static int check_fat_status(int fd) 
+/// FAT[1] carries the clean shutdown and hard error flags on FAT16/FAT32
+static gboolean check_fat_status(int fs, uint32_t status_entry) 
 {
-    uint16_t Fat16_Entry;
-    uint32_t Fat32_Entry;
-    int fs_error = 2;
-    int fs_good = 0;
-    int fs_bad = 1;
-
-    if (FS == FAT_16)
+    if (fs == FAT_16)
     {
-        read(fd, &Fat16_Entry, sizeof(Fat16_Entry));
-        if (!(Fat16_Entry & 0x8000))
-            return fs_bad;
-        if (!(Fat16_Entry & 0x4000))
-            return fs_error;
-
+        if (!(status_entry & FAT16_CLEAN_SHUTDOWN))
+            return FALSE;
+        if (!(status_entry & FAT16_NO_DISK_ERROR))
+            return FALSE;
     } 
-    else if (FS == FAT_32) 
+    else if (fs == FAT_32) 
     {
-        read(fd, &Fat32_Entry, sizeof(Fat32_Entry));
-        if (!(Fat32_Entry & 0x08000000))
-            return fs_bad;
-        if (!(Fat32_Entry & 0x04000000))
-            return fs_error;
+        if (!(status_entry & FAT32_CLEAN_SHUTDOWN))
+            return FALSE;
+        if (!(status_entry & FAT32_NO_DISK_ERROR))
+            return FALSE;
     } 
-    return fs_good;
+    return TRUE;
 }
-static ull check_fat16_entry(ul  *fat_bitmap, 
-                             ull  total_block,
-                             ull  cluster_size,
-                             ull  block, 
-                             ull *bfree, 
-                             ull *bused, 
-                             ull *DamagedClusters,
-                             int  fd)
+static uint get_fat_entry_bits(int fs)
 {
-    uint16_t Fat16_Entry = 0;
-    ull i = 0;
-    
-    read(fd, &Fat16_Entry, sizeof(Fat16_Entry));
-    if (Fat16_Entry  == 0xFFF7) 
-    { /// bad FAT16 cluster
-        DamagedClusters++;
-        for (i=0; i < cluster_size; i++,block++)
-            pc_clear_bit(block, fat_bitmap, total_block);
-    } 
-    else if (Fat16_Entry == 0x0000)
-    { /// free
-        bfree++;
-        for (i=0; i < cluster_size; i++,block++)
-            pc_clear_bit(block, fat_bitmap, total_block);
-    } 
-    else 
-    {
-        bused++;
-        for (i=0; i < cluster_size; i++,block++)
-            pc_set_bit(block, fat_bitmap, total_block);
-    }
-    return block;
+    if (fs == FAT_12)
+        return 12;
+    if (fs == FAT_16)
+        return 16;
+    return 32;
 }
-/// check per FAT32 entry
-static ull check_fat32_entry(ul  *fat_bitmap,
-                             ull  total_block,
-                             ull  cluster_size,
-                             ull  block, 
-                             ull *bfree, 
-                             ull *bused, 
-                             ull *DamagedClusters,
-                             int  fd)
+static uint32_t get_fat_bad_cluster(int fs)
 {
-    uint32_t Fat32_Entry = 0;
-    ull i = 0;
-    
-    read(fd, &Fat32_Entry, sizeof(Fat32_Entry));
-    if (Fat32_Entry  == 0x0FFFFFF7) 
-    { /// bad FAT32 cluster
-        DamagedClusters++;
-        for (i=0; i < cluster_size; i++,block++)
-            pc_clear_bit(block, fat_bitmap, total_block);
-    } 
-    else if (Fat32_Entry == 0x0000)
-    { /// free
-        bfree++;
-        for (i=0; i < cluster_size; i++,block++)
-            pc_clear_bit(block, fat_bitmap, total_block);
-    } 
-    else 
+    if (fs == FAT_12)
+        return FAT12_BAD_CLUSTER;
+    if (fs == FAT_16)
+        return FAT16_BAD_CLUSTER;
+    return FAT32_BAD_CLUSTER;
+}
+/// decode count entries of a FAT chunk that starts on an even entry
+static void decode_fat_entries(int fs, const uint8_t *buf, ull count, uint32_t *entries)
+{
+    ull i;
+
+    if (fs == FAT_32)
+    {
+        for (i = 0; i < count; i++)
+            entries[i] = ((uint32_t)buf[4 * i]             |
+                          (uint32_t)buf[4 * i + 1] << 8    |
+                          (uint32_t)buf[4 * i + 2] << 16   |
+                          (uint32_t)buf[4 * i + 3] << 24) & 0x0FFFFFFF;
+    }
+    else if (fs == FAT_16)
     {
-        bused++;
-        for (i=0; i < cluster_size; i++,block++)
-            pc_set_bit(block, fat_bitmap, total_block);
+        for (i = 0; i < count; i++)
+            entries[i] = GET_UNALIGNED_W((buf + 2 * i));
     }
+    else
+    {
+        /// two 12-bit entries are packed in three bytes
+        for (i = 0; i + 1 < count; i += 2)
+        {
+            const uint8_t *p = buf + i / 2 * 3;
 
-    return block;
+            entries[i]     = p[0] | (uint32_t)(p[1] & 0x0F) << 8;
+            entries[i + 1] = p[1] >> 4 | (uint32_t)p[2] << 4;
+        }
+        if (i < count)
+            entries[i] = buf[i / 2 * 3] | (uint32_t)(buf[i / 2 * 3 + 1] & 0x0F) << 8;
+    }
 }
-/// check per FAT12 entry
-static ull check_fat12_entry(ul  *fat_bitmap, 
-                             ull  total_block,
-                             ull  cluster_size,
-                             ull  block, 
-                             ull *bfree, 
-                             ull *bused, 
-                             ull *DamagedClusters,
-                             int  fd)
+/// sectors [start, end) of a cluster run, a block is free only when all of it is
+static void mark_cluster_run(ul      *bitmap,
+                             ull      start,
+                             ull      end,
+                             gboolean used,
+                             ull      sec_per_block,
+                             ull      total_block)
 {
-    uint16_t Fat16_Entry = 0;
-    uint16_t Fat12_Entry = 0;
-    ull i = 0;
-    
-    read(fd, &Fat16_Entry, sizeof(Fat16_Entry));
-    Fat12_Entry = Fat16_Entry>>4;
-    if (Fat12_Entry  == 0xFF7) 
-    { /// bad FAT12 cluster
-        DamagedClusters++;
-        for (i=0; i < cluster_size; i++,block++)
-            pc_clear_bit(block, fat_bitmap, total_block);
-    } 
-    else if (Fat12_Entry == 0x0000)
-    { /// free
-        bfree++;
-        for (i=0; i < cluster_size; i++,block++)
-            pc_clear_bit(block, fat_bitmap, total_block);
-    } 
-    else 
+    ull first, last;
+
+    if (start >= end)
+        return;
+    if (used)
+    {
+        first = start / sec_per_block;
+        last  = (end + sec_per_block - 1) / sec_per_block;
+        if (last > total_block)
+            last = total_block;
+        if (first < last)
+            pc_set_range(first, last - first, bitmap, total_block);
+    }
+    else
     {
-        bused++;
-        for (i=0; i < cluster_size; i++,block++)
-            pc_set_bit(block, fat_bitmap, total_block);
+        first = (start + sec_per_block - 1) / sec_per_block;
+        last  = end / sec_per_block;
+        if (first < last)
+            pc_clear_range(first, last - first, bitmap, total_block);
     }
-    return block;
 }
-/// get_used_block - get FAT used blocks
-static ull get_used_block(FatBootSector *fat_sb,int fd)
+/******************************************************************************
+ * Function:              scan_fat_clusters      
+ *        
+ * Explain: Read the first FAT in large chunks and mark the sectors of every
+ *          allocated cluster as used, free and bad clusters as unused
+ *        
+ * Input:   @fd           device opened by get_fat_fs_sector
+ *          @fat_sb       boot sector
+ *          @fs           FAT_12, FAT_16 or FAT_32, from get_fat_type
+ *          @bitmap       image bitmap
+ *          @block_size   image block size, from get_fat_block_size
+ *        
+ * Output:  success      :TRUE
+ *          fail         :FALSE
+ ******************************************************************************/
+static gboolean scan_fat_clusters(int           fd,
+                                  FatBootSector *fat_sb,
+                                  int            fs,
+                                  ul            *bitmap,
+                                  uint           block_size)
 {
-    ull i = 0;
-    int fat_stat = 0;
-    ull block = 0, bfree = 0, bused = 0, DamagedClusters = 0;
-    ull cluster_count = 0, total_sector = 0;
-    ull real_back_block= 0;
-    int FatReservedBytes = 0;
-    unsigned long *fat_bitmap;
-
-    total_sector = get_total_sector(fat_sb);
-    cluster_count = get_cluster_count(fat_sb);
-    fat_bitmap = pc_alloc_bitmap(total_sector);
-    pc_init_bitmap(fat_bitmap, 0xFF, total_sector);
-
-    /// A) B) C)
-    block = mark_reserved_sectors(fat_bitmap, block,fat_sb);
-
-    /// D) The clusters
-    FatReservedBytes = fat_sb->sector_size * fat_sb->reserved;
-
-    lseek(fd, FatReservedBytes, SEEK_SET);
-
-    /// The second fat is used to check FAT status
-    fat_stat = check_fat_status(fd);
-    if (fat_stat != 0)
+    const uint     entry_bits    = get_fat_entry_bits(fs);
+    const uint32_t bad_cluster   = get_fat_bad_cluster(fs);
+    const ull      chunk_entries = (ull)FAT_CHUNK_BYTES * 8 / entry_bits;
+    const ull      sec_per_block = block_size / fat_sb->sector_size;
+    const ull      total_sector  = get_total_sector(fat_sb);
+    const ull      total_block   = total_sector / sec_per_block;
+    ull            nentries, fat_entries, first;
+    ull            sector, run_start;
+    gboolean       run_used = TRUE;
+    uint8_t       *buffer  = NULL;
+    uint32_t      *entries = NULL;
+
+    /// A) B) C), the runs below are kept in sectors, the data area may
+    /// start inside a block
+    sector = mark_reserved_sectors(bitmap, sec_per_block, fat_sb);
+    run_start = sector;
+
+    /// D) The clusters, FAT[0] and FAT[1] are not clusters
+    nentries    = get_cluster_count(fat_sb) + 2;
+    fat_entries = get_sec_per_fat(fat_sb) * fat_sb->sector_size * 8 / entry_bits;
+    if (nentries > fat_entries)
+        nentries = fat_entries;
+    if (nentries < 2)
     {
-        return 0;
+        return FALSE;
+    }
+    buffer  = malloc(FAT_CHUNK_BYTES);
+    entries = malloc(chunk_entries * sizeof(uint32_t));
+    if (buffer == NULL || entries == NULL)
+    {
+        goto ERROR;
     }
-    for (i=0; i < cluster_count; i++)
+    if (lseek(fd, (off_t)fat_sb->sector_size * fat_sb->reserved, SEEK_SET) == (off_t)-1)
     {
-        if(FS == FAT_16)
+        goto ERROR;
+    }
+    for (first = 0; first < nentries; first += chunk_entries)
+    {
+        ull count = nentries - first < chunk_entries ? nentries - first : chunk_entries;
+        ull bytes = (count * entry_bits + 7) / 8;
+        ull i = 0;
+
+        if (write_read_io_all(&fd, (char*)buffer, bytes, READ) != (int)bytes)
         {
-            block = check_fat16_entry(fat_bitmap,
-                                      total_sector, 
-                                      fat_sb->cluster_size,
-                                      block, 
-                                      &bfree, 
-                                      &bused, 
-                                      &DamagedClusters,
-                                      fd);
-        } 
-        else if (FS == FAT_32)
-        { /// FAT32
-            block = check_fat32_entry(fat_bitmap,
-                                      total_sector, 
-                                      fat_sb->cluster_size,
-                                      block, 
-                                      &bfree, 
-                                      &bused, 
-                                      &DamagedClusters,
-                                      fd);
-        } 
-        else if (FS == FAT_12)
-        { /// FAT12
-            block = check_fat12_entry(fat_bitmap,
-                                      total_sector, 
-                                      fat_sb->cluster_size,
-                                      block, 
-                                      &bfree, 
-                                      &bused, 
-                                      &DamagedClusters,
-                                      fd);
-        } 
-    }
-
-    while(block < total_sector){
-        pc_set_bit(block, fat_bitmap, total_sector);
-        block++;
-    }
-    for (block = 0; block < total_sector; block++)
-    {
-        if (pc_test_bit(block, fat_bitmap, total_sector)) {
-            real_back_block++;
+            goto ERROR;
+        }
+        decode_fat_entries(fs, buffer, count, entries);
+        if (first == 0)
+        {
+            if (!check_fat_status(fs, entries[1]))
+            {
+                goto ERROR;
+            }
+            i = 2;
+        }
+        for (; i < count; i++)
+        {
+            gboolean used = entries[i] != 0 && entries[i] != bad_cluster;
+
+            if (used != run_used)
+            {
+                mark_cluster_run(bitmap, run_start, sector, run_used, sec_per_block, total_block);
+                run_start = sector;
+                run_used  = used;
+            }
+            sector += fat_sb->cluster_size;
         }
     }
-    free(fat_bitmap);
+    mark_cluster_run(bitmap, run_start, sector, run_used, sec_per_block, total_block);
+
+    /// E) the sectors after the last cluster are copied as they are, those
+    /// past the last whole block by the image tail
+    mark_cluster_run(bitmap, sector, total_sector, TRUE, sec_per_block, total_block);
 
-    return real_back_block;
+    free(entries);
+    free(buffer);
+    return TRUE;
+ERROR:
+    free(entries);
+    free(buffer);
+    return FALSE;
 }
 
 // open device
@@ -364,7 +386,8 @@ static int get_fat_fs_sector (const char* device,FatBootSector *fat_sb)
     return fd;
 }
 
-static const char *get_fat_fs_type(FatBootSector *fat_sb)
+/// FAT_12, FAT_16 or FAT_32, 0 when the boot sector is not FAT
+static int get_fat_type(FatBootSector *fat_sb)
 {
     off_t total_sectors;
     off_t logical_sector_size;
@@ -385,45 +408,49 @@ static const char *get_fat_fs_type(FatBootSector *fat_sb)
         data_size = (off_t) total_sectors * logical_sector_size - data_start;
         if (data_size <= 0)
         {
-            return NULL;
+            return 0;
         }   
         clusters = data_size / (fat_sb->cluster_size * logical_sector_size);
         if (clusters <= 0)
         {
-            return NULL;
+            return 0;
         }    
         if (clusters >= FAT12_THRESHOLD)
         {
-            FS = FAT_16;
-            return "FAT16";
-
+            return FAT_16;
         }
        else
         {
-            FS = FAT_12;
-            return "FAT12";
+            return FAT_12;
         }
     }
     else if ((fat_sb->u.fat32.fat_name[4] == '2')||(!fat_sb->fat_length && fat_sb->u.fat32.fat_length))
     {
-        FS = FAT_32;
-        return  "FAT32";
+        return FAT_32;
     }
     
-    return NULL;
+    return 0;
 }    
+static const char *get_fat_fs_type(FatBootSector *fat_sb)
+{
+    switch (get_fat_type(fat_sb))
+    {
+        case FAT_12:
+            return "FAT12";
+        case FAT_16:
+            return "FAT16";
+        case FAT_32:
+            return "FAT32";
+        default:
+            return NULL;
+    }
+}
 // reference dumpe2fs
-static gboolean read_bitmap_info (const char      *device, 
-                                  file_system_info fs_info, 
-                                  ul              *bitmap) 
+static gboolean read_bitmap_info (const char       *device, 
+                                  file_system_info *fs_info, 
+                                  ul               *bitmap) 
 {
-    ull i = 0;
-    int fat_stat = 0;
     FatBootSector fat_sb;
-    ull block = 0, bfree = 0, bused = 0, DamagedClusters = 0;
-    ull cluster_count = 0;
-    ull total_sector = 0;
-    ull FatReservedBytes = 0;
     int fd;
 
     fd = get_fat_fs_sector (device,&fat_sb);
@@ -432,63 +459,16 @@ static gboolean read_bitmap_info (const char      *device,
         return FALSE;
     }     
 
-    total_sector = get_total_sector(&fat_sb);
-    cluster_count = get_cluster_count(&fat_sb);
-
-    pc_init_bitmap(bitmap, 0xFF, total_sector);
-
-    /// A) B) C)
-    block = mark_reserved_sectors(bitmap, block,&fat_sb);
-
-    /// D) The clusters
-    FatReservedBytes = fat_sb.sector_size * fat_sb.reserved;
-
-    lseek(fd, FatReservedBytes, SEEK_SET);
-
-    /// The second used to check FAT status
-    fat_stat = check_fat_status(fd);
-    if (fat_stat != 0)
+    pc_init_bitmap(bitmap, 0xFF, fs_info->totalblock);
+    if (!scan_fat_clusters(fd, &fat_sb, get_fat_type(&fat_sb), 
+                           bitmap, fs_info->block_size))
     {
-        close (fd);
+        close(fd);
         return FALSE;
     }    
-    for (i=0; i < cluster_count; i++)
-    {
-        if(FS == FAT_16)
-        {
-            block = check_fat16_entry(bitmap, 
-                                      total_sector,
-                                      fat_sb.cluster_size,
-                                      block, 
-                                      &bfree, 
-                                      &bused, 
-                                      &DamagedClusters,
-                                      fd);
-        } 
-        else if (FS == FAT_32)
-        { /// FAT32
-            block = check_fat32_entry(bitmap, 
-                                      total_sector,
-                                      fat_sb.cluster_size,
-                                      block, 
-                                      &bfree, 
-                                      &bused, 
-                                      &DamagedClusters,
-                                      fd);
-        } 
-        else if (FS == FAT_12)
-        { /// FAT12
-            block = check_fat12_entry(bitmap,
-                                      total_sector,
-                                      fat_sb.cluster_size, 
-                                      block, 
-                                      &bfree, 
-                                      &bused, 
-                                      &DamagedClusters,
-                                      fd);
-        } 
-    }
     close(fd);
+    /// the boot sector has no used count, so take it from the single scan
+    fs_info->usedblocks = pc_count_bits(bitmap, fs_info->totalblock);
 
     return TRUE;
 }
@@ -496,7 +476,6 @@ static gboolean read_super_blocks(const char* device, file_system_info* fs_info)
 {
     FatBootSector fat_sb;
     ull total_sector = 0;
-    ull bused = 0;
     int fd;
 
     const char *fs_type;
@@ -507,14 +486,18 @@ static gboolean read_super_blocks(const char* device, file_system_info* fs_info)
         return FALSE;
     }     
     fs_type = get_fat_fs_type (&fat_sb);
+    if (fs_type == NULL)
+    {
+        close (fd);
+        return FALSE;
+    }    
     strncpy(fs_info->fs, fs_type, FS_MAGIC_SIZE);
     total_sector = get_total_sector(&fat_sb);
-    bused = get_used_block(&fat_sb,fd);//so I need calculate by myself.
     
-    fs_info->block_size  = fat_sb.sector_size;
-    fs_info->totalblock  = total_sector;
-    fs_info->usedblocks  = bused;
-    fs_info->device_size = total_sector * fs_info->block_size;
+    fs_info->block_size  = get_fat_block_size(&fat_sb);
+    fs_info->device_size = total_sector * fat_sb.sector_size;
+    fs_info->totalblock  = fs_info->device_size / fs_info->block_size;
+    fs_info->usedblocks  = 0;   /// counted by read_bitmap_info
     
     close (fd);
     return TRUE;
@@ -528,6 +511,7 @@ static gboolean check_system_space (file_system_info *fs_info,
 
     needed_space += sizeof(image_head) + sizeof(file_system_info) + sizeof(image_options);
     needed_space += BITS_TO_BYTES(fs_info->totalblock);
+    needed_space += sizeof(image_tail) + fs_info->device_size % fs_info->block_size;
     needed_space += convert_blocks_to_bytes(0, fs_info->usedblocks, 
             fs_info->block_size,
             img_opt->blocks_per_checksum,
@@ -557,32 +541,22 @@ static gboolean check_system_space (file_system_info *fs_info,
  ******************************************************************************/
 static ull get_read_blocks_size (file_system_info *fs_info,ull *block_id,ul *bitmap)
 {
-    ull blocks_skip,blocks_read;
+    ull read_end;
     const ull  blocks_total = fs_info->totalblock;
     const uint block_size = fs_info->block_size;
     const uint buffer_capacity = DEFAULT_BUFFER_SIZE > block_size ? DEFAULT_BUFFER_SIZE / block_size : 1;
 
     /// skip unused blocks
-    for (blocks_skip = 0;
-        *block_id + blocks_skip < blocks_total &&
-        !pc_test_bit(*block_id + blocks_skip, bitmap, blocks_total);
-         blocks_skip++);
-    if (*block_id + blocks_skip == blocks_total)
+    *block_id = pc_find_next_set(bitmap, blocks_total, *block_id);
+    if (*block_id >= blocks_total)
     {
         return 0;
     }
+    /// read blocks size < buffer_capacity && Current block has data
+    read_end = *block_id + buffer_capacity < blocks_total ?
+               *block_id + buffer_capacity : blocks_total;
 
-    if (blocks_skip)
-    {    
-        *block_id += blocks_skip;
-    }
-    /// read blocks size < 256 && Current block has data
-    for (blocks_read = 0;
-        *block_id + blocks_read < blocks_total && blocks_read < buffer_capacity &&
-         pc_test_bit(*block_id + blocks_read, bitmap,blocks_total);
-       ++blocks_read);
-
-    return blocks_read;
+    return pc_find_next_zero(bitmap, read_end, *block_id) - *block_id;
 
 }    
 static gboolean read_write_data_ptf (SysbakGdbus      *object,
@@ -599,6 +573,7 @@ static gboolean read_write_data_ptf (SysbakGdbus      *object,
     uint  blocks_in_cs = 0, blocks_per_cs, write_size;
     char *read_buffer, *write_buffer;
     ull   block_id = 0;	
+    ull   copied_count = 0;
     int   r_size, w_size;	
     progress_bar  prog;
     progress_data pdata;
@@ -627,6 +602,10 @@ static gboolean read_write_data_ptf (SysbakGdbus      *object,
         ull i,blocks_read;
         int cs_added = 0, write_offset = 0;
         off_t offset;
+        if (!job_continue (object))
+        {
+            goto ERROR;
+        }
         blocks_read = get_read_blocks_size (fs_info,&block_id,bitmap);
         if (blocks_read == 0)
             break;
@@ -668,10 +647,10 @@ static gboolean read_write_data_ptf (SysbakGdbus      *object,
         {
             pdata.percent=100.0;
         }
-        sysbak_gdbus_emit_sysbak_progress (object,
-                                           pdata.percent,
-                                           pdata.speed,
-                                           pdata.elapsed);
+        emit_sysbak_progress (object,
+                              pdata.percent,
+                              pdata.speed,
+                              pdata.elapsed);
         if (r_size + cs_added * img_opt->checksum_size != w_size)
         {
             goto ERROR;
@@ -709,6 +688,8 @@ gboolean gdbus_sysbak_fatfs_ptf (SysbakGdbus           *object,
     file_system_info fs_info;   /// description of the file system
     image_options    img_opt;
     unsigned long   *bitmap = NULL;
+    image_tail       tail;
+    char            *tail_data = NULL;
     uint             buffer_capacity;
     int              e_code;
     gint             dfr = 0,dfw = 0;
@@ -756,7 +737,7 @@ gboolean gdbus_sysbak_fatfs_ptf (SysbakGdbus           *object,
         e_code = 4;
         goto ERROR;
     }
-    if (!read_bitmap_info(source, fs_info, bitmap))
+    if (!read_bitmap_info(source, &fs_info, bitmap))
     {
         e_code = 5;
         goto ERROR;
@@ -767,14 +748,29 @@ gboolean gdbus_sysbak_fatfs_ptf (SysbakGdbus           *object,
         e_code = 6;
         goto ERROR;
     }    
+    if (!read_device_tail(&dfr, fs_info, &tail, &tail_data))
+    {
+        e_code = 3;
+        goto ERROR;
+    }
+    if (tail_data != NULL)
+    {
+        set_image_fs_flags(&img_opt, IMAGE_FS_TAIL);
+    }
     if (!write_image_desc(&dfw, fs_info,img_opt))
     {
         e_code = 7;
         goto ERROR;
     }    
     write_image_bitmap(&dfw, fs_info, bitmap);
-    copied_count = 0;
-    sysbak_gdbus_complete_sysbak_fatfs_ptf (object,invocation); 
+    if (tail_data != NULL && !write_image_tail(&dfw, &tail, tail_data))
+    {
+        e_code = 7;
+        goto ERROR;
+    }
+    if (invocation != NULL)
+        sysbak_gdbus_complete_sysbak_fatfs_ptf (object,invocation);
+    invocation = NULL;
     if (!read_write_data_ptf (object,&fs_info,&img_opt,bitmap,&dfr,&dfw))
     {
         e_code = 8;
@@ -782,20 +778,23 @@ gboolean gdbus_sysbak_fatfs_ptf (SysbakGdbus           *object,
     } 
 
     fsync(dfw);
-	sysbak_gdbus_emit_sysbak_finished (object,
-                                       fs_info.totalblock,
-                                       fs_info.usedblocks,
-                                       fs_info.block_size);
-    free(bitmap);
+	emit_sysbak_finished (object,
+                          fs_info.totalblock,
+                          fs_info.usedblocks,
+                          fs_info.block_size);
+    g_free(tail_data);
+    pc_free_bitmap(bitmap);
     close (dfw);
     close (dfr);
     return TRUE;
 ERROR:
-	sysbak_gdbus_complete_sysbak_fatfs_ptf (object,invocation); 
-	sysbak_gdbus_emit_sysbak_error (object,
-                                    sysbak_error_message[e_code],
-                                    e_code);
-    free(bitmap);
+	if (invocation != NULL)
+	    sysbak_gdbus_complete_sysbak_fatfs_ptf (object,invocation);
+	emit_sysbak_error (object,
+                       sysbak_error_message[e_code],
+                       e_code);
+    g_free(tail_data);
+    pc_free_bitmap(bitmap);
     if (dfr > 0)
     {    
         close (dfr);
@@ -838,6 +837,10 @@ static gboolean read_write_data_ptp (SysbakGdbus      *object,
         ull blocks_read;
         off_t offset;
 
+        if (!job_continue (object))
+        {
+            goto ERROR;
+        }
         blocks_read = get_read_blocks_size (fs_info,&block_id,bitmap);
         if (blocks_read == 0)
             break;
@@ -866,10 +869,10 @@ static gboolean read_write_data_ptp (SysbakGdbus      *object,
         {
             pdata.percent=100.0;
         }
-		sysbak_gdbus_emit_sysbak_progress (object,
-                                           pdata.percent,
-                                           pdata.speed,
-                                           pdata.elapsed);
+		emit_sysbak_progress (object,
+                              pdata.percent,
+                              pdata.speed,
+                              pdata.elapsed);
     } while (1);
 
     free(buffer);
@@ -890,6 +893,8 @@ gboolean gdbus_sysbak_fatfs_ptp (SysbakGdbus           *object,
     file_system_info fs_info;   /// description of the file system
     image_options    img_opt;
     ul              *bitmap = NULL;
+    image_tail       tail;
+    char            *tail_data = NULL;
     uint             buffer_capacity;
     ull free_space = 0;
     gint             e_code;
@@ -934,7 +939,7 @@ gboolean gdbus_sysbak_fatfs_ptp (SysbakGdbus           *object,
         goto ERROR;
     }
 
-    if (!read_bitmap_info(source, fs_info, bitmap))
+    if (!read_bitmap_info(source, &fs_info, bitmap))
     {
         e_code = 5;
         goto ERROR;
@@ -945,8 +950,9 @@ gboolean gdbus_sysbak_fatfs_ptp (SysbakGdbus           *object,
         e_code = 6;
         goto ERROR;
     }   
-    copied_count = 0;
-    sysbak_gdbus_complete_sysbak_fatfs_ptp (object,invocation); 
+    if (invocation != NULL)
+        sysbak_gdbus_complete_sysbak_fatfs_ptp (object,invocation);
+    invocation = NULL;
     if (!read_write_data_ptp (object,
                              &fs_info,
                               bitmap,
@@ -956,19 +962,28 @@ gboolean gdbus_sysbak_fatfs_ptp (SysbakGdbus           *object,
         e_code = 8;
         goto ERROR;
     }
+    if (!read_device_tail(&dfr, fs_info, &tail, &tail_data) ||
+        !write_device_tail(&dfw, &tail, tail_data))
+    {
+        e_code = 8;
+        goto ERROR;
+    }
 
     fsync(dfw);
-    free(bitmap);
+    g_free(tail_data);
+    pc_free_bitmap(bitmap);
     close (dfr);
     close (dfw);
-    sysbak_gdbus_emit_sysbak_finished (object,
-                                       fs_info.totalblock,
-                                       fs_info.usedblocks,
-                                       fs_info.block_size);
+    emit_sysbak_finished (object,
+                          fs_info.totalblock,
+                          fs_info.usedblocks,
+                          fs_info.block_size);
     return TRUE;
 ERROR:
-    sysbak_gdbus_complete_sysbak_fatfs_ptp (object,invocation); 
-    free(bitmap);
+    if (invocation != NULL)
+        sysbak_gdbus_complete_sysbak_fatfs_ptp (object,invocation);
+    g_free(tail_data);
+    pc_free_bitmap(bitmap);
     if (dfr > 0)
     {    
         close (dfr);
@@ -977,8 +992,8 @@ ERROR:
     {    
         close (dfw);
     }    
-    sysbak_gdbus_emit_sysbak_error (object,
-                                    sysbak_error_message[e_code],
-                                    e_code);
+    emit_sysbak_error (object,
+                       sysbak_error_message[e_code],
+                       e_code);
     return FALSE;
 }  
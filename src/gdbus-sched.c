@@ -0,0 +1,344 @@
+/*  sysbak-admin
+ *   Copyright (C) 2019  zhuyaliang https://github.com/zhuyaliang/
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include "gdbus-sched.h"
+
+#define SYS_DEV_BLOCK    "/sys/dev/block"
+#define SYS_CLASS_BLOCK  "/sys/class/block"
+#define SCHED_MAX_DEPTH  8      /// dm on md on partitions, and so on
+
+/// a physical disk, or a resource only one job may hold at a time
+typedef struct
+{
+    gint running;
+    gint limit;
+} sched_device;
+
+/// jobs that take turns on a slot count of their own, over the disk limits
+struct sched_group
+{
+    sched_device device;
+    guint        ref_count;     /// the owner and each queued or running job
+};
+
+typedef struct
+{
+    gpointer     job;
+    GPtrArray   *devices;       /// sched_device the job reads or writes
+    sched_group *group;
+} sched_entry;
+
+static GMutex       sched_lock;
+static GThreadPool *sched_pool = NULL;
+static GFunc        sched_run_job = NULL;
+static GHashTable  *sched_devices = NULL;   /// name -> sched_device
+static GQueue       sched_queue = G_QUEUE_INIT;
+static guint        sched_max_jobs;
+static guint        sched_running;
+
+static gint get_disk_limit (const gchar *disk)
+{
+    gchar *file;
+    gchar *text = NULL;
+    gint   limit = SCHED_SSD_JOBS;
+
+    file = g_build_filename (SYS_CLASS_BLOCK, disk, "queue", "rotational", NULL);
+    if (g_file_get_contents (file, &text, NULL, NULL) && text[0] == '1')
+    {
+        limit = SCHED_HDD_JOBS;
+    }
+    g_free (text);
+    g_free (file);
+
+    return limit;
+}
+static sched_device *get_sched_device (const gchar *name, gint limit)
+{
+    sched_device *device;
+
+    device = g_hash_table_lookup (sched_devices, name);
+    if (device == NULL)
+    {
+        device = g_new0 (sched_device, 1);
+        device->limit = limit;
+        g_hash_table_insert (sched_devices, g_strdup (name), device);
+    }
+    return device;
+}
+static void add_sched_device (GPtrArray *devices, sched_device *device)
+{
+    guint i;
+
+    for (i = 0; i < devices->len; i++)
+    {
+        if (g_ptr_array_index (devices, i) == device)
+            return;
+    }
+    g_ptr_array_add (devices, device);
+}
+/******************************************************************************
+ * Function:              add_physical_disks
+ *
+ * Explain: Follow a block device in sysfs down to the disks it lives on.
+ *          A partition belongs to the disk whose directory holds it, and
+ *          dm (LVM, crypt) and md devices list the devices below them in
+ *          slaves.  A device with neither is a disk of its own.
+ *
+ * Input:   @sysdir       sysfs directory of the block device
+ *          @devices      receives a sched_device per disk
+ *          @depth        levels followed so far
+ ******************************************************************************/
+static void add_physical_disks (const gchar *sysdir, GPtrArray *devices, int depth)
+{
+    gchar       *real;
+    gchar       *file;
+    gchar       *child;
+    gchar       *disk;
+    GDir        *dir;
+    const gchar *name;
+    gboolean     found = FALSE;
+
+    real = realpath (sysdir, NULL);
+    if (real == NULL || depth > SCHED_MAX_DEPTH)
+    {
+        free (real);
+        return;
+    }
+    file = g_build_filename (real, "partition", NULL);
+    if (g_file_test (file, G_FILE_TEST_EXISTS))
+    {
+        child = g_path_get_dirname (real);
+        add_physical_disks (child, devices, depth + 1);
+        g_free (child);
+        goto out;
+    }
+    g_free (file);
+    file = g_build_filename (real, "slaves", NULL);
+    dir = g_dir_open (file, 0, NULL);
+    if (dir != NULL)
+    {
+        while ((name = g_dir_read_name (dir)) != NULL)
+        {
+            child = g_build_filename (SYS_CLASS_BLOCK, name, NULL);
+            add_physical_disks (child, devices, depth + 1);
+            g_free (child);
+            found = TRUE;
+        }
+        g_dir_close (dir);
+    }
+    if (!found)
+    {
+        disk = g_path_get_basename (real);
+        add_sched_device (devices, get_sched_device (disk, get_disk_limit (disk)));
+        g_free (disk);
+    }
+out:
+    g_free (file);
+    free (real);
+}
+/// the disks below a device node, or below the file system holding a file
+static void add_path_disks (const gchar *path, GPtrArray *devices)
+{
+    struct stat st;
+    gchar      *dir;
+    gchar      *sysdir;
+    dev_t       dev;
+    guint       len = devices->len;
+
+    if (path == NULL || path[0] == '\0')
+        return;
+    if (stat (path, &st) == 0)
+    {
+        dev = S_ISBLK (st.st_mode) ? st.st_rdev : st.st_dev;
+    }
+    else
+    {
+        /// the image file is created by the job itself
+        dir = g_path_get_dirname (path);
+        if (stat (dir, &st) != 0)
+        {
+            g_free (dir);
+            return;
+        }
+        g_free (dir);
+        dev = st.st_dev;
+    }
+    sysdir = g_strdup_printf (SYS_DEV_BLOCK "/%u:%u", major (dev), minor (dev));
+    add_physical_disks (sysdir, devices, 0);
+    g_free (sysdir);
+    if (devices->len == len)
+    {
+        /// no sysfs entry (nfs, tmpfs), the device number stands for the disk
+        sysdir = g_strdup_printf ("%u:%u", major (dev), minor (dev));
+        add_sched_device (devices, get_sched_device (sysdir, SCHED_SSD_JOBS));
+        g_free (sysdir);
+    }
+}
+static gboolean entry_can_start (sched_entry *entry, GHashTable *waiting)
+{
+    sched_device *device;
+    guint         i;
+
+    for (i = 0; i < entry->devices->len; i++)
+    {
+        device = g_ptr_array_index (entry->devices, i);
+        if (device->running >= device->limit || g_hash_table_contains (waiting, device))
+            return FALSE;
+    }
+    return TRUE;
+}
+/******************************************************************************
+ * Function:              sched_dispatch
+ *
+ * Explain: Start every queued job whose disks all have a free slot, in
+ *          queue order.  A job that has to wait keeps its disks for
+ *          itself, so the jobs behind it only overtake it on the other
+ *          disks: every disk stays busy and none of them starves a job.
+ *          Called with sched_lock held.
+ ******************************************************************************/
+static void sched_dispatch (void)
+{
+    GHashTable   *waiting;
+    GList        *link, *next;
+    sched_entry  *entry;
+    sched_device *device;
+    guint         i;
+
+    waiting = g_hash_table_new (NULL, NULL);
+    for (link = sched_queue.head; link != NULL && sched_running < sched_max_jobs; link = next)
+    {
+        next = link->next;
+        entry = link->data;
+        if (!entry_can_start (entry, waiting))
+        {
+            for (i = 0; i < entry->devices->len; i++)
+                g_hash_table_add (waiting, g_ptr_array_index (entry->devices, i));
+            continue;
+        }
+        for (i = 0; i < entry->devices->len; i++)
+        {
+            device = g_ptr_array_index (entry->devices, i);
+            device->running++;
+        }
+        sched_running++;
+        g_queue_delete_link (&sched_queue, link);
+        g_thread_pool_push (sched_pool, entry, NULL);
+    }
+    g_hash_table_destroy (waiting);
+}
+static void sched_run (gpointer data, gpointer user_data)
+{
+    sched_entry  *entry = data;
+    sched_device *device;
+    guint         i;
+
+    sched_run_job (entry->job, user_data);
+
+    g_mutex_lock (&sched_lock);
+    for (i = 0; i < entry->devices->len; i++)
+    {
+        device = g_ptr_array_index (entry->devices, i);
+        device->running--;
+    }
+    sched_running--;
+    sched_dispatch ();
+    if (entry->group != NULL && --entry->group->ref_count == 0)
+    {
+        g_free (entry->group);
+    }
+    g_mutex_unlock (&sched_lock);
+
+    g_ptr_array_free (entry->devices, TRUE);
+    g_free (entry);
+}
+void sched_init (GFunc run, guint max_jobs)
+{
+    sched_run_job = run;
+    sched_max_jobs = max_jobs;
+    sched_devices = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    sched_pool = g_thread_pool_new (sched_run, NULL, max_jobs, FALSE, NULL);
+}
+/******************************************************************************
+ * Function:              sched_submit
+ *
+ * Explain: Queue a job behind the disks of its source and target.  It
+ *          runs on the worker pool once each of them, and the exclusive
+ *          resource if there is one, has a free slot.
+ *
+ * Input:   @job          handed to the run function of sched_init
+ *          @source       device or image file the job reads
+ *          @target       device or image file the job writes
+ *          @exclusive    resource held by one job at a time, or NULL
+ *          @group        group the job counts against, or NULL
+ ******************************************************************************/
+void sched_submit (gpointer     job,
+                   const gchar *source,
+                   const gchar *target,
+                   const gchar *exclusive,
+                   sched_group *group)
+{
+    sched_entry *entry = g_new0 (sched_entry, 1);
+
+    entry->job = job;
+    entry->devices = g_ptr_array_new ();
+
+    g_mutex_lock (&sched_lock);
+    add_path_disks (source, entry->devices);
+    add_path_disks (target, entry->devices);
+    if (exclusive != NULL)
+    {
+        add_sched_device (entry->devices, get_sched_device (exclusive, 1));
+    }
+    if (group != NULL)
+    {
+        group->ref_count++;
+        entry->group = group;
+        add_sched_device (entry->devices, &group->device);
+    }
+    g_queue_push_tail (&sched_queue, entry);
+    sched_dispatch ();
+    g_mutex_unlock (&sched_lock);
+}
+sched_group *sched_group_new (guint limit)
+{
+    sched_group *group = g_new0 (sched_group, 1);
+
+    group->device.limit = MAX (limit, 1);
+    group->ref_count = 1;
+
+    return group;
+}
+/// the group goes away once the last of its jobs has run
+void sched_group_unref (sched_group *group)
+{
+    g_mutex_lock (&sched_lock);
+    if (--group->ref_count == 0)
+    {
+        g_free (group);
+    }
+    g_mutex_unlock (&sched_lock);
+}
+void sched_free (void)
+{
+    g_thread_pool_free (sched_pool, TRUE, FALSE);
+    g_hash_table_destroy (sched_devices);
+    sched_pool = NULL;
+    sched_devices = NULL;
+}
@@ -0,0 +1,44 @@
+/*  sysbak-admin
+*   Copyright (C) 2019  zhuyaliang https://github.com/zhuyaliang/
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __GDBUS_SCHED_H__
+#define __GDBUS_SCHED_H__
+
+#include <glib.h>
+
+#define     SCHED_HDD_JOBS           1    /// jobs sharing a rotational disk
+#define     SCHED_SSD_JOBS           2    /// jobs sharing a solid state disk
+
+/// jobs capped at a number of their own, on top of the disk limits
+typedef struct sched_group sched_group;
+
+void        sched_init                     (GFunc             run,
+                                            guint             max_jobs);
+
+void        sched_submit                   (gpointer          job,
+                                            const gchar      *source,
+                                            const gchar      *target,
+                                            const gchar      *exclusive,
+                                            sched_group      *group);
+
+sched_group *sched_group_new               (guint             limit);
+
+void        sched_group_unref              (sched_group      *group);
+
+void        sched_free                     (void);
+
+#endif
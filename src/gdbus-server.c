@@ -19,17 +19,742 @@
 #include <glib.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <time.h>
+#include <sys/stat.h>
 #include "gdbus-extfs.h"
 #include "gdbus-disk.h"
 #include "gdbus-fatfs.h"
 #include "gdbus-btrfs.h"
 #include "gdbus-xfsfs.h"
+#include "gdbus-sched.h"
 
 #define ORG_NAME  "org.sysbak.admin.gdbus"
 #define DBS_NAME  "/org/sysbak/admin/gdbus"
+#define JOB_PATH  "/org/sysbak/admin/jobs/%u"
+#define SYSBAK_MAX_JOBS     8
+/// libxfs keeps its buffer cache and devices per process, one xfs job at a time
+#define XFSFS_EXCLUSIVE     "libxfs"
+/// libbtrfs keeps the scanned devices of every fsid in one list, and two
+/// opens of one fsid share their fds, one btrfs job at a time
+#define BTRFS_EXCLUSIVE     "libbtrfs"
+/// unit of the totals in the SysbakFinished of a disk backup
+#define DISK_BLOCK_SIZE     512
+#define DISK_CAPTURES       4
 
 static GMainLoop* loop = NULL;
- 
+static guint job_serial = 0;
+static GHashTable *live_jobs = NULL;   /// job objects not removed yet, main loop only
+
+typedef gboolean (*SysbakJobFunc) (SysbakGdbus           *object,
+                                   GDBusMethodInvocation *invocation,
+                                   const gchar           *source,
+                                   const gchar           *target,
+                                   gboolean               overwrite,
+                                   gboolean               lean);
+typedef struct
+{
+    SysbakJobFunc          func;
+    SysbakGdbus           *object;     /// the job object, /org/sysbak/admin/jobs/N
+    GDBusMethodInvocation *invocation;
+    gchar                 *source;
+    gchar                 *target;
+    gboolean               overwrite;
+    gboolean               lean;
+    GSourceFunc            done;       /// run on the main loop after the job, or NULL
+    gpointer               done_data;
+} SysbakJob;
+
+/// queued behind the last signals of the job, so they still reach the bus
+static gboolean remove_job_object (gpointer data)
+{
+    GDBusInterfaceSkeleton *skeleton = data;
+
+    g_hash_table_remove (live_jobs, skeleton);
+    if (g_dbus_interface_skeleton_get_connection (skeleton) != NULL)
+    {
+        g_dbus_interface_skeleton_unexport (skeleton);
+    }
+    return G_SOURCE_REMOVE;
+}
+static void run_job (gpointer data, gpointer user_data)
+{
+    SysbakJob *job = data;
+
+    /// cancelled while it was queued
+    if (job_cancelled (job->object))
+    {
+        if (job->invocation != NULL)
+            g_dbus_method_invocation_return_value (job->invocation, g_variant_new ("()"));
+        emit_sysbak_error (job->object, SYSBAK_CANCELLED_MESSAGE, SYSBAK_CANCELLED);
+    }
+    else
+    {
+        job->func (job->object,
+                   job->invocation,
+                   job->source,
+                   job->target,
+                   job->overwrite,
+                   job->lean);
+    }
+    if (job->done != NULL)
+    {
+        g_main_context_invoke (NULL, job->done, job->done_data);
+    }
+    g_main_context_invoke_full (NULL,
+                                G_PRIORITY_DEFAULT,
+                                remove_job_object,
+                                job->object,
+                                g_object_unref);
+    g_free (job->source);
+    g_free (job->target);
+    g_free (job);
+}
+/******************************************************************************
+ * Function:              new_job_object      
+ *        
+ * Explain: Export a job object at /org/sysbak/admin/jobs/N for one copy.
+ *          It carries the same interface as the daemon object, so a
+ *          client follows the Progress, Finished and Error signals of a
+ *          single job through a proxy on its path, and Cancel, Pause and
+ *          Resume on that path act on that job alone.  Every signal is
+ *          repeated on the daemon object for clients of one job at a time.
+ *        
+ * Input:   @object       the daemon object
+ *          @source       announced with the path in JobAdded
+ *          @target
+ *        
+ * Output:  the job object, not exported when the export failed
+ ******************************************************************************/
+static SysbakGdbus *new_job_object (SysbakGdbus *object,
+                                    const gchar *source,
+                                    const gchar *target)
+{
+    GDBusConnection *connection;
+    SysbakGdbus     *job_object;
+    GError          *error = NULL;
+    gchar           *path;
+
+    /// the handlers are shared, a copy asked of a job object belongs to the daemon
+    if (g_object_get_data (G_OBJECT (object), SYSBAK_JOB_PARENT) != NULL)
+    {
+        object = g_object_get_data (G_OBJECT (object), SYSBAK_JOB_PARENT);
+    }
+    job_object = sysbak_gdbus_skeleton_new ();
+    new_job_control (job_object);
+    g_hash_table_add (live_jobs, job_object);
+    g_object_set_data_full (G_OBJECT (job_object),
+                            SYSBAK_JOB_PARENT,
+                            g_object_ref (object),
+                            g_object_unref);
+    connection = g_dbus_interface_skeleton_get_connection (G_DBUS_INTERFACE_SKELETON (object));
+    path = g_strdup_printf (JOB_PATH, ++job_serial);
+    if (!g_dbus_interface_skeleton_export (G_DBUS_INTERFACE_SKELETON (job_object),
+                                           connection,
+                                           path,
+                                           &error))
+    {
+        g_warning ("Failed to export job object %s: %s", path, error->message);
+        g_error_free (error);
+    }
+    else
+    {
+        sysbak_gdbus_emit_job_added (object, path, source, target);
+    }
+    g_free (path);
+
+    return job_object;
+}
+/******************************************************************************
+ * Function:              queue_job      
+ *        
+ * Explain: Hand a copy job to the scheduler and return to the main loop
+ *          at once.  The job completes the invocation itself, its signals
+ *          go back to the main loop through the emit_sysbak_* helpers.
+ *          It starts once the disks below source and target can take
+ *          another job; jobs that share exclusive run one at a time.
+ ******************************************************************************/
+static gboolean queue_job (SysbakJobFunc          func,
+                           const gchar           *exclusive,
+                           SysbakGdbus           *object,
+                           GDBusMethodInvocation *invocation,
+                           const gchar           *source,
+                           const gchar           *target,
+                           gboolean               overwrite,
+                           gboolean               lean)
+{
+    SysbakJob *job = g_new0 (SysbakJob, 1);
+
+    job->func = func;
+    job->object = new_job_object (object, source, target);
+    job->invocation = invocation;
+    job->source = g_strdup (source);
+    job->target = g_strdup (target);
+    job->overwrite = overwrite;
+    job->lean = lean;
+    sched_submit (job, source, target, exclusive, NULL);
+
+    return TRUE;
+}
+/// fat and restore take no lean flag
+static gboolean run_fatfs_ptf (SysbakGdbus           *object,
+                               GDBusMethodInvocation *invocation,
+                               const gchar           *source,
+                               const gchar           *target,
+                               gboolean               overwrite,
+                               gboolean               lean)
+{
+    return gdbus_sysbak_fatfs_ptf (object, invocation, source, target, overwrite);
+}
+static gboolean run_fatfs_ptp (SysbakGdbus           *object,
+                               GDBusMethodInvocation *invocation,
+                               const gchar           *source,
+                               const gchar           *target,
+                               gboolean               overwrite,
+                               gboolean               lean)
+{
+    return gdbus_sysbak_fatfs_ptp (object, invocation, source, target, overwrite);
+}
+static gboolean run_restore (SysbakGdbus           *object,
+                             GDBusMethodInvocation *invocation,
+                             const gchar           *source,
+                             const gchar           *target,
+                             gboolean               overwrite,
+                             gboolean               lean)
+{
+    return gdbus_sysbak_restore (object, invocation, source, target, overwrite);
+}
+static gboolean handle_extfs_ptf (SysbakGdbus           *object,
+                                  GDBusMethodInvocation *invocation,
+                                  const gchar           *source,
+                                  const gchar           *target,
+                                  gboolean               overwrite,
+                                  gboolean               lean)
+{
+    return queue_job (gdbus_sysbak_extfs_ptf, NULL,
+                      object, invocation, source, target, overwrite, lean);
+}
+static gboolean handle_extfs_ptp (SysbakGdbus           *object,
+                                  GDBusMethodInvocation *invocation,
+                                  const gchar           *source,
+                                  const gchar           *target,
+                                  gboolean               overwrite,
+                                  gboolean               lean)
+{
+    return queue_job (gdbus_sysbak_extfs_ptp, NULL,
+                      object, invocation, source, target, overwrite, lean);
+}
+static gboolean handle_fatfs_ptf (SysbakGdbus           *object,
+                                  GDBusMethodInvocation *invocation,
+                                  const gchar           *source,
+                                  const gchar           *target,
+                                  gboolean               overwrite)
+{
+    return queue_job (run_fatfs_ptf, NULL,
+                      object, invocation, source, target, overwrite, FALSE);
+}
+static gboolean handle_fatfs_ptp (SysbakGdbus           *object,
+                                  GDBusMethodInvocation *invocation,
+                                  const gchar           *source,
+                                  const gchar           *target,
+                                  gboolean               overwrite)
+{
+    return queue_job (run_fatfs_ptp, NULL,
+                      object, invocation, source, target, overwrite, FALSE);
+}
+static gboolean handle_btrfs_ptf (SysbakGdbus           *object,
+                                  GDBusMethodInvocation *invocation,
+                                  const gchar           *source,
+                                  const gchar           *target,
+                                  gboolean               overwrite,
+                                  gboolean               lean)
+{
+    return queue_job (gdbus_sysbak_btrfs_ptf, BTRFS_EXCLUSIVE,
+                      object, invocation, source, target, overwrite, lean);
+}
+static gboolean handle_btrfs_ptp (SysbakGdbus           *object,
+                                  GDBusMethodInvocation *invocation,
+                                  const gchar           *source,
+                                  const gchar           *target,
+                                  gboolean               overwrite,
+                                  gboolean               lean)
+{
+    return queue_job (gdbus_sysbak_btrfs_ptp, BTRFS_EXCLUSIVE,
+                      object, invocation, source, target, overwrite, lean);
+}
+static gboolean handle_xfsfs_ptf (SysbakGdbus           *object,
+                                  GDBusMethodInvocation *invocation,
+                                  const gchar           *source,
+                                  const gchar           *target,
+                                  gboolean               overwrite,
+                                  gboolean               lean)
+{
+    return queue_job (gdbus_sysbak_xfsfs_ptf, XFSFS_EXCLUSIVE,
+                      object, invocation, source, target, overwrite, lean);
+}
+static gboolean handle_xfsfs_ptp (SysbakGdbus           *object,
+                                  GDBusMethodInvocation *invocation,
+                                  const gchar           *source,
+                                  const gchar           *target,
+                                  gboolean               overwrite,
+                                  gboolean               lean)
+{
+    return queue_job (gdbus_sysbak_xfsfs_ptp, XFSFS_EXCLUSIVE,
+                      object, invocation, source, target, overwrite, lean);
+}
+static gboolean handle_restore (SysbakGdbus           *object,
+                                GDBusMethodInvocation *invocation,
+                                const gchar           *source,
+                                const gchar           *target,
+                                gboolean               overwrite)
+{
+    return queue_job (run_restore, NULL,
+                      object, invocation, source, target, overwrite, FALSE);
+}
+/// a file system BackupDisk images, and the copy that does it
+typedef struct
+{
+    const gchar   *fstype;
+    SysbakJobFunc  func;
+    const gchar   *exclusive;
+    gboolean       per_fsid;    /// one image holds every member device of the uuid
+} SysbakBackupType;
+
+static const SysbakBackupType backup_types[] =
+{
+    {"ext2",  gdbus_sysbak_extfs_ptf, NULL,            FALSE},
+    {"ext3",  gdbus_sysbak_extfs_ptf, NULL,            FALSE},
+    {"ext4",  gdbus_sysbak_extfs_ptf, NULL,            FALSE},
+    {"vfat",  run_fatfs_ptf,          NULL,            FALSE},
+    {"btrfs", gdbus_sysbak_btrfs_ptf, BTRFS_EXCLUSIVE, TRUE},
+    {"xfs",   gdbus_sysbak_xfsfs_ptf, XFSFS_EXCLUSIVE, FALSE},
+};
+
+typedef struct
+{
+    SysbakGdbus           *object;      /// the disk job object
+    GDBusMethodInvocation *invocation;
+    gchar                 *source;
+    gchar                 *target;      /// directory of the images and tables
+    gboolean               overwrite;
+    gboolean               lean;
+    sched_group           *group;       /// at most max_jobs partitions at a time
+    GPtrArray             *partitions;  /// disk_partition as lsblk lists them
+    GPtrArray             *parts;       /// SysbakPart being imaged
+    guint                  running;     /// parts not through yet
+    gboolean               failed;      /// a part reported an error
+    gchar                 *message;     /// why the disk was not backed up
+    time_t                 start;
+} SysbakDisk;
+
+/// a partition of a disk backup, owned by the main loop
+typedef struct
+{
+    SysbakDisk     *disk;
+    SysbakGdbus    *object;     /// not exported, its signals fold into the disk's
+    disk_partition *info;
+    gdouble         percent;
+    gdouble         speed;
+    guint64         totalbytes;
+    guint64         usedbytes;
+} SysbakPart;
+
+typedef gboolean (*SysbakCaptureFunc) (SysbakDisk *disk, gchar **message);
+
+typedef struct
+{
+    SysbakCaptureFunc  func;
+    SysbakDisk        *disk;
+    gchar             *message;
+} SysbakCapture;
+
+static gboolean capture_lvm_meta (SysbakDisk *disk, gchar **message)
+{
+    gchar    *prefix = g_build_filename (disk->target, "lvm", NULL);
+    gboolean  ret = save_lvm_meta (prefix, message);
+
+    g_free (prefix);
+    return ret;
+}
+static gboolean capture_disk_info (SysbakDisk *disk, gchar **message)
+{
+    gchar    *file = g_build_filename (disk->target, "disk-info.ini", NULL);
+
+    disk->partitions = save_disk_info (disk->source, file, message);
+    g_free (file);
+    return disk->partitions != NULL;
+}
+static gboolean capture_partition_table (SysbakDisk *disk, gchar **message)
+{
+    gchar    *file = g_build_filename (disk->target, "disk-table", NULL);
+    gboolean  ret = save_partition_table (disk->source, file, message);
+
+    g_free (file);
+    return ret;
+}
+static gboolean capture_disk_mbr (SysbakDisk *disk, gchar **message)
+{
+    gchar    *file = g_build_filename (disk->target, "disk-mbr", NULL);
+    gboolean  ret = save_disk_mbr (disk->source, file, message);
+
+    g_free (file);
+    return ret;
+}
+static gpointer capture_thread (gpointer data)
+{
+    SysbakCapture *capture = data;
+
+    return GINT_TO_POINTER (capture->func (capture->disk, &capture->message));
+}
+static void free_part (gpointer data)
+{
+    SysbakPart *part = data;
+
+    g_signal_handlers_disconnect_by_data (part->object, part);
+    g_object_unref (part->object);
+    g_free (part);
+}
+static void free_disk (SysbakDisk *disk)
+{
+    g_ptr_array_free (disk->parts, TRUE);
+    if (disk->partitions != NULL)
+    {
+        g_ptr_array_free (disk->partitions, TRUE);
+    }
+    sched_group_unref (disk->group);
+    g_free (disk->source);
+    g_free (disk->target);
+    g_free (disk->message);
+    g_free (disk);
+}
+/// every part is through, answer the call and take the disk job off the bus
+static void finish_disk (SysbakDisk *disk)
+{
+    SysbakPart *part;
+    guint64     totalbytes = 0;
+    guint64     usedbytes = 0;
+    guint       i;
+
+    sysbak_gdbus_complete_backup_disk (disk->object, disk->invocation);
+    if (disk->message != NULL)
+    {
+        emit_sysbak_error (disk->object, disk->message, 1);
+    }
+    else if (job_cancelled (disk->object))
+    {
+        emit_sysbak_error (disk->object, SYSBAK_CANCELLED_MESSAGE, SYSBAK_CANCELLED);
+    }
+    else if (!disk->failed)
+    {
+        for (i = 0; i < disk->parts->len; i++)
+        {
+            part = g_ptr_array_index (disk->parts, i);
+            totalbytes += part->totalbytes;
+            usedbytes += part->usedbytes;
+        }
+        emit_sysbak_finished (disk->object,
+                              totalbytes / DISK_BLOCK_SIZE,
+                              usedbytes / DISK_BLOCK_SIZE,
+                              DISK_BLOCK_SIZE);
+    }
+    remove_job_object (disk->object);
+    g_object_unref (disk->object);
+    free_disk (disk);
+}
+/// parts weigh as much as their size, the speeds of the running ones add up
+static void emit_disk_progress (SysbakDisk *disk)
+{
+    SysbakPart *part;
+    gdouble     done = 0;
+    gdouble     speed = 0;
+    guint64     size = 0;
+    guint       i;
+
+    for (i = 0; i < disk->parts->len; i++)
+    {
+        part = g_ptr_array_index (disk->parts, i);
+        done += part->percent * part->info->size;
+        speed += part->speed;
+        size += part->info->size;
+    }
+    if (size == 0)
+        return;
+    emit_sysbak_progress (disk->object, done / size, speed, time (NULL) - disk->start);
+}
+static void on_part_progress (SysbakGdbus *object,
+                              gdouble      percent,
+                              gdouble      speed,
+                              guint64      elapsed,
+                              gpointer     data)
+{
+    SysbakPart *part = data;
+
+    part->percent = percent;
+    part->speed = speed;
+    emit_disk_progress (part->disk);
+}
+static void on_part_finished (SysbakGdbus *object,
+                              guint64      totalblock,
+                              guint64      usedblocks,
+                              guint        block_size,
+                              gpointer     data)
+{
+    SysbakPart *part = data;
+
+    part->totalbytes = totalblock * block_size;
+    part->usedbytes = usedblocks * block_size;
+}
+/// named after its partition, a cancel is told once for the whole disk
+static void on_part_error (SysbakGdbus *object,
+                           const gchar *message,
+                           gint         ecode,
+                           gpointer     data)
+{
+    SysbakPart *part = data;
+    gchar      *text;
+
+    part->disk->failed = TRUE;
+    if (job_cancelled (part->disk->object))
+        return;
+    text = g_strdup_printf ("%s: %s", part->info->name, message);
+    emit_sysbak_error (part->disk->object, text, ecode);
+    g_free (text);
+}
+/// queued by run_job behind the last signals of the part
+static gboolean part_done (gpointer data)
+{
+    SysbakPart *part = data;
+    SysbakDisk *disk = part->disk;
+
+    part->percent = 100;
+    part->speed = 0;
+    if (--disk->running == 0)
+    {
+        finish_disk (disk);
+    }
+    return G_SOURCE_REMOVE;
+}
+static const SysbakBackupType *get_backup_type (const gchar *fstype)
+{
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS (backup_types); i++)
+    {
+        if (g_strcmp0 (fstype, backup_types[i].fstype) == 0)
+            return &backup_types[i];
+    }
+    return NULL;
+}
+static SysbakPart *new_disk_part (SysbakDisk *disk, disk_partition *info)
+{
+    SysbakPart *part = g_new0 (SysbakPart, 1);
+
+    part->disk = disk;
+    part->info = info;
+    part->object = sysbak_gdbus_skeleton_new ();
+    share_job_control (part->object, disk->object);
+    g_signal_connect (part->object, "sysbak-progress", G_CALLBACK (on_part_progress), part);
+    g_signal_connect (part->object, "sysbak-finished", G_CALLBACK (on_part_finished), part);
+    g_signal_connect (part->object, "sysbak-error", G_CALLBACK (on_part_error), part);
+    g_ptr_array_add (disk->parts, part);
+
+    return part;
+}
+/******************************************************************************
+ * Function:              start_disk_parts      
+ *        
+ * Explain: Queue a job for each partition and logical volume of the disk
+ *          that has a file system to image.  They count against the group
+ *          of the disk, so no more than max_jobs of them run at a time on
+ *          top of the disk limits, and follow its cancel and pause.  Free
+ *          space, lvm members and file systems without a backend are left
+ *          out, disk-info.ini still lists them.  A multi-device btrfs is
+ *          imaged once, from its first member on the disk.
+ ******************************************************************************/
+static gboolean start_disk_parts (gpointer data)
+{
+    SysbakDisk             *disk = data;
+    const SysbakBackupType *type;
+    disk_partition         *info;
+    SysbakPart             *part;
+    SysbakJob              *job;
+    GHashTable             *fsids;
+    guint                   i;
+
+    if (disk->message != NULL || job_cancelled (disk->object))
+    {
+        finish_disk (disk);
+        return G_SOURCE_REMOVE;
+    }
+    /// no image is written of a disk in use
+    for (i = 0; i < disk->partitions->len; i++)
+    {
+        info = g_ptr_array_index (disk->partitions, i);
+        if (get_backup_type (info->fstype) != NULL &&
+            info->mountpoint != NULL && info->mountpoint[0] != '\0')
+        {
+            disk->message = g_strdup_printf ("Please umount the %s to be backed up", info->path);
+            finish_disk (disk);
+            return G_SOURCE_REMOVE;
+        }
+    }
+    fsids = g_hash_table_new (g_str_hash, g_str_equal);
+    for (i = 0; i < disk->partitions->len; i++)
+    {
+        info = g_ptr_array_index (disk->partitions, i);
+        type = get_backup_type (info->fstype);
+        if (type == NULL)
+        {
+            continue;
+        }
+        if (type->per_fsid && info->uuid != NULL && info->uuid[0] != '\0' &&
+            !g_hash_table_add (fsids, info->uuid))
+        {
+            continue;
+        }
+        part = new_disk_part (disk, info);
+        job = g_new0 (SysbakJob, 1);
+        job->func = type->func;
+        job->object = g_object_ref (part->object);
+        job->source = g_strdup (info->path);
+        job->target = g_strdup_printf ("%s/%s.img", disk->target, info->name);
+        job->overwrite = disk->overwrite;
+        job->lean = disk->lean;
+        job->done = part_done;
+        job->done_data = part;
+        disk->running++;
+        sched_submit (job, job->source, job->target, type->exclusive, disk->group);
+    }
+    g_hash_table_destroy (fsids);
+    if (disk->running == 0)
+    {
+        finish_disk (disk);
+    }
+    return G_SOURCE_REMOVE;
+}
+/******************************************************************************
+ * Function:              backup_disk_thread      
+ *        
+ * Explain: Capture the lvm metadata, the partition list, the partition
+ *          table and the MBR of the disk side by side, then hand the
+ *          partitions to the main loop.  Runs on a thread of its own, a
+ *          worker of the pool would only wait on the tools.
+ ******************************************************************************/
+static gpointer backup_disk_thread (gpointer data)
+{
+    static const SysbakCaptureFunc funcs[DISK_CAPTURES] =
+    {
+        capture_lvm_meta,
+        capture_disk_info,
+        capture_partition_table,
+        capture_disk_mbr
+    };
+    SysbakDisk    *disk = data;
+    SysbakCapture  captures[DISK_CAPTURES];
+    GThread       *threads[DISK_CAPTURES];
+    int            i;
+
+    if (g_mkdir_with_parents (disk->target, S_IRWXU) != 0)
+    {
+        disk->message = g_strdup_printf ("Failed to create %s", disk->target);
+        goto EXIT;
+    }
+    for (i = 0; i < DISK_CAPTURES; i++)
+    {
+        captures[i].func = funcs[i];
+        captures[i].disk = disk;
+        captures[i].message = NULL;
+        threads[i] = g_thread_new ("disk-capture", capture_thread, &captures[i]);
+    }
+    for (i = 0; i < DISK_CAPTURES; i++)
+    {
+        if (GPOINTER_TO_INT (g_thread_join (threads[i])) || disk->message != NULL)
+        {
+            g_free (captures[i].message);
+            continue;
+        }
+        disk->message = captures[i].message;
+    }
+EXIT:
+    g_main_context_invoke (NULL, start_disk_parts, disk);
+    return NULL;
+}
+/******************************************************************************
+ * Function:              handle_backup_disk      
+ *        
+ * Explain: Back up a whole disk into a directory: the lvm metadata,
+ *          disk-info.ini, the partition table, the MBR, and an image of
+ *          each partition and logical volume.  The partitions are imaged
+ *          side by side, and a job object reports them as one: Progress
+ *          weighs them by size, Finished sums them up in DISK_BLOCK_SIZE
+ *          blocks, and Cancel, Pause and Resume act on all of them.
+ *        
+ * Input:   @source       the disk device
+ *          @target       the directory, created if needed
+ *          @max_jobs     partitions imaged at a time, 0 for SYSBAK_MAX_JOBS
+ ******************************************************************************/
+static gboolean handle_backup_disk (SysbakGdbus           *object,
+                                    GDBusMethodInvocation *invocation,
+                                    const gchar           *source,
+                                    const gchar           *target,
+                                    gboolean               overwrite,
+                                    gboolean               lean,
+                                    guint                  max_jobs)
+{
+    SysbakDisk *disk = g_new0 (SysbakDisk, 1);
+
+    disk->object = new_job_object (object, source, target);
+    disk->invocation = invocation;
+    disk->source = g_strdup (source);
+    disk->target = g_strdup (target);
+    disk->overwrite = overwrite;
+    disk->lean = lean;
+    disk->group = sched_group_new (max_jobs > 0 ? max_jobs : SYSBAK_MAX_JOBS);
+    disk->parts = g_ptr_array_new_with_free_func (free_part);
+    disk->start = time (NULL);
+    g_thread_unref (g_thread_new ("disk-backup", backup_disk_thread, disk));
+
+    return TRUE;
+}
+typedef gboolean (*SysbakControlFunc) (SysbakGdbus *object);
+
+/// on a job object for that job, on the daemon object for every job
+static gboolean control_jobs (SysbakGdbus *object, SysbakControlFunc func)
+{
+    GHashTableIter iter;
+    gpointer       job_object;
+    gboolean       ret = FALSE;
+
+    if (g_object_get_data (G_OBJECT (object), SYSBAK_JOB_CONTROL) != NULL)
+    {
+        return func (object);
+    }
+    g_hash_table_iter_init (&iter, live_jobs);
+    while (g_hash_table_iter_next (&iter, &job_object, NULL))
+    {
+        if (func (job_object))
+            ret = TRUE;
+    }
+    return ret;
+}
+static gboolean handle_cancel (SysbakGdbus           *object,
+                               GDBusMethodInvocation *invocation)
+{
+    sysbak_gdbus_complete_cancel (object, invocation, control_jobs (object, cancel_job));
+    return TRUE;
+}
+static gboolean handle_pause (SysbakGdbus           *object,
+                              GDBusMethodInvocation *invocation)
+{
+    sysbak_gdbus_complete_pause (object, invocation, control_jobs (object, pause_job));
+    return TRUE;
+}
+static gboolean handle_resume (SysbakGdbus           *object,
+                               GDBusMethodInvocation *invocation)
+{
+    sysbak_gdbus_complete_resume (object, invocation, control_jobs (object, resume_job));
+    return TRUE;
+}
+
 static void AcquiredCallback (GDBusConnection *Connection,
                               const gchar     *name,
                               gpointer         data)
@@ -41,15 +766,19 @@ static void AcquiredCallback (GDBusConnection *Connection,
     sysbak_gdbus = sysbak_gdbus_skeleton_new ();
     iface = SYSBAK_GDBUS_GET_IFACE (sysbak_gdbus);
 
-    iface->handle_sysbak_extfs_ptf  = gdbus_sysbak_extfs_ptf;
-	iface->handle_sysbak_extfs_ptp  = gdbus_sysbak_extfs_ptp;
-    iface->handle_sysbak_fatfs_ptf  = gdbus_sysbak_fatfs_ptf;
-	iface->handle_sysbak_fatfs_ptp  = gdbus_sysbak_fatfs_ptp;
-    iface->handle_sysbak_btrfs_ptf  = gdbus_sysbak_btrfs_ptf;
-	iface->handle_sysbak_btrfs_ptp  = gdbus_sysbak_btrfs_ptp;
-    iface->handle_sysbak_xfsfs_ptf  = gdbus_sysbak_xfsfs_ptf;
-	iface->handle_sysbak_xfsfs_ptp  = gdbus_sysbak_xfsfs_ptp;
-	iface->handle_sysbak_restore    = gdbus_sysbak_restore;
+    iface->handle_sysbak_extfs_ptf  = handle_extfs_ptf;
+	iface->handle_sysbak_extfs_ptp  = handle_extfs_ptp;
+    iface->handle_sysbak_fatfs_ptf  = handle_fatfs_ptf;
+	iface->handle_sysbak_fatfs_ptp  = handle_fatfs_ptp;
+    iface->handle_sysbak_btrfs_ptf  = handle_btrfs_ptf;
+	iface->handle_sysbak_btrfs_ptp  = handle_btrfs_ptp;
+    iface->handle_sysbak_xfsfs_ptf  = handle_xfsfs_ptf;
+	iface->handle_sysbak_xfsfs_ptp  = handle_xfsfs_ptp;
+	iface->handle_sysbak_restore    = handle_restore;
+    iface->handle_backup_disk       = handle_backup_disk;
+    iface->handle_cancel            = handle_cancel;
+    iface->handle_pause             = handle_pause;
+    iface->handle_resume            = handle_resume;
     iface->handle_get_disk_size     = gdbus_get_disk_size;
     iface->handle_get_source_use_size     = gdbus_get_source_use_size;
     iface->handle_create_pv         = gdbus_create_pv;
@@ -90,6 +819,8 @@ int main(int argc,char* argv[])
 {
     guint  dbus_id;
 
+    live_jobs = g_hash_table_new (NULL, NULL);
+    sched_init (run_job, SYSBAK_MAX_JOBS);
     dbus_id = g_bus_own_name (G_BUS_TYPE_SYSTEM,
                               ORG_NAME,
                               G_BUS_NAME_OWNER_FLAGS_ALLOW_REPLACEMENT,
@@ -101,5 +832,7 @@ int main(int argc,char* argv[])
     loop = g_main_loop_new(NULL, FALSE);
     g_main_loop_run(loop);
     g_bus_unown_name(dbus_id);
+    sched_free ();
+    g_hash_table_destroy (live_jobs);
     return 0;
 }
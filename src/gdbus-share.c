@@ -72,6 +72,271 @@ int write_read_io_all(int *fd, char *buf, ull count, int do_write)
     }
     return size;
 }
+/// write zeros over [offset, offset + length), the device or file is left
+/// the same size
+gboolean zero_device_range(int *fd, ull offset, ull length)
+{
+    char *buffer;
+    ull   count;
+
+    if (length == 0)
+        return TRUE;
+#ifdef FALLOC_FL_ZERO_RANGE
+    if (fallocate(*fd, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE, offset, length) == 0)
+        return TRUE;
+#endif
+    buffer = calloc(1, DEFAULT_BUFFER_SIZE);
+    if (buffer == NULL)
+    {
+        return FALSE;
+    }
+    if (lseek(*fd, (off_t)offset, SEEK_SET) == (off_t)-1)
+    {
+        free(buffer);
+        return FALSE;
+    }
+    while (length > 0)
+    {
+        count = length < DEFAULT_BUFFER_SIZE ? length : DEFAULT_BUFFER_SIZE;
+        if (write_read_io_all(fd, buffer, count, WRITE) != (int)count)
+        {
+            free(buffer);
+            return FALSE;
+        }
+        length -= count;
+    }
+    free(buffer);
+
+    return TRUE;
+}
+
+/// the copy table follows the bitmap: a count, the ranges and their crc
+gboolean write_image_copies(int *fd, GArray *copies)
+{
+    uint32_t count = copies->len;
+    uint32_t crc;
+    ull      size = (ull)count * sizeof(image_copy_range);
+
+    if (write_read_io_all(fd, (char*)&count, sizeof(count), WRITE) != sizeof(count))
+    {
+        return FALSE;
+    }
+    if (size > 0 && write_read_io_all(fd, copies->data, size, WRITE) != (int)size)
+    {
+        return FALSE;
+    }
+    init_crc32(&crc);
+    crc = crc32(crc, copies->data, size);
+    if (write_read_io_all(fd, (char*)&crc, sizeof(crc), WRITE) != sizeof(crc))
+    {
+        return FALSE;
+    }
+
+    return TRUE;
+}
+gboolean read_image_copies(int *fd, GArray *copies)
+{
+    uint32_t count;
+    uint32_t crc, r_crc;
+    ull      size;
+
+    if (write_read_io_all(fd, (char*)&count, sizeof(count), READ) != sizeof(count))
+    {
+        return FALSE;
+    }
+    size = (ull)count * sizeof(image_copy_range);
+    if (size > DEFAULT_BUFFER_SIZE * 64ULL)
+    {
+        return FALSE;
+    }
+    g_array_set_size(copies, count);
+    if (size > 0 && write_read_io_all(fd, copies->data, size, READ) != (int)size)
+    {
+        return FALSE;
+    }
+    if (write_read_io_all(fd, (char*)&r_crc, sizeof(r_crc), READ) != sizeof(r_crc))
+    {
+        return FALSE;
+    }
+    init_crc32(&crc);
+    crc = crc32(crc, copies->data, size);
+
+    return crc == r_crc;
+}
+/// the xfs log description follows the bitmap with its own crc
+gboolean write_image_xfs_log(int *fd, image_xfs_log *log)
+{
+    uint32_t crc;
+
+    if (write_read_io_all(fd, (char*)log, sizeof(image_xfs_log), WRITE) != sizeof(image_xfs_log))
+    {
+        return FALSE;
+    }
+    init_crc32(&crc);
+    crc = crc32(crc, log, sizeof(image_xfs_log));
+
+    return write_read_io_all(fd, (char*)&crc, sizeof(crc), WRITE) == sizeof(crc);
+}
+gboolean read_image_xfs_log(int *fd, image_xfs_log *log)
+{
+    uint32_t crc, r_crc;
+
+    if (write_read_io_all(fd, (char*)log, sizeof(image_xfs_log), READ) != sizeof(image_xfs_log))
+    {
+        return FALSE;
+    }
+    if (write_read_io_all(fd, (char*)&r_crc, sizeof(r_crc), READ) != sizeof(r_crc))
+    {
+        return FALSE;
+    }
+    init_crc32(&crc);
+    crc = crc32(crc, log, sizeof(image_xfs_log));
+
+    return crc == r_crc;
+}
+/// the bytes after the last whole block, data is NULL when the device ends on one
+gboolean read_device_tail(int *fd, file_system_info fs_info, image_tail *tail, char **data)
+{
+    tail->offset = fs_info.totalblock * fs_info.block_size;
+    tail->length = fs_info.device_size > tail->offset ? fs_info.device_size - tail->offset : 0;
+    *data = NULL;
+    if (tail->length == 0)
+    {
+        return TRUE;
+    }
+    *data = g_malloc(tail->length);
+    if (lseek(*fd, (off_t)tail->offset, SEEK_SET) == (off_t)-1 ||
+        write_read_io_all(fd, *data, tail->length, READ) != (int)tail->length)
+    {
+        g_free(*data);
+        *data = NULL;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+gboolean write_device_tail(int *fd, image_tail *tail, const char *data)
+{
+    if (tail->length == 0)
+    {
+        return TRUE;
+    }
+    if (lseek(*fd, (off_t)tail->offset, SEEK_SET) == (off_t)-1)
+    {
+        return FALSE;
+    }
+
+    return write_read_io_all(fd, (char*)data, tail->length, WRITE) == (int)tail->length;
+}
+/// the tail follows the bitmap and the other trailers, its bytes and a crc
+gboolean write_image_tail(int *fd, image_tail *tail, const char *data)
+{
+    uint32_t crc;
+
+    if (write_read_io_all(fd, (char*)tail, sizeof(image_tail), WRITE) != sizeof(image_tail))
+    {
+        return FALSE;
+    }
+    if (write_read_io_all(fd, (char*)data, tail->length, WRITE) != (int)tail->length)
+    {
+        return FALSE;
+    }
+    init_crc32(&crc);
+    crc = crc32(crc, tail, sizeof(image_tail));
+    crc = crc32(crc, (char*)data, tail->length);
+
+    return write_read_io_all(fd, (char*)&crc, sizeof(crc), WRITE) == sizeof(crc);
+}
+gboolean read_image_tail(int *fd, file_system_info fs_info, image_tail *tail, char **data)
+{
+    uint32_t crc, r_crc;
+
+    *data = NULL;
+    if (write_read_io_all(fd, (char*)tail, sizeof(image_tail), READ) != sizeof(image_tail))
+    {
+        return FALSE;
+    }
+    if (tail->length == 0 || tail->length >= fs_info.block_size ||
+        tail->offset != fs_info.totalblock * fs_info.block_size)
+    {
+        return FALSE;
+    }
+    *data = g_malloc(tail->length);
+    if (write_read_io_all(fd, *data, tail->length, READ) != (int)tail->length ||
+        write_read_io_all(fd, (char*)&r_crc, sizeof(r_crc), READ) != sizeof(r_crc))
+    {
+        goto ERROR;
+    }
+    init_crc32(&crc);
+    crc = crc32(crc, tail, sizeof(image_tail));
+    crc = crc32(crc, *data, tail->length);
+    if (crc != r_crc)
+    {
+        goto ERROR;
+    }
+
+    return TRUE;
+ERROR:
+    g_free(*data);
+    *data = NULL;
+    return FALSE;
+}
+/******************************************************************************
+ * Function:              rebuild_copy_ranges      
+ *        
+ * Explain: Write the copies that were left out of the image.  Only the
+ *          used blocks of each source range are copied, the rest of the
+ *          range holds nothing the file system will read.
+ *        
+ * Input:   @fd           restored device or file, source ranges written
+ *          @fs_info      block size and count of the bitmap
+ *          @bitmap       used blocks
+ *          @copies       image_copy_range entries
+ ******************************************************************************/
+gboolean rebuild_copy_ranges(int              *fd,
+                             file_system_info  fs_info,
+                             ul               *bitmap,
+                             GArray           *copies)
+{
+    const uint        buffer_capacity = DEFAULT_BUFFER_SIZE > fs_info.block_size ? 
+                                        DEFAULT_BUFFER_SIZE / fs_info.block_size : 1;
+    image_copy_range *range;
+    char             *buffer;
+    ull               block, end, run;
+    ull               bytes;
+    off_t             delta;
+    guint             i;
+
+    buffer = malloc((ull)buffer_capacity * fs_info.block_size);
+    if (buffer == NULL)
+    {
+        return FALSE;
+    }
+    for (i = 0; i < copies->len; i++)
+    {
+        range = &g_array_index(copies, image_copy_range, i);
+        block = range->source / fs_info.block_size;
+        end = (range->source + range->length) / fs_info.block_size;
+        if (end > fs_info.totalblock)
+            end = fs_info.totalblock;
+        delta = (off_t)range->target - (off_t)range->source;
+        while ((block = pc_find_next_set(bitmap, end, block)) < end)
+        {
+            run = pc_find_next_zero(bitmap, MIN(end, block + buffer_capacity), block) - block;
+            bytes = run * fs_info.block_size;
+            if (pread(*fd, buffer, bytes, (off_t)(block * fs_info.block_size)) != (ssize_t)bytes ||
+                pwrite(*fd, buffer, bytes, (off_t)(block * fs_info.block_size) + delta) != (ssize_t)bytes)
+            {
+                free(buffer);
+                return FALSE;
+            }
+            block += run;
+        }
+    }
+    free(buffer);
+
+    return TRUE;
+}
 
 gboolean check_memory_size(file_system_info fs_info,image_options img_opt)
 {
@@ -83,17 +348,19 @@ gboolean check_memory_size(file_system_info fs_info,image_options img_opt)
     ull            cs_size = 0;
     void          *test_bitmap, *test_read, *test_write;
     ull            cs_in_buffer = buffer_capacity / blkcs;
+    /// large bitmaps are file backed and need no resident memory
+    const gboolean bitmap_in_memory = pc_bitmap_in_memory(fs_info.totalblock);
 
     cs_size = cs_in_buffer * img_opt.checksum_size;
 
-    test_bitmap = malloc(bitmap_size);
+    test_bitmap = bitmap_in_memory ? malloc(bitmap_size) : NULL;
     test_read   = malloc(raw_io_size);
     test_write  = malloc(raw_io_size + cs_size);
 
     free(test_bitmap);
     free(test_read);
     free(test_write);
-    if (test_bitmap == NULL || test_read == NULL || test_write == NULL) 
+    if ((bitmap_in_memory && test_bitmap == NULL) || test_read == NULL || test_write == NULL) 
     {
         return FALSE;
     }
@@ -102,7 +369,7 @@ gboolean check_memory_size(file_system_info fs_info,image_options img_opt)
 }
 static void set_image_options(image_options* img_opt)
 {
-    img_opt->feature_size = sizeof(image_options);
+    img_opt->feature_size = IMAGE_OPTIONS_V2_SIZE;
     img_opt->image_version = 0x0002;
     img_opt->checksum_mode = CSM_CRC32;
     img_opt->checksum_size = CRC32_SIZE;
@@ -124,18 +391,17 @@ void init_image_options(image_options* img_opt)
     set_image_options(img_opt);
 }
 
-void update_used_blocks_count(file_system_info* fs_info, ul *bitmap) 
+/// fs_flags only exist in the extended options block, plain images keep
+/// the partclone 0002 layout
+void set_image_fs_flags(image_options *img_opt, uint8_t fs_flags)
 {
-    ull  used = 0;
-    uint i;
-
-    for(i = 0; i < fs_info->totalblock; ++i) 
-    {
-        if (pc_test_bit(i, bitmap, fs_info->totalblock))
-            ++used;
-    }
+    img_opt->fs_flags = fs_flags;
+    img_opt->feature_size = fs_flags ? sizeof(image_options) : IMAGE_OPTIONS_V2_SIZE;
+}
 
-    fs_info->used_bitmap = used;
+void update_used_blocks_count(file_system_info* fs_info, ul *bitmap) 
+{
+    fs_info->used_bitmap = pc_count_bits(bitmap, fs_info->totalblock);
 }
 static ul get_checksum_count(ull       block_count, 
                              uint32_t  blocks_per_cs) 
@@ -237,13 +503,21 @@ static void init_image_head(image_head* image_hdr)
 gboolean write_image_desc(int* fd, file_system_info fs_info,image_options img_opt) 
 {
     image_desc image;
+    uint32_t   crc;
+    ull        desc_size;
+
+    memset(&image, 0, sizeof(image_desc));
     init_image_head(&image.head);
 
     memcpy(&image.fs_info, &fs_info, sizeof(file_system_info));
-    memcpy(&image.options, &img_opt, sizeof(image_options));
-    init_crc32(&image.crc);
-    image.crc = crc32(image.crc, &image, sizeof(image_desc) - CRC32_SIZE);
-    if (write_read_io_all (fd, (char*)&image, sizeof(image_desc),WRITE) != sizeof(image_desc))
+    memcpy(&image.options, &img_opt, img_opt.feature_size);
+    /// the checksum follows the options block actually in use
+    desc_size = offsetof(image_desc, options) + img_opt.feature_size;
+    init_crc32(&crc);
+    crc = crc32(crc, &image, desc_size);
+    memcpy((char*)&image + desc_size, &crc, CRC32_SIZE);
+    desc_size += CRC32_SIZE;
+    if (write_read_io_all (fd, (char*)&image, desc_size,WRITE) != (int)desc_size)
     {
         return FALSE;
     }    
@@ -276,10 +550,13 @@ gboolean read_image_desc(int              *fd,
 
     image_desc image;
     int r_size;
-    uint32_t crc;
+    uint32_t crc, r_crc;
+    ull head_size = offsetof(image_desc, options) + sizeof(image.options.feature_size);
+    ull desc_size;
 
-    r_size = write_read_io_all (fd, (char*)&image, sizeof(image), READ);
-    if (r_size != sizeof(image))
+    memset(&image, 0, sizeof(image_desc));
+    r_size = write_read_io_all (fd, (char*)&image, head_size, READ);
+    if (r_size != (int)head_size)
     {
         return FALSE;
     }
@@ -288,10 +565,27 @@ gboolean read_image_desc(int              *fd,
     {
         return FALSE;
     }
+    /// the options block is partclone 0002 or our extended one
+    if (image.options.feature_size < IMAGE_OPTIONS_V2_SIZE ||
+        image.options.feature_size > sizeof(image_options))
+    {
+        return FALSE;
+    }
+    desc_size = offsetof(image_desc, options) + image.options.feature_size;
+    r_size = write_read_io_all (fd, (char*)&image + head_size, desc_size - head_size, READ);
+    if (r_size != (int)(desc_size - head_size))
+    {
+        return FALSE;
+    }
+    r_size = write_read_io_all (fd, (char*)&r_crc, CRC32_SIZE, READ);
+    if (r_size != CRC32_SIZE)
+    {
+        return FALSE;
+    }
 
     init_crc32(&crc);
-    crc = crc32(crc, &image, sizeof(image) - CRC32_SIZE);
-    if (crc != image.crc)
+    crc = crc32(crc, &image, desc_size);
+    if (crc != r_crc)
     {
         return FALSE;
     }
@@ -354,9 +648,10 @@ static gboolean check_file_type (const char *filename)
 {
     struct stat s_stat;
     int fd;
-    image_desc image;
-    int r_size;
-    uint32_t crc;
+    image_head       img_head;
+    file_system_info fs_info;
+    image_options    img_opt;
+    gboolean         ret;
 
     if (stat(filename,&s_stat) != 0)
     {
@@ -372,24 +667,10 @@ static gboolean check_file_type (const char *filename)
     {
         return FALSE;
     }    
-    r_size = read(fd, (char*)&image, sizeof(image));
-    if (r_size != sizeof(image))
-    {
-        return FALSE;
-    }
-    // check the image magic
-    if (memcmp(image.head.magic, IMAGE_MAGIC, IMAGE_MAGIC_SIZE))
-    {
-        return FALSE;
-    }
-    init_crc32(&crc);
-    crc = crc32(crc, &image, sizeof(image) - CRC32_SIZE);
-    if (crc != image.crc)
-    {
-        return FALSE;
-    }
+    // check the image magic and header checksum
+    ret = read_image_desc(&fd, &img_head, &fs_info, &img_opt);
     close (fd);
-    return TRUE;
+    return ret;
 }    
 int open_source_device(const char *device,int mode) 
 {
@@ -438,6 +719,8 @@ int open_target_device(const char* target, int mode,gboolean overwrite)
     // back-up parct to parct or restore or dd to block
     else if (mode == RESTORE || mode == BACK_PTP || (ddd_block_device == 1)) 
     {    
+        /// redundant copies are rebuilt by reading the target back
+        flags = O_RDWR | O_LARGEFILE;
         stat(target, &st_dev);
         if (!S_ISBLK(st_dev.st_mode)) 
         {
@@ -449,3 +732,252 @@ int open_target_device(const char* target, int mode,gboolean overwrite)
     } 
     return ret;
 }
+/// signals of a worker thread, carried over to the main loop
+typedef enum
+{
+    SIGNAL_PROGRESS,
+    SIGNAL_FINISHED,
+    SIGNAL_ERROR
+} SysbakSignalKind;
+
+typedef struct
+{
+    SysbakSignalKind kind;
+    SysbakGdbus     *object;
+    gdouble          percent;
+    gdouble          speed;
+    guint64          elapsed;
+    guint64          totalblock;
+    guint64          usedblocks;
+    guint            block_size;
+    gchar           *message;
+    gint             ecode;
+} SysbakSignal;
+
+static void emit_signal_on (SysbakGdbus *object, SysbakSignal *signal)
+{
+    switch (signal->kind)
+    {
+        case SIGNAL_PROGRESS:
+            sysbak_gdbus_emit_sysbak_progress (object,
+                                               signal->percent,
+                                               signal->speed,
+                                               signal->elapsed);
+            break;
+        case SIGNAL_FINISHED:
+            sysbak_gdbus_emit_sysbak_finished (object,
+                                               signal->totalblock,
+                                               signal->usedblocks,
+                                               signal->block_size);
+            break;
+        case SIGNAL_ERROR:
+            sysbak_gdbus_emit_sysbak_error (object,
+                                            signal->message,
+                                            signal->ecode);
+            break;
+        default:
+            break;
+    }
+}
+/// a job object sends the signal itself, then the daemon object repeats it
+static gboolean emit_signal_main (gpointer data)
+{
+    SysbakSignal *signal = data;
+    SysbakGdbus  *parent;
+
+    emit_signal_on (signal->object, signal);
+    parent = g_object_get_data (G_OBJECT (signal->object), SYSBAK_JOB_PARENT);
+    if (parent != NULL)
+    {
+        emit_signal_on (parent, signal);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+static void free_signal (gpointer data)
+{
+    SysbakSignal *signal = data;
+
+    g_object_unref (signal->object);
+    g_free (signal->message);
+    g_free (signal);
+}
+/******************************************************************************
+ * Function:              queue_signal      
+ *        
+ * Explain: Jobs run on worker threads, their signals are emitted from the
+ *          main loop, in the order they were queued.  Called on the main
+ *          loop itself the signal goes out at once.
+ ******************************************************************************/
+static void queue_signal (SysbakSignal *signal)
+{
+    g_main_context_invoke_full (NULL,
+                                G_PRIORITY_DEFAULT,
+                                emit_signal_main,
+                                signal,
+                                free_signal);
+}
+void emit_sysbak_progress (SysbakGdbus *object,
+                           gdouble      percent,
+                           gdouble      speed,
+                           guint64      elapsed)
+{
+    SysbakSignal *signal = g_new0 (SysbakSignal, 1);
+
+    signal->kind = SIGNAL_PROGRESS;
+    signal->object = g_object_ref (object);
+    signal->percent = percent;
+    signal->speed = speed;
+    signal->elapsed = elapsed;
+    queue_signal (signal);
+}
+void emit_sysbak_finished (SysbakGdbus *object,
+                           guint64      totalblock,
+                           guint64      usedblocks,
+                           guint        block_size)
+{
+    SysbakSignal *signal = g_new0 (SysbakSignal, 1);
+
+    signal->kind = SIGNAL_FINISHED;
+    signal->object = g_object_ref (object);
+    signal->totalblock = totalblock;
+    signal->usedblocks = usedblocks;
+    signal->block_size = block_size;
+    queue_signal (signal);
+}
+void emit_sysbak_error (SysbakGdbus *object,
+                        const gchar *message,
+                        gint         ecode)
+{
+    SysbakSignal *signal = g_new0 (SysbakSignal, 1);
+
+    signal->kind = SIGNAL_ERROR;
+    signal->object = g_object_ref (object);
+    /// whatever step a cancelled job failed at, it reports the cancel
+    if (job_cancelled (object))
+    {
+        message = SYSBAK_CANCELLED_MESSAGE;
+        ecode = SYSBAK_CANCELLED;
+    }
+    /// SysbakError carries a string, never a NULL one
+    if (message == NULL)
+    {
+        message = "Unknown error";
+    }
+    signal->message = g_strdup (message);
+    signal->ecode = ecode;
+    queue_signal (signal);
+}
+/// cancel and pause state of a job object
+typedef struct
+{
+    GCancellable *cancellable;
+    GMutex        lock;
+    GCond         cond;
+    gboolean      paused;
+    gint          ref_count;    /// job objects sharing it
+} SysbakControl;
+
+static void free_control (gpointer data)
+{
+    SysbakControl *control = data;
+
+    if (!g_atomic_int_dec_and_test (&control->ref_count))
+        return;
+    g_object_unref (control->cancellable);
+    g_cond_clear (&control->cond);
+    g_mutex_clear (&control->lock);
+    g_free (control);
+}
+static SysbakControl *get_control (SysbakGdbus *object)
+{
+    return g_object_get_data (G_OBJECT (object), SYSBAK_JOB_CONTROL);
+}
+void new_job_control (SysbakGdbus *object)
+{
+    SysbakControl *control = g_new0 (SysbakControl, 1);
+
+    control->cancellable = g_cancellable_new ();
+    g_mutex_init (&control->lock);
+    g_cond_init (&control->cond);
+    control->ref_count = 1;
+    g_object_set_data_full (G_OBJECT (object), SYSBAK_JOB_CONTROL, control, free_control);
+}
+/// a job run as part of another one stops and sleeps along with it
+void share_job_control (SysbakGdbus *object, SysbakGdbus *owner)
+{
+    SysbakControl *control = get_control (owner);
+
+    g_atomic_int_inc (&control->ref_count);
+    g_object_set_data_full (G_OBJECT (object), SYSBAK_JOB_CONTROL, control, free_control);
+}
+/// wakes a paused job too, it must not sleep through its cancel
+gboolean cancel_job (SysbakGdbus *object)
+{
+    SysbakControl *control = get_control (object);
+
+    if (control == NULL)
+        return FALSE;
+    g_cancellable_cancel (control->cancellable);
+    g_mutex_lock (&control->lock);
+    g_cond_broadcast (&control->cond);
+    g_mutex_unlock (&control->lock);
+
+    return TRUE;
+}
+gboolean pause_job (SysbakGdbus *object)
+{
+    SysbakControl *control = get_control (object);
+
+    if (control == NULL)
+        return FALSE;
+    g_mutex_lock (&control->lock);
+    control->paused = TRUE;
+    g_mutex_unlock (&control->lock);
+
+    return TRUE;
+}
+gboolean resume_job (SysbakGdbus *object)
+{
+    SysbakControl *control = get_control (object);
+
+    if (control == NULL)
+        return FALSE;
+    g_mutex_lock (&control->lock);
+    control->paused = FALSE;
+    g_cond_broadcast (&control->cond);
+    g_mutex_unlock (&control->lock);
+
+    return TRUE;
+}
+gboolean job_cancelled (SysbakGdbus *object)
+{
+    SysbakControl *control = get_control (object);
+
+    return control != NULL && g_cancellable_is_cancelled (control->cancellable);
+}
+/******************************************************************************
+ * Function:              job_continue      
+ *        
+ * Explain: Checked by the copy loops before every chunk.  A paused job
+ *          sleeps here, between two chunks, until it is resumed or
+ *          cancelled, so it picks up at the block it stopped on.
+ *        
+ * Input:   @object       the job object the copy reports on
+ *        
+ * Output:  go on         :TRUE
+ *          cancelled     :FALSE, the loop unwinds through its ERROR path
+ ******************************************************************************/
+gboolean job_continue (SysbakGdbus *object)
+{
+    SysbakControl *control = get_control (object);
+
+    if (control == NULL)
+        return TRUE;
+    g_mutex_lock (&control->lock);
+    while (control->paused && !g_cancellable_is_cancelled (control->cancellable))
+        g_cond_wait (&control->cond, &control->lock);
+    g_mutex_unlock (&control->lock);
+
+    return !g_cancellable_is_cancelled (control->cancellable);
+}
@@ -23,6 +23,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <stdarg.h>
 #include <sysbak-admin-generated.h>
 
@@ -49,6 +50,12 @@
 #define     ext4_MAGIC               "EXT4"
 #define     btrfs_MAGIC              "BTRFS"
 #define     xfs_MAGIC                "XFS"
+/// set on a job object, its signals are repeated on the daemon object
+#define     SYSBAK_JOB_PARENT        "sysbak-job-parent"
+#define     SYSBAK_JOB_CONTROL       "sysbak-job-control"
+/// SysbakError of a cancelled job, past the backend error codes
+#define     SYSBAK_CANCELLED          10
+#define     SYSBAK_CANCELLED_MESSAGE "Job cancelled"
 
 typedef enum
 {
@@ -82,8 +89,39 @@ typedef struct
     uint32_t blocks_per_checksum;
     uint8_t  reseed_checksum;
     uint8_t  bitmap_mode;
+    uint8_t  fs_flags;          /// only present when feature_size covers it
 
 } image_options;
+/// size of the options block written by partclone 0002 images
+#define     IMAGE_OPTIONS_V2_SIZE    offsetof(image_options, fs_flags)
+/// ext lean image, unused inode tables and a clean journal were left out
+#define     IMAGE_FS_LEAN            0x01
+/// redundant copies were left out, a copy table after the bitmap rebuilds them
+#define     IMAGE_FS_COPIES          0x02
+/// a clean xfs log was left out, an image_xfs_log after the bitmap describes it
+#define     IMAGE_FS_XFS_LOG         0x04
+/// the device does not end on a block, an image_tail after the bitmap holds the rest
+#define     IMAGE_FS_TAIL            0x08
+typedef struct
+{
+    ull target;         /// byte offset of the copy left out of the image
+    ull source;         /// byte offset of the copy in the image
+    ull length;
+} image_copy_range;
+typedef struct
+{
+    ull      offset;    /// byte offset of the internal log
+    ull      length;    /// log size in bytes
+    uint32_t cycle;     /// cycle of the fresh log, above every lsn on disk
+    uint32_t version;   /// log record version, 1 or 2
+    uint32_t sunit;     /// log stripe unit in bytes, 0 for none
+    uint8_t  uuid[16];  /// file system uuid stamped in every record
+} image_xfs_log;
+typedef struct
+{
+    ull offset;         /// byte offset of the end of the last whole block
+    ull length;         /// bytes up to the end of the device, less than a block
+} image_tail;
 typedef struct
 {
     char     magic[IMAGE_MAGIC_SIZE+1];
@@ -140,8 +178,78 @@ int         write_read_io_all              (int              *fd,
 											ull               count, 
 											int               do_write);
 
+gboolean    zero_device_range              (int              *fd,
+                                            ull               offset,
+                                            ull               length);
+
+gboolean    write_image_copies             (int              *fd,
+                                            GArray           *copies);
+
+gboolean    read_image_copies              (int              *fd,
+                                            GArray           *copies);
+
+gboolean    rebuild_copy_ranges            (int              *fd,
+                                            file_system_info  fs_info,
+                                            ul               *bitmap,
+                                            GArray           *copies);
+
+gboolean    write_image_xfs_log            (int              *fd,
+                                            image_xfs_log    *log);
+
+gboolean    read_image_xfs_log             (int              *fd,
+                                            image_xfs_log    *log);
+
+gboolean    read_device_tail               (int              *fd,
+                                            file_system_info  fs_info,
+                                            image_tail       *tail,
+                                            char            **data);
+
+gboolean    write_device_tail              (int              *fd,
+                                            image_tail       *tail,
+                                            const char       *data);
+
+gboolean    write_image_tail               (int              *fd,
+                                            image_tail       *tail,
+                                            const char       *data);
+
+gboolean    read_image_tail                (int              *fd,
+                                            file_system_info  fs_info,
+                                            image_tail       *tail,
+                                            char            **data);
+
+void        emit_sysbak_progress           (SysbakGdbus      *object,
+                                            gdouble           percent,
+                                            gdouble           speed,
+                                            guint64           elapsed);
+
+void        emit_sysbak_finished           (SysbakGdbus      *object,
+                                            guint64           totalblock,
+                                            guint64           usedblocks,
+                                            guint             block_size);
+
+void        emit_sysbak_error              (SysbakGdbus      *object,
+                                            const gchar      *message,
+                                            gint              ecode);
+
+void        new_job_control                (SysbakGdbus      *object);
+
+void        share_job_control              (SysbakGdbus      *object,
+                                            SysbakGdbus      *owner);
+
+gboolean    cancel_job                     (SysbakGdbus      *object);
+
+gboolean    pause_job                      (SysbakGdbus      *object);
+
+gboolean    resume_job                     (SysbakGdbus      *object);
+
+gboolean    job_cancelled                  (SysbakGdbus      *object);
+
+gboolean    job_continue                   (SysbakGdbus      *object);
+
 void        init_file_system_info          (file_system_info *fs_info);
 void        init_image_options             (image_options    *img_opt);
+void        set_image_fs_flags             (image_options    *img_opt,
+                                            uint8_t           fs_flags);
 
 gboolean    write_image_desc               (int              *fd, 
 		                                    file_system_info  fs_info,
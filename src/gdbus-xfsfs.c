@@ -37,7 +37,7 @@ static const char *sysbak_error_message[10] =
 	"Failed to read bitmap",
 	"Not enough disk  space",
 	"Write header information failed",
-	"Failed reading and writing data"
+	"Failed reading and writing data",
 	"Failed reading image header"
 };
 typedef enum typnm
@@ -48,22 +48,23 @@ typedef enum typnm
     TYP_LOG, TYP_RTBITMAP, TYP_RTSUMMARY, TYP_SB, TYP_SYMLINK,
     TYP_TEXT, TYP_NONE
 } typnm_t;
-static ull copied_count;
-static unsigned long long total_block;
-static unsigned long* xfs_bitmap;
-static int source_fd = -1;
-xfs_mount_t     *mp;
-xfs_mount_t     mbuf;
-libxfs_init_t   xargs;
-static void set_bitmap(unsigned long* bitmap, uint64_t start, int count)
+/// the mount of one job, its AG scan threads share it
+typedef struct
 {
-    uint64_t block;
-
-
-    for (block = start; block < start+count; block++){
-    pc_clear_bit(block, bitmap, total_block);
-    }
+    ull             total_block;
+    ul             *bitmap;
+    int             source_fd;
+    xfs_mount_t    *mp;
+    xfs_mount_t     mbuf;
+    libxfs_init_t   xargs;
+    GMutex          bitmap_lock;
+} XfsContext;
 
+/// the job this thread works for, set by the job and each scan thread
+static __thread XfsContext *ctx;
+static void set_bitmap(unsigned long* bitmap, uint64_t start, int count)
+{
+    pc_clear_range(start, count, bitmap, ctx->total_block);
 }
 
 static gboolean get_sb(xfs_sb_t *sbp, xfs_off_t off, int size, xfs_agnumber_t agno)
@@ -79,14 +80,14 @@ static gboolean get_sb(xfs_sb_t *sbp, xfs_off_t off, int size, xfs_agnumber_t ag
     memset(buf, 0, size);
     memset(sbp, 0, sizeof(*sbp));
 
-    if (lseek64(source_fd, off, SEEK_SET) != off) 
+    if (lseek64(ctx->source_fd, off, SEEK_SET) != off) 
     {   
         free(buf); 
         buf = NULL;
         return FALSE;
     }
 
-    if (buf && (rval = read(source_fd, buf, size)) != size) 
+    if (buf && (rval = read(ctx->source_fd, buf, size)) != size) 
     {
         free(buf); 
         buf = NULL;
@@ -105,70 +106,120 @@ static gboolean get_sb(xfs_sb_t *sbp, xfs_off_t off, int size, xfs_agnumber_t ag
 
 static void fs_close(void)
 {
-    libxfs_device_close(xargs.ddev);
+    if (ctx->source_fd < 0)
+    {
+        return;
+    }
+    if (ctx->xargs.ddev)
+    {
+        libxfs_device_close(ctx->xargs.ddev);
+    }
+    close(ctx->source_fd);
+    ctx->source_fd = -1;
+    ctx->mp = NULL;
+}
+/// every job starts on an unmounted context of its own
+static void context_init (XfsContext *context)
+{
+    memset(context, 0, sizeof(XfsContext));
+    context->source_fd = -1;
+    g_mutex_init(&context->bitmap_lock);
+    ctx = context;
+}
+static void context_clear (XfsContext *context)
+{
+    g_mutex_clear(&context->bitmap_lock);
+    ctx = NULL;
 }
-static gboolean fs_open(char* device)
+/// mount the device once, the mount serves the sizing and bitmap phases
+static gboolean fs_open(const char* device)
 {
     xfs_sb_t        *sb;
     unsigned int    source_blocksize;       /* source filesystem blocksize */
     unsigned int    source_sectorsize;      /* source disk sectorsize */
-    if ((source_fd = open(device, O_RDONLY)) < 0) 
+    if ((ctx->source_fd = open(device, O_RDONLY)) < 0) 
     {
         return FALSE;
     }
-    memset(&xargs, 0, sizeof(xargs));
-    xargs.isdirect = LIBXFS_DIRECT;
-    xargs.isreadonly = LIBXFS_ISREADONLY;
-    xargs.volname = device;
+    memset(&ctx->xargs, 0, sizeof(ctx->xargs));
+    ctx->xargs.isdirect = LIBXFS_DIRECT;
+    ctx->xargs.isreadonly = LIBXFS_ISREADONLY;
+    ctx->xargs.usebuflock = 1;       /// the AG scan reads buffers from several threads
+    ctx->xargs.volname = (char *)device;
 
-    if (libxfs_init(&xargs) == 0)
+    if (libxfs_init(&ctx->xargs) == 0)
     {
         return FALSE;
     }
 
-    memset(&mbuf, 0, sizeof(xfs_mount_t));
-    sb = &mbuf.m_sb;
+    memset(&ctx->mbuf, 0, sizeof(xfs_mount_t));
+    sb = &ctx->mbuf.m_sb;
     if (!get_sb(sb, 0, XFS_MAX_SECTORSIZE, 0))
     {
         return FALSE;
     }    
-    mp = libxfs_mount(&mbuf, sb, xargs.ddev, xargs.logdev, xargs.rtdev, 1);
-    if (mp == NULL) 
+    ctx->mp = libxfs_mount(&ctx->mbuf, sb, ctx->xargs.ddev, ctx->xargs.logdev, ctx->xargs.rtdev, 1);
+    if (ctx->mp == NULL) 
     {
         return FALSE;
     } 
-    else if (mp->m_sb.sb_inprogress)  
+    else if (ctx->mp->m_sb.sb_inprogress)  
     {
         return FALSE;
     } 
-    else if (mp->m_sb.sb_logstart == 0)  
+    else if (ctx->mp->m_sb.sb_logstart == 0)  
     {
         return FALSE;
     }
-    else if (mp->m_sb.sb_rextents != 0)  
+    else if (ctx->mp->m_sb.sb_rextents != 0)  
     {
         return FALSE;
     }
 
-    source_blocksize = mp->m_sb.sb_blocksize;
-    source_sectorsize = mp->m_sb.sb_sectsize;
+    source_blocksize = ctx->mp->m_sb.sb_blocksize;
+    source_sectorsize = ctx->mp->m_sb.sb_sectsize;
     if (source_blocksize < source_sectorsize)  
     {
         return FALSE;
     }
     return TRUE;
 }
+/// free extents of the AG being scanned, applied to the bitmap in one go
+typedef struct
+{
+    unsigned long long start;
+    xfs_extlen_t       len;
+} free_extent;
+
+static __thread GArray *ag_extents;
+
 static void
 addtohist(
 	xfs_agnumber_t	agno,
 	xfs_agblock_t	agbno,
 	xfs_extlen_t	len)
 {
-	unsigned long long start_block;
-	
-	start_block = (agno*mp->m_sb.sb_agblocks) + agbno;
-	set_bitmap(xfs_bitmap, start_block, len);
+	free_extent ext;
+
+	ext.start = ((unsigned long long)agno * ctx->mp->m_sb.sb_agblocks) + agbno;
+	ext.len = len;
+	g_array_append_val(ag_extents, ext);
+}
+
+/* AGs share bitmap words at their edges, the clears go in under a lock */
+static void
+flush_ag_extents(void)
+{
+	free_extent	*ext;
+	guint		i;
 
+	g_mutex_lock(&ctx->bitmap_lock);
+	for (i = 0; i < ag_extents->len; i++) {
+		ext = &g_array_index(ag_extents, free_extent, i);
+		set_bitmap(ctx->bitmap, ext->start, ext->len);
+	}
+	g_mutex_unlock(&ctx->bitmap_lock);
+	g_array_set_size(ag_extents, 0);
 }
 
 
@@ -185,18 +236,40 @@ scan_sbtree(
 {
 	xfs_agnumber_t	seqno = be32_to_cpu(agf->agf_seqno);
 	struct xfs_buf	*bp;
-	int blkbb = 1 << mp->m_blkbb_log;
+	int blkbb = 1 << ctx->mp->m_blkbb_log;
 	void *data;
 
-	bp = libxfs_readbuf(mp->m_ddev_targp, XFS_AGB_TO_DADDR(mp, seqno, root), blkbb, 0, NULL);
-        data = bp->b_addr;
-	if (data == NULL) {
+	bp = libxfs_readbuf(ctx->mp->m_ddev_targp, XFS_AGB_TO_DADDR(ctx->mp, seqno, root), blkbb, 0, NULL);
+	if (bp == NULL)
 		return;
-	}
-	(*func)(data, typ, nlevels - 1, agf);
+	data = bp->b_addr;
+	if (data != NULL && bp->b_error == 0)
+		(*func)(data, typ, nlevels - 1, agf);
+	/* buffers are locked per thread, a held one would stall the others */
+	libxfs_putbuf(bp);
 }
 
 
+/* read the children of a node in one batch before walking them one by one */
+static void
+prefetch_level(
+	xfs_agf_t	*agf,
+	xfs_alloc_ptr_t	*pp,
+	int		numrecs)
+{
+	xfs_agnumber_t	seqno = be32_to_cpu(agf->agf_seqno);
+	xfs_daddr_t	*daddrs;
+	int		i;
+
+	if (numrecs <= 1)
+		return;
+	daddrs = g_new(xfs_daddr_t, numrecs);
+	for (i = 0; i < numrecs; i++)
+		daddrs[i] = XFS_AGB_TO_DADDR(ctx->mp, seqno, be32_to_cpu(pp[i]));
+	libxfs_prefetch_bufs(ctx->mp->m_ddev_targp, daddrs, numrecs, 1 << ctx->mp->m_blkbb_log);
+	g_free(daddrs);
+}
+
 static void
 scanfunc_bno(
 	struct xfs_btree_block	*block,
@@ -214,14 +287,15 @@ scanfunc_bno(
 	}
 
 	if (level == 0) {
-		rp = XFS_ALLOC_REC_ADDR(mp, block, 1);
+		rp = XFS_ALLOC_REC_ADDR(ctx->mp, block, 1);
 		for (i = 0; i < be16_to_cpu(block->bb_numrecs); i++)
 			addtohist(be32_to_cpu(agf->agf_seqno),
 					be32_to_cpu(rp[i].ar_startblock),
 					be32_to_cpu(rp[i].ar_blockcount));
 		return;
 	}
-	pp = XFS_ALLOC_PTR_ADDR(mp, block, 1, mp->m_alloc_mxr[1]);
+	pp = XFS_ALLOC_PTR_ADDR(ctx->mp, block, 1, ctx->mp->m_alloc_mxr[1]);
+	prefetch_level(agf, pp, be16_to_cpu(block->bb_numrecs));
 	for (i = 0; i < be16_to_cpu(block->bb_numrecs); i++)
 		scan_sbtree(agf, be32_to_cpu(pp[i]), typ, level, scanfunc_bno);
 }
@@ -240,14 +314,18 @@ scan_freelist(
 
 	if (be32_to_cpu(agf->agf_flcount) == 0)
 		return;
-	bp = libxfs_readbuf(mp->m_ddev_targp, XFS_AG_DADDR(mp, seqno, XFS_AGFL_DADDR(mp)), XFS_FSS_TO_BB(mp, 1), 0, ops);
+	bp = libxfs_readbuf(ctx->mp->m_ddev_targp, XFS_AG_DADDR(ctx->mp, seqno, XFS_AGFL_DADDR(ctx->mp)), XFS_FSS_TO_BB(ctx->mp, 1), 0, ops);
+	if (bp == NULL)
+		return;
 	agfl = bp->b_addr;
 	i = be32_to_cpu(agf->agf_flfirst);
 
-	agfl_bno = xfs_sb_version_hascrc(&mp->m_sb) ? &agfl->agfl_bno[0] : (__be32 *)agfl;
+	agfl_bno = xfs_sb_version_hascrc(&ctx->mp->m_sb) ? &agfl->agfl_bno[0] : (__be32 *)agfl;
 
-	if (be32_to_cpu(agf->agf_flfirst) >= XFS_AGFL_SIZE(mp) ||
-	    be32_to_cpu(agf->agf_fllast) >= XFS_AGFL_SIZE(mp)) {
+	if (bp->b_error != 0 ||
+	    be32_to_cpu(agf->agf_flfirst) >= XFS_AGFL_SIZE(ctx->mp) ||
+	    be32_to_cpu(agf->agf_fllast) >= XFS_AGFL_SIZE(ctx->mp)) {
+		libxfs_putbuf(bp);
 		return;
 	}
 
@@ -256,9 +334,10 @@ scan_freelist(
 		addtohist(seqno, bno, 1);
 		if (i == be32_to_cpu(agf->agf_fllast))
 			break;
-		if (++i == XFS_AGFL_SIZE(mp))
+		if (++i == XFS_AGFL_SIZE(ctx->mp))
 			i = 0;
 	}
+	libxfs_putbuf(bp);
 }
 
 
@@ -271,66 +350,359 @@ scan_ag(
 	struct xfs_buf	*bp;
 	const struct xfs_buf_ops *ops = NULL;
 
-	bp = libxfs_readbuf(mp->m_ddev_targp, XFS_AG_DADDR(mp, agno, XFS_AGF_DADDR(mp)), XFS_FSS_TO_BB(mp, 1), 0, ops);
+	bp = libxfs_readbuf(ctx->mp->m_ddev_targp, XFS_AG_DADDR(ctx->mp, agno, XFS_AGF_DADDR(ctx->mp)), XFS_FSS_TO_BB(ctx->mp, 1), 0, ops);
+	if (bp == NULL)
+		return;
 	agf = bp->b_addr;
-	scan_freelist(agf);
-	scan_sbtree(agf, be32_to_cpu(agf->agf_roots[XFS_BTNUM_BNO]),
-			TYP_BNOBT, be32_to_cpu(agf->agf_levels[XFS_BTNUM_BNO]),
-			scanfunc_bno);
+	if (bp->b_error == 0) {
+		scan_freelist(agf);
+		scan_sbtree(agf, be32_to_cpu(agf->agf_roots[XFS_BTNUM_BNO]),
+				TYP_BNOBT, be32_to_cpu(agf->agf_levels[XFS_BTNUM_BNO]),
+				scanfunc_bno);
+	}
+	libxfs_putbuf(bp);
+	flush_ag_extents();
 }
 
-static gboolean read_bitmap_info (const char      *device, 
-                                  file_system_info fs_info, 
-                                  ul              *bitmap) 
+#define XFS_SCAN_MAX_THREADS   32
+
+typedef struct
+{
+    XfsContext    *ctx;
+    xfs_agnumber_t num_ags;
+    gint           next_ag;
+} XfsAgScan;
+
+static gpointer scan_ag_thread (gpointer data)
 {
+    XfsAgScan *scan = data;
+    gint       agno;
 
-    xfs_agnumber_t  agno = 0;
-    xfs_agnumber_t  num_ags;
+    ctx = scan->ctx;
+    ag_extents = g_array_new(FALSE, FALSE, sizeof(free_extent));
+    while (1)
+    {
+        agno = g_atomic_int_add(&scan->next_ag, 1);
+        if (agno >= (gint)scan->num_ags)
+            break;
+        scan_ag(agno);
+    }
+    g_array_free(ag_extents, TRUE);
+    ag_extents = NULL;
+
+    return NULL;
+}
+/******************************************************************************
+ * Function:              read_bitmap_info      
+ *        
+ * Explain: Start from a full bitmap and clear what the free space btrees
+ *          of every AG list.  AGs are independent, so worker threads
+ *          claim them one at a time; each collects its free extents and
+ *          clears them in one locked pass.
+ *        
+ * Input:   @fs_info      total block count
+ *          @bitmap       image bitmap
+ ******************************************************************************/
+static gboolean read_bitmap_info (file_system_info fs_info, 
+                                  ul              *bitmap) 
+{
+    XfsAgScan  scan;
+    GThread   *threads[XFS_SCAN_MAX_THREADS];
+    guint      nthreads;
+    guint      i;
 
-    //int start = 0;
-    //int bit_size = 1;
-    //int bres;
-    //pthread_t prog_bitmap_thread;
+    ctx->total_block = fs_info.totalblock;
 
-    uint64_t bused = 0;
-    uint64_t bfree = 0;
-    unsigned long long current_block = 0;
-    total_block = fs_info.totalblock;
+    ctx->bitmap = bitmap;
 
-    xfs_bitmap = bitmap;
+    pc_set_range(0, fs_info.totalblock, bitmap, fs_info.totalblock);
 
-    for(current_block = 0; current_block < fs_info.totalblock; current_block++){
-	pc_set_bit(current_block, bitmap, fs_info.totalblock);
+    scan.ctx = ctx;
+    scan.num_ags = ctx->mp->m_sb.sb_agcount;
+    scan.next_ag = 0;
+    nthreads = MIN(g_get_num_processors(), scan.num_ags);
+    nthreads = MIN(nthreads, XFS_SCAN_MAX_THREADS);
+    if (nthreads <= 1)
+    {
+        scan_ag_thread(&scan);
+        return TRUE;
     }
-    fs_open(device);
+    for (i = 0; i < nthreads; i++)
+        threads[i] = g_thread_new("xfs-ag-scan", scan_ag_thread, &scan);
+    for (i = 0; i < nthreads; i++)
+        g_thread_join(threads[i]);
+
+    return TRUE;
+}
+
+/// the in-tree crc32c of btrfs/crc32c.c, its header pulls in btrfs kerncompat
+extern uint32_t crc32c_le(uint32_t seed, unsigned char const *data, size_t length);
+
+/// blocks before the head that in-flight log writes could have left torn
+#define XFS_LOG_VERIFY_BLOCKS   (XLOG_MAX_ICLOGS * BTOBB(XLOG_MAX_RECORD_BSIZE))
+#define XFS_LOG_USER_TID        0xb0c0d0d0      /// xfs_repair marks its records so
+
+static gboolean read_log_blocks (const image_xfs_log *log, ull blk, ull count, char *buffer)
+{
+    ssize_t bytes = BBTOB(count);
+
+    return pread(ctx->source_fd, buffer, bytes, log->offset + BBTOB(blk)) == bytes;
+}
+/// header blocks carry the cycle in h_cycle, every other block in its first word
+static uint32_t log_block_cycle (const char *block)
+{
+    const __be32 *word = (const __be32 *)block;
+
+    if (be32_to_cpu(word[0]) == XLOG_HEADER_MAGIC_NUM)
+        return be32_to_cpu(word[1]);
+    return be32_to_cpu(word[0]);
+}
+static int log_header_blocks (uint32_t version, uint32_t h_size)
+{
+    if (!(version & XLOG_VERSION_2) || h_size <= XLOG_HEADER_CYCLE_SIZE)
+        return 1;
+    return (h_size + XLOG_HEADER_CYCLE_SIZE - 1) / XLOG_HEADER_CYCLE_SIZE;
+}
+/******************************************************************************
+ * Function:              find_clean_log      
+ *        
+ * Explain: Check that the internal log ends in an unmount record, the way
+ *          the kernel's xlog_find_tail decides a log needs no recovery.
+ *          Only a plain cycle boundary is accepted: the head is found by
+ *          binary search, and the blocks in front of it must all carry the
+ *          current cycle.  Anything else keeps the log in the image.
+ *        
+ * Input:   @log          filled with what a restore needs to rewrite it
+ *        
+ * Output:  clean        :TRUE
+ *          otherwise    :FALSE
+ ******************************************************************************/
+static gboolean find_clean_log (image_xfs_log *log)
+{
+    xlog_rec_header_t *rhead = NULL;
+    xlog_op_header_t  *op;
+    char              *buffer;
+    uint32_t           first_cycle, last_cycle, cycle;
+    ull                log_bbs, low, high, mid, start, blk, rblk = 0;
+    int                hblks;
+    gboolean           ret = FALSE;
 
-    num_ags = mp->m_sb.sb_agcount;
+    memset(log, 0, sizeof(image_xfs_log));
+    log->offset = BBTOB(XFS_FSB_TO_DADDR(ctx->mp, ctx->mp->m_sb.sb_logstart));
+    log_bbs = XFS_FSB_TO_BB(ctx->mp, ctx->mp->m_sb.sb_logblocks);
+    log->length = BBTOB(log_bbs);
+    buffer = g_malloc(BBTOB(XFS_LOG_VERIFY_BLOCKS));
 
-    for (agno = 0; agno < num_ags ; agno++)  {
-	scan_ag(agno);
+    if (!read_log_blocks(log, 0, 1, buffer))
+        goto out;
+    first_cycle = log_block_cycle(buffer);
+    if (!read_log_blocks(log, log_bbs - 1, 1, buffer))
+        goto out;
+    last_cycle = log_block_cycle(buffer);
+    if (first_cycle == 0 || last_cycle + 1 != first_cycle)
+        goto out;
+
+    low = 0;
+    high = log_bbs - 1;
+    while (high - low > 1)
+    {
+        mid = low + (high - low) / 2;
+        if (!read_log_blocks(log, mid, 1, buffer))
+            goto out;
+        cycle = log_block_cycle(buffer);
+        if (cycle == first_cycle)
+            low = mid;
+        else if (cycle == last_cycle)
+            high = mid;
+        else
+            goto out;
     }
-    for(current_block = 0; current_block < fs_info.totalblock; current_block++){
-	if(pc_test_bit(current_block, bitmap, fs_info.totalblock))
-	    bused++;
-	else
-	    bfree++;
+
+    start = high > XFS_LOG_VERIFY_BLOCKS ? high - XFS_LOG_VERIFY_BLOCKS : 0;
+    if (!read_log_blocks(log, start, high - start, buffer))
+        goto out;
+    for (blk = start; blk < high; blk++)
+    {
+        char *block = buffer + BBTOB(blk - start);
+
+        if (log_block_cycle(block) != first_cycle)
+            goto out;
+        if (be32_to_cpu(*(__be32 *)block) == XLOG_HEADER_MAGIC_NUM)
+        {
+            rhead = (xlog_rec_header_t *)block;
+            rblk = blk;
+        }
     }
-    fs_close();
+    if (rhead == NULL || be32_to_cpu(rhead->h_num_logops) != 1)
+        goto out;
+    hblks = log_header_blocks(be32_to_cpu(rhead->h_version), be32_to_cpu(rhead->h_size));
+    if (rblk + hblks >= high ||
+        rblk + hblks + BTOBB(be32_to_cpu(rhead->h_len)) != high)
+        goto out;
+    op = (xlog_op_header_t *)(buffer + BBTOB(rblk + hblks - start));
+    if (!(op->oh_flags & XLOG_UNMOUNT_TRANS))
+        goto out;
+
+    /// metadata lsns stay below (first_cycle, head), the new log starts above
+    log->cycle = first_cycle + 1;
+    log->version = xfs_sb_version_haslogv2(&ctx->mp->m_sb) ? XLOG_VERSION_2 : XLOG_VERSION_1;
+    if (log->version == XLOG_VERSION_2 && ctx->mp->m_sb.sb_logsunit > 1)
+        log->sunit = ctx->mp->m_sb.sb_logsunit;
+    memcpy(log->uuid, &ctx->mp->m_sb.sb_uuid, sizeof(log->uuid));
+    ret = TRUE;
+out:
+    g_free(buffer);
+    return ret;
+}
+/// leave a clean log out of the bitmap, log holds what restore rewrites
+static gboolean clear_clean_log (file_system_info *fs_info, ul *bitmap, image_xfs_log *log)
+{
+    if (!find_clean_log(log))
+        return FALSE;
+    pc_clear_range(log->offset / fs_info->block_size,
+                   log->length / fs_info->block_size,
+                   bitmap,
+                   fs_info->totalblock);
     return TRUE;
 }
+typedef struct
+{
+    const image_xfs_log *log;
+    uint32_t             h_size;    /// record size announced in every header
+    int                  hdrs;      /// header blocks per record
+    int                  blocks;    /// blocks per record
+} XfsLogFormat;
+
+/// one unmount record, packed and checksummed as xlog_sync writes it
+static void build_log_record (const XfsLogFormat *fmt,
+                              char               *p,
+                              int                 blocks,
+                              uint32_t            cycle,
+                              ull                 blk,
+                              ull                 tail_blk)
+{
+    xlog_rec_header_t *head = (xlog_rec_header_t *)p;
+    xlog_op_header_t  *op;
+    char              *data = p + BBTOB(fmt->hdrs);
+    uint32_t           data_len = BBTOB(blocks - fmt->hdrs);
+    uint16_t           magic = XLOG_UNMOUNT_TYPE;
+    uint32_t           crc;
+    int                xheads = 1;
+    int                i;
+
+    memset(p, 0, BBTOB(blocks));
+    head->h_magicno = cpu_to_be32(XLOG_HEADER_MAGIC_NUM);
+    head->h_cycle = cpu_to_be32(cycle);
+    head->h_version = cpu_to_be32(fmt->log->version);
+    head->h_len = cpu_to_be32(data_len);
+    head->h_lsn = cpu_to_be64(((xfs_lsn_t)cycle << 32) | blk);
+    head->h_tail_lsn = cpu_to_be64(((xfs_lsn_t)cycle << 32) | tail_blk);
+    head->h_prev_block = cpu_to_be32(-1);
+    head->h_num_logops = cpu_to_be32(1);
+    head->h_fmt = cpu_to_be32(XLOG_FMT);
+    memcpy(&head->h_fs_uuid, fmt->log->uuid, sizeof(head->h_fs_uuid));
+    head->h_size = cpu_to_be32(fmt->h_size);
+    for (i = 1; i < fmt->hdrs; i++)
+        *(__be32 *)(p + BBTOB(i)) = cpu_to_be32(cycle);
+
+    op = (xlog_op_header_t *)data;
+    op->oh_tid = cpu_to_be32(XFS_LOG_USER_TID);
+    op->oh_len = cpu_to_be32(2 * sizeof(uint32_t));
+    op->oh_clientid = XFS_LOG;
+    op->oh_flags = XLOG_UNMOUNT_TRANS;
+    /// host order, as xfs_repair and the kernel write it
+    memcpy(data + sizeof(xlog_op_header_t), &magic, sizeof(magic));
 
-static gboolean read_super_blocks(const char* device, file_system_info* fs_info)
+    /// only the first data block has a non zero first word to save
+    head->h_cycle_data[0] = *(__be32 *)data;
+    for (i = 0; i < blocks - fmt->hdrs; i++)
+        *(__be32 *)(data + BBTOB(i)) = cpu_to_be32(cycle);
+
+    if (fmt->log->version == XLOG_VERSION_2)
+        xheads = MIN(fmt->hdrs, (int)((data_len + XLOG_HEADER_CYCLE_SIZE - 1) / XLOG_HEADER_CYCLE_SIZE));
+    crc = crc32c_le(~0U, (unsigned char *)head, sizeof(xlog_rec_header_t));
+    for (i = 1; i < xheads; i++)
+        crc = crc32c_le(crc, (unsigned char *)p + BBTOB(i), sizeof(xlog_rec_ext_header_t));
+    crc = crc32c_le(crc, (unsigned char *)data, data_len);
+    head->h_crc = cpu_to_le32(~crc);
+}
+/******************************************************************************
+ * Function:              format_xfs_log      
+ *        
+ * Explain: Write an empty log over the region a lean image left out, the
+ *          way xfs_repair -L does: an unmount record of the new cycle at
+ *          the start, then records of the previous cycle up to the end, so
+ *          the kernel finds the head right behind the unmount record and
+ *          whatever the target held there is overwritten.
+ *        
+ * Input:   @fd           restored device or partition
+ *          @log          log description saved at backup time
+ *        
+ * Output:  success      :TRUE
+ *          fail         :FALSE
+ ******************************************************************************/
+gboolean format_xfs_log (int *fd, const image_xfs_log *log)
 {
-    if (!fs_open(device))
+    XfsLogFormat fmt;
+    char        *buffer;
+    ull          log_bbs = BTOBB(log->length);
+    ull          blk = 0, fill, chunk;
+    int          len, i;
+
+    fmt.log = log;
+    fmt.h_size = MAX(log->sunit, XLOG_BIG_RECORD_BSIZE);
+    fmt.hdrs = log_header_blocks(log->version, log->sunit);
+    fmt.blocks = MAX((int)BTOBB(log->sunit), fmt.hdrs + 1);
+    if (log->cycle < 2 || log_bbs < (ull)fmt.blocks)
     {
         return FALSE;
-    }    
+    }
+    chunk = MAX(BTOBB(DEFAULT_BUFFER_SIZE) / fmt.blocks, 1) * fmt.blocks;
+    buffer = g_malloc(BBTOB(chunk));
+
+    while (blk < log_bbs)
+    {
+        for (fill = 0; fill < chunk && blk + fill < log_bbs; fill += len)
+        {
+            char *p = buffer + BBTOB(fill);
+
+            len = MIN((ull)fmt.blocks, log_bbs - blk - fill);
+            if (blk + fill == 0)
+            {
+                build_log_record(&fmt, p, len, log->cycle, 0, 0);
+            }
+            else if (len > fmt.hdrs)
+            {
+                build_log_record(&fmt, p, len, log->cycle - 1,
+                                 blk + fill, blk + fill - fmt.blocks);
+            }
+            else
+            {
+                /// a tail too short for a record only needs the cycle stamp
+                memset(p, 0, BBTOB(len));
+                for (i = 0; i < len; i++)
+                    *(__be32 *)(p + BBTOB(i)) = cpu_to_be32(log->cycle - 1);
+            }
+        }
+        if (lseek(*fd, (off_t)(log->offset + BBTOB(blk)), SEEK_SET) == (off_t)-1 ||
+            write_read_io_all(fd, buffer, BBTOB(fill), WRITE) != (int)BBTOB(fill))
+        {
+            g_free(buffer);
+            return FALSE;
+        }
+        blk += fill;
+    }
+    g_free(buffer);
+
+    return TRUE;
+}
+static gboolean read_super_blocks(file_system_info* fs_info)
+{
     strncpy(fs_info->fs, xfs_MAGIC, FS_MAGIC_SIZE);
-    fs_info->block_size  = mp->m_sb.sb_blocksize;
-    fs_info->totalblock  = mp->m_sb.sb_dblocks;
-    fs_info->usedblocks  = mp->m_sb.sb_dblocks - mp->m_sb.sb_fdblocks;
+    fs_info->block_size  = ctx->mp->m_sb.sb_blocksize;
+    fs_info->totalblock  = ctx->mp->m_sb.sb_dblocks;
+    fs_info->usedblocks  = ctx->mp->m_sb.sb_dblocks - ctx->mp->m_sb.sb_fdblocks;
     fs_info->device_size = fs_info->totalblock * fs_info->block_size;
-    fs_close();
  
     return TRUE;
 }
@@ -372,32 +744,22 @@ static gboolean check_system_space (file_system_info *fs_info,
  ******************************************************************************/
 static ull get_read_blocks_size (file_system_info *fs_info,ull *block_id,ul *bitmap)
 {
-    ull blocks_skip,blocks_read;
+    ull read_end;
     const ull  blocks_total = fs_info->totalblock;
     const uint block_size = fs_info->block_size;
     const uint buffer_capacity = DEFAULT_BUFFER_SIZE > block_size ? DEFAULT_BUFFER_SIZE / block_size : 1;
 
     /// skip unused blocks
-    for (blocks_skip = 0;
-        *block_id + blocks_skip < blocks_total &&
-        !pc_test_bit(*block_id + blocks_skip, bitmap, blocks_total);
-         blocks_skip++);
-    if (*block_id + blocks_skip == blocks_total)
+    *block_id = pc_find_next_set(bitmap, blocks_total, *block_id);
+    if (*block_id >= blocks_total)
     {
         return 0;
     }
+    /// read blocks size < buffer_capacity && Current block has data
+    read_end = *block_id + buffer_capacity < blocks_total ?
+               *block_id + buffer_capacity : blocks_total;
 
-    if (blocks_skip)
-    {    
-        *block_id += blocks_skip;
-    }
-    /// read blocks size < 256 && Current block has data
-    for (blocks_read = 0;
-        *block_id + blocks_read < blocks_total && blocks_read < buffer_capacity &&
-         pc_test_bit(*block_id + blocks_read, bitmap,blocks_total);
-       ++blocks_read);
-
-    return blocks_read;
+    return pc_find_next_zero(bitmap, read_end, *block_id) - *block_id;
 
 }    
 static gboolean read_write_data_ptf (SysbakGdbus      *object,
@@ -414,6 +776,7 @@ static gboolean read_write_data_ptf (SysbakGdbus      *object,
     uint  blocks_in_cs = 0, blocks_per_cs, write_size;
     char *read_buffer, *write_buffer;
     ull   block_id = 0;	
+    ull   copied_count = 0;
     int   r_size, w_size;	
     progress_bar  prog;
     progress_data pdata;
@@ -442,6 +805,10 @@ static gboolean read_write_data_ptf (SysbakGdbus      *object,
         ull i,blocks_read;
         int cs_added = 0, write_offset = 0;
         off_t offset;
+        if (!job_continue (object))
+        {
+            goto ERROR;
+        }
         blocks_read = get_read_blocks_size (fs_info,&block_id,bitmap);
         if (blocks_read == 0)
             break;
@@ -483,10 +850,10 @@ static gboolean read_write_data_ptf (SysbakGdbus      *object,
         {
             pdata.percent=100.0;
         }
-        sysbak_gdbus_emit_sysbak_progress (object,
-                                           pdata.percent,
-                                           pdata.speed,
-                                           pdata.elapsed);
+        emit_sysbak_progress (object,
+                              pdata.percent,
+                              pdata.speed,
+                              pdata.elapsed);
         if (r_size + cs_added * img_opt->checksum_size != w_size)
         {
             goto ERROR;
@@ -520,14 +887,19 @@ gboolean gdbus_sysbak_xfsfs_ptf (SysbakGdbus           *object,
                                  GDBusMethodInvocation *invocation,
 								 const gchar           *source,
 								 const gchar           *target,
-                                 gboolean               overwrite)
+                                 gboolean               overwrite,
+                                 gboolean               lean)
 {
+    XfsContext       context;
     file_system_info fs_info;   /// description of the file system
     image_options    img_opt;
+    image_xfs_log    xlog;
     unsigned long   *bitmap = NULL;
     uint             buffer_capacity;
     int              e_code;
     gint             dfr = 0,dfw = 0;
+
+    context_init(&context);
     dfr = open_source_device(source,BACK_PTF);
     if (dfr <= 0 ) 
     {
@@ -550,8 +922,8 @@ gboolean gdbus_sysbak_xfsfs_ptf (SysbakGdbus           *object,
     init_file_system_info(&fs_info);
     init_image_options(&img_opt);
     
-    // get Super Block information from partition
-    if (!read_super_blocks(source, &fs_info))
+    // the file system is opened once and serves every probe below
+    if (!fs_open(source) || !read_super_blocks(&fs_info))
     {
         e_code = 3;
         goto ERROR;
@@ -571,11 +943,16 @@ gboolean gdbus_sysbak_xfsfs_ptf (SysbakGdbus           *object,
         e_code = 4;
         goto ERROR;
     }
-    if (!read_bitmap_info(source, fs_info, bitmap))
+    if (!read_bitmap_info(fs_info, bitmap))
     {
         e_code = 5;
         goto ERROR;
     }
+    if (lean && clear_clean_log(&fs_info, bitmap, &xlog))
+    {
+        set_image_fs_flags(&img_opt, IMAGE_FS_XFS_LOG);
+    }
+    fs_close();
     update_used_blocks_count(&fs_info, bitmap);
     if (!check_system_space (&fs_info,target,&img_opt))
     {
@@ -588,7 +965,11 @@ gboolean gdbus_sysbak_xfsfs_ptf (SysbakGdbus           *object,
         goto ERROR;
     }    
     write_image_bitmap(&dfw, fs_info, bitmap);
-    copied_count = 0;
+    if (img_opt.fs_flags & IMAGE_FS_XFS_LOG && !write_image_xfs_log(&dfw, &xlog))
+    {
+        e_code = 7;
+        goto ERROR;
+    }
 //    sysbak_gdbus_complete_sysbak_xfsfs_ptf (object,invocation); 
     if (!read_write_data_ptf (object,&fs_info,&img_opt,bitmap,&dfr,&dfw))
     {
@@ -596,22 +977,26 @@ gboolean gdbus_sysbak_xfsfs_ptf (SysbakGdbus           *object,
         goto ERROR;
     } 
 
-	sysbak_gdbus_emit_sysbak_finished (object,
-                                       fs_info.totalblock,
-                                       fs_info.usedblocks,
-                                       fs_info.block_size);
-    free(bitmap);
+	emit_sysbak_finished (object,
+                          fs_info.totalblock,
+                          fs_info.usedblocks,
+                          fs_info.block_size);
+    pc_free_bitmap(bitmap);
+    context_clear(&context);
     close (dfw);
     close (dfr);
     g_print ("sysbak_gdbus_complete_sysbak_xfsfs_ptf \r\n");
-    sysbak_gdbus_complete_sysbak_xfsfs_ptf (object,invocation); 
+    if (invocation != NULL)
+        sysbak_gdbus_complete_sysbak_xfsfs_ptf (object,invocation);
     return TRUE;
 ERROR:
-	sysbak_gdbus_complete_sysbak_xfsfs_ptf (object,invocation); 
-	sysbak_gdbus_emit_sysbak_error (object,
-                                    sysbak_error_message[e_code],
-                                    e_code);
-    free(bitmap);
+	if (invocation != NULL)
+	    sysbak_gdbus_complete_sysbak_xfsfs_ptf (object,invocation);
+	emit_sysbak_error (object,
+                       sysbak_error_message[e_code],
+                       e_code);
+    pc_free_bitmap(bitmap);
+    fs_close();
     if (dfr > 0)
     {    
         close (dfr);
@@ -620,6 +1005,7 @@ ERROR:
     {    
         close (dfw);
     }    
+    context_clear(&context);
     return FALSE;
 }   
 
@@ -654,6 +1040,10 @@ static gboolean read_write_data_ptp (SysbakGdbus      *object,
         ull blocks_read;
         off_t offset;
 
+        if (!job_continue (object))
+        {
+            goto ERROR;
+        }
         blocks_read = get_read_blocks_size (fs_info,&block_id,bitmap);
         if (blocks_read == 0)
             break;
@@ -682,10 +1072,10 @@ static gboolean read_write_data_ptp (SysbakGdbus      *object,
         {
             pdata.percent=100.0;
         }
-		sysbak_gdbus_emit_sysbak_progress (object,
-                                           pdata.percent,
-                                           pdata.speed,
-                                           pdata.elapsed);
+		emit_sysbak_progress (object,
+                              pdata.percent,
+                              pdata.speed,
+                              pdata.elapsed);
     } while (1);
 
     free(buffer);
@@ -701,16 +1091,21 @@ gboolean gdbus_sysbak_xfsfs_ptp (SysbakGdbus           *object,
                                  GDBusMethodInvocation *invocation,
                                  const gchar           *source,
                                  const gchar           *target,
-                                 gboolean               overwrite)
+                                 gboolean               overwrite,
+                                 gboolean               lean)
 {
+    XfsContext       context;
     file_system_info fs_info;   /// description of the file system
     image_options    img_opt;
+    image_xfs_log    xlog;
     ul              *bitmap = NULL;
     uint             buffer_capacity;
+    gboolean         clean_log = FALSE;
     ull free_space = 0;
     gint             e_code;
     gint             dfr = 0,dfw = 0;
 
+    context_init(&context);
     dfr = open_source_device(source,BACK_PTP);
     if (dfr <= 0 ) 
     {
@@ -726,8 +1121,8 @@ gboolean gdbus_sysbak_xfsfs_ptp (SysbakGdbus           *object,
 
     init_file_system_info(&fs_info);
     init_image_options(&img_opt);
-    // get Super Block information from partition
-    if (!read_super_blocks(source, &fs_info))
+    // the file system is opened once and serves every probe below
+    if (!fs_open(source) || !read_super_blocks(&fs_info))
     {
         e_code = 3;
         goto ERROR;
@@ -750,19 +1145,22 @@ gboolean gdbus_sysbak_xfsfs_ptp (SysbakGdbus           *object,
         goto ERROR;
     }
 
-    if (!read_bitmap_info(source, fs_info, bitmap))
+    if (!read_bitmap_info(fs_info, bitmap))
     {
         e_code = 5;
         goto ERROR;
     }    
+    clean_log = lean && clear_clean_log(&fs_info, bitmap, &xlog);
+    fs_close();
     free_space = get_partition_free_space(&dfw);
     if (free_space < fs_info.device_size)
     {
         e_code = 6;
         goto ERROR;
     }   
-    copied_count = 0;
-    sysbak_gdbus_complete_sysbak_xfsfs_ptp (object,invocation); 
+    if (invocation != NULL)
+        sysbak_gdbus_complete_sysbak_xfsfs_ptp (object,invocation);
+    invocation = NULL;
     if (!read_write_data_ptp (object,
                              &fs_info,
                               bitmap,
@@ -772,19 +1170,27 @@ gboolean gdbus_sysbak_xfsfs_ptp (SysbakGdbus           *object,
         e_code = 8;
         goto ERROR;
     }
+    if (clean_log && !format_xfs_log(&dfw, &xlog))
+    {
+        e_code = 8;
+        goto ERROR;
+    }
 
     fsync(dfw);
-    free(bitmap);
+    pc_free_bitmap(bitmap);
+    context_clear(&context);
     close (dfr);
     close (dfw);
-    sysbak_gdbus_emit_sysbak_finished (object,
-                                       fs_info.totalblock,
-                                       fs_info.usedblocks,
-                                       fs_info.block_size);
+    emit_sysbak_finished (object,
+                          fs_info.totalblock,
+                          fs_info.usedblocks,
+                          fs_info.block_size);
     return TRUE;
 ERROR:
-    sysbak_gdbus_complete_sysbak_xfsfs_ptp (object,invocation); 
-    free(bitmap);
+    if (invocation != NULL)
+        sysbak_gdbus_complete_sysbak_xfsfs_ptp (object,invocation);
+    pc_free_bitmap(bitmap);
+    fs_close();
     if (dfr > 0)
     {    
         close (dfr);
@@ -793,8 +1199,9 @@ ERROR:
     {    
         close (dfw);
     }    
-    sysbak_gdbus_emit_sysbak_error (object,
-                                    sysbak_error_message[e_code],
-                                    e_code);
+    context_clear(&context);
+    emit_sysbak_error (object,
+                       sysbak_error_message[e_code],
+                       e_code);
     return FALSE;
 }  
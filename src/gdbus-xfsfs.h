@@ -31,18 +31,24 @@
 #include <glib.h>
 #include <gio/gio.h>
 #include "sysbak-admin-generated.h"
+#include "gdbus-share.h"
 
 
 gboolean      gdbus_sysbak_xfsfs_ptf      (SysbakGdbus           *object,
                                            GDBusMethodInvocation *invocation,
                                            const gchar           *source,
                                            const gchar           *target,
-                                           gboolean               overwrite);
+                                           gboolean               overwrite,
+                                           gboolean               lean);
 
 gboolean      gdbus_sysbak_xfsfs_ptp      (SysbakGdbus           *object,
                                            GDBusMethodInvocation *invocation,
                                            const gchar           *source,
                                            const gchar           *target,
-                                           gboolean               overwrite);
+                                           gboolean               overwrite,
+                                           gboolean               lean);
+
+gboolean      format_xfs_log              (int                   *fd,
+                                           const image_xfs_log   *log);
 
 #endif
@@ -83,6 +83,7 @@ gboolean sysbak_admin_btrfs_ptf_async (SysbakAdmin *sysbak)
 									    source,
 									    target,
                                         overwrite,
+                                        sysbak_admin_get_lean (sysbak),
 										NULL,
 								        (GAsyncReadyCallback) call_sysbak_btrfs_ptf,
 										sysbak);
@@ -150,6 +151,7 @@ gboolean sysbak_admin_btrfs_ptp_async (SysbakAdmin *sysbak)
 									    source,
 									    target,
                                         overwrite,
+                                        sysbak_admin_get_lean (sysbak),
 										NULL,
 								        (GAsyncReadyCallback) call_sysbak_btrfs_ptp,
 										sysbak);
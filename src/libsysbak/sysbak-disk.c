@@ -37,13 +37,6 @@
 
 #define   CMDOPTION   "NAME,FSTYPE,UUID";
 
-typedef void (*sysbak_func) (SysbakAdmin *);
-typedef struct
-{
-    char        *fs_type;
-    sysbak_func  sysbak_admin_type;
-}sys_admin;
-
 static const char *execute_command_line (const char *disk_name)
 {
     const gchar *argv[7];
@@ -283,116 +276,6 @@ gboolean get_disk_lvm_metadata (SysbakAdmin *sysbak)
     return ret;      /// finish
 }  
 
-static void sysbak_admin_extfs (SysbakAdmin *sysbak)
-{
-    sysbak_admin_extfs_ptf_async (sysbak);
-}    
-static void sysbak_admin_fatfs (SysbakAdmin *sysbak) 
-{
-    sysbak_admin_fatfs_ptf_async (sysbak);
-}
-static void sysbak_admin_btrfs (SysbakAdmin *sysbak) 
-{
-    sysbak_admin_btrfs_ptf_async (sysbak);
-}
-static void sysbak_admin_xfsfs (SysbakAdmin *sysbak) 
-{
-    sysbak_admin_xfsfs_ptf_async (sysbak);
-}
-static char *get_dev_path (char *str)
-{
-    int i = 0;
-    const char *normal_path = "/dev/";
-    const char *lvm_path = "/dev/mapper/";
-
-    char *dev_name;
-    
-    dev_name = g_strconcat(normal_path,str,NULL);
-    while (str[i] != '\0')
-    {
-        if (str[i] == '-')
-        { 
-            g_free (dev_name);
-            dev_name = g_strconcat(lvm_path,str,NULL);
-            break;
-        }
-        i++;
-    }
-
-    return dev_name;
-/*
-    while (str[i] != '\0')
-    {
-        if (str[i] == '-')
-        {    
-            str[i] = '/';
-            break;
-        }
-        i++;
-    } 
-  */  
-}   
-
-static void sysbak_admin_disk_data (SysbakAdmin  *sysbak,char *dir_name)
-{
-    char     *disk_info;
-    GKeyFile *keyfile;
-    char    **groups = NULL;
-    GError   *error = NULL;
-    gsize     length = 0;
-    int       i,j;
-    char     *partition;
-    char     *fs_type;
-    char     *source,*target;	
-    SysbakGdbus *proxy;
-    
-    static sys_admin array_data [6] =
-    {
-        {"ext2", sysbak_admin_extfs},
-        {"ext3", sysbak_admin_extfs},
-        {"ext4", sysbak_admin_extfs},
-        {"vfat", sysbak_admin_fatfs},
-        {"btrfs",sysbak_admin_btrfs},
-        {"xfs",  sysbak_admin_xfsfs}
-    };
-    
-    disk_info = g_strdup_printf ("%s/disk-info.ini",dir_name);
-    keyfile = g_key_file_new();
-    g_key_file_load_from_file(keyfile,disk_info, G_KEY_FILE_NONE, &error);
-    groups = g_key_file_get_groups(keyfile, &length);
-    proxy  = (SysbakGdbus*)sysbak_admin_get_proxy (sysbak);
-    for(i = 0; i < (int)length; i++)
-    {
-        partition = g_key_file_get_string (keyfile,
-                                           groups[i],
-                                          "name",
-                                           NULL);
-        
-        fs_type = g_key_file_get_string (keyfile,
-                                         groups[i],
-                                        "fstype",
-                                         &error);
-        
-        for (j = 0; j < 6; j++)
-        {
-            if (g_strcmp0 (fs_type,array_data[j].fs_type) == 0)
-            {
-                target = g_strdup_printf ("%s/%s.img",dir_name,partition);
-                source = get_dev_path (partition);
-
-	            sysbak_admin_set_source (sysbak,source);
-	            sysbak_admin_set_target (sysbak,target);
-                sysbak_admin_set_option (sysbak,1);
-                array_data[j].sysbak_admin_type (sysbak);
-                g_free (source);
-                g_free (target);
-            }   
-		    sysbak_gdbus_emit_sysbak_error (proxy,"There are unsupported file systems",-1);
-            
-        }    
-    }
-    g_free (disk_info);
-}   
 static gboolean create_target_dir (const char *target)
 {
     if (access (target,F_OK) == -1)
@@ -401,14 +284,37 @@ static gboolean create_target_dir (const char *target)
     }
     return -1;
 }    
+static void call_backup_disk (GObject      *source_object,
+                              GAsyncResult *res,
+                              gpointer      data)
+{
+	SysbakAdmin *sysbak = SYSBAK_ADMIN (data);
+	SysbakGdbus *proxy;
+    g_autoptr(GError) error = NULL;
+	g_autofree gchar *error_message = NULL;
+	const char  *base_error = "Backup disk to file failed";
+	
+	proxy  = (SysbakGdbus*)sysbak_admin_get_proxy (sysbak);
+	if (! sysbak_gdbus_call_backup_disk_finish(proxy,res,&error))
+	{
+
+		error_message = g_strdup_printf ("%s %s",base_error,error->message);
+		sysbak_gdbus_emit_sysbak_error (proxy,error_message,-1);
+	}
+}
+/*
+ * The daemon captures the lvm metadata, disk-info.ini, the partition
+ * table and the MBR side by side, then images the partitions in
+ * parallel and reports them as one job.
+ */
 gboolean sysbak_admin_disk_to_file (SysbakAdmin  *sysbak)
 {
-    gboolean  ret;
-    char     *disk_info,*disk_mbr,*disk_table,*lvm_meta;
-    char     *source,*target;	
+    const char  *source,*target;	
+    SysbakGdbus *proxy;
     
     source = sysbak_admin_get_source (sysbak);
     target = sysbak_admin_get_target (sysbak);
+	proxy  = (SysbakGdbus*)sysbak_admin_get_proxy (sysbak);
 
     if (!check_file_device (source))
     {
@@ -420,43 +326,15 @@ gboolean sysbak_admin_disk_to_file (SysbakAdmin  *sysbak)
     {
         return FALSE;
     }    
-    // stp 2 Check overwrite;
-    // stp 3 Check disk space;
-    lvm_meta = g_strdup_printf ("%s/lvm",target);
-	sysbak_admin_set_target (sysbak,lvm_meta);
-    ret = get_disk_lvm_metadata (sysbak);
-    g_free (lvm_meta);
-    if (!ret)
-    {
-        return FALSE;
-    }    
-    
-    disk_info = g_strdup_printf ("%s/disk-info.ini",target);
-    ret = get_disk_info_config (source,disk_info);
-    g_free (disk_info);
-    if (!ret)
-    {
-        return FALSE;
-    }    
-    
-    disk_table = g_strdup_printf ("%s/disk-table",target);
-    sysbak_admin_set_target (sysbak,disk_table);
-    ret = get_disk_partition_table (sysbak);
-    g_free (disk_table);
-    if (!ret)
-    {
-        return FALSE;
-    }    
-    
-    disk_mbr = g_strdup_printf ("%s/disk-mbr",target);
-	sysbak_admin_set_target (sysbak,disk_mbr);
-    ret = get_disk_mbr (sysbak);
-    g_free (disk_mbr);
-    if (!ret)
-    {
-        return FALSE;
-    }    
-    sysbak_admin_disk_data (sysbak,target);
+	sysbak_gdbus_call_backup_disk (proxy,
+                                   source,
+                                   target,
+                                   TRUE,
+                                   sysbak_admin_get_lean (sysbak),
+                                   sysbak_admin_get_jobs (sysbak),
+                                   NULL,
+                                   (GAsyncReadyCallback) call_backup_disk,
+                                   sysbak);
 
     return TRUE;
 }
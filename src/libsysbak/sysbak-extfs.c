@@ -83,6 +83,7 @@ gboolean sysbak_admin_extfs_ptf_async (SysbakAdmin *sysbak)
 									    source,
 									    target,
                                         overwrite,
+                                        sysbak_admin_get_lean (sysbak),
 										NULL,
 								        (GAsyncReadyCallback) call_sysbak_extfs_ptf,
 										sysbak);
@@ -151,6 +152,7 @@ gboolean sysbak_admin_extfs_ptp_async (SysbakAdmin *sysbak)
 									    source,
 									    target,
                                         overwrite,
+                                        sysbak_admin_get_lean (sysbak),
 										NULL,
 								        (GAsyncReadyCallback) call_sysbak_extfs_ptp,
 										sysbak);
@@ -42,6 +42,8 @@ enum
 typedef struct
 {
    gboolean	       overwrite;
+   gboolean	       lean;
+   guint           jobs;
    char           *source; 
    char           *target;
    SysbakGdbus    *proxy;
@@ -199,6 +201,20 @@ gboolean sysbak_admin_get_option (SysbakAdmin *sysbak)
 	return priv->overwrite;
 }
 
+gboolean sysbak_admin_get_lean (SysbakAdmin *sysbak)
+{
+	SysbakAdminPrivate *priv = sysbak_admin_get_instance_private (sysbak);
+	
+	return priv->lean;
+}
+
+guint sysbak_admin_get_jobs (SysbakAdmin *sysbak)
+{
+	SysbakAdminPrivate *priv = sysbak_admin_get_instance_private (sysbak);
+	
+	return priv->jobs;
+}
+
 gpointer sysbak_admin_get_proxy (SysbakAdmin *sysbak)
 {
 	SysbakAdminPrivate *priv = sysbak_admin_get_instance_private (sysbak);
@@ -225,6 +241,21 @@ void sysbak_admin_set_option (SysbakAdmin *sysbak,gboolean overwrite)
 	priv->overwrite = overwrite;
 }
 
+void sysbak_admin_set_lean (SysbakAdmin *sysbak,gboolean lean)
+{
+	SysbakAdminPrivate *priv = sysbak_admin_get_instance_private (sysbak);
+	
+	priv->lean = lean;
+}
+
+/// partitions a disk backup images at a time, 0 leaves it to the daemon
+void sysbak_admin_set_jobs (SysbakAdmin *sysbak,guint jobs)
+{
+	SysbakAdminPrivate *priv = sysbak_admin_get_instance_private (sysbak);
+	
+	priv->jobs = jobs;
+}
+
 SysbakAdmin *sysbak_admin_new (void)
 {
 	return g_object_new (SYSBAK_TYPE_ADMIN,NULL);
@@ -66,6 +66,10 @@ const char      *sysbak_admin_get_target       (SysbakAdmin    *sysbak);
 
 gboolean         sysbak_admin_get_option       (SysbakAdmin    *sysbak);
 
+gboolean         sysbak_admin_get_lean         (SysbakAdmin    *sysbak);
+
+guint            sysbak_admin_get_jobs         (SysbakAdmin    *sysbak);
+
 gpointer         sysbak_admin_get_proxy        (SysbakAdmin    *sysbak);
 
 void             sysbak_admin_set_source       (SysbakAdmin    *sysbak,
@@ -77,5 +81,11 @@ void             sysbak_admin_set_target       (SysbakAdmin    *sysbak,
 void             sysbak_admin_set_option       (SysbakAdmin    *sysbak,
 		                                        gboolean       overwrite);
 
+void             sysbak_admin_set_lean         (SysbakAdmin    *sysbak,
+		                                        gboolean       lean);
+
+void             sysbak_admin_set_jobs         (SysbakAdmin    *sysbak,
+		                                        guint          jobs);
+
 G_END_DECLS
 #endif
@@ -83,6 +83,7 @@ gboolean sysbak_admin_xfsfs_ptf_async (SysbakAdmin *sysbak)
 									    source,
 									    target,
                                         overwrite,
+                                        sysbak_admin_get_lean (sysbak),
 										NULL,
 								        (GAsyncReadyCallback) call_sysbak_xfsfs_ptf,
 										sysbak);
@@ -149,6 +150,7 @@ gboolean sysbak_admin_xfsfs_ptp_async (SysbakAdmin *sysbak)
 									    source,
 									    target,
                                         overwrite,
+                                        sysbak_admin_get_lean (sysbak),
 										NULL,
 								        (GAsyncReadyCallback) call_sysbak_xfsfs_ptp,
 										sysbak);
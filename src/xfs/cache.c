@@ -48,9 +48,11 @@ cache_init(
 	struct cache_operations	*cache_operations)
 {
 	struct cache *		cache;
-	unsigned int		i, maxcount;
+	struct cache_shard *	shard;
+	unsigned int		i, j, nshards, maxcount;
 
-	maxcount = hashsize * HASH_CACHE_RATIO;
+	nshards = hashsize < CACHE_MAX_SHARDS ? hashsize : CACHE_MAX_SHARDS;
+	maxcount = hashsize * HASH_CACHE_RATIO / nshards;
 
 	if (!(cache = malloc(sizeof(struct cache))))
 		return NULL;
@@ -58,13 +60,16 @@ cache_init(
 		free(cache);
 		return NULL;
 	}
+	if (!(cache->c_shards = calloc(nshards, sizeof(struct cache_shard)))) {
+		free(cache->c_hash);
+		free(cache);
+		return NULL;
+	}
 
 	cache->c_flags = flags;
-	cache->c_count = 0;
-	cache->c_max = 0;
 	cache->c_hits = 0;
 	cache->c_misses = 0;
-	cache->c_maxcount = maxcount;
+	cache->c_nshards = nshards;
 	cache->c_hashsize = hashsize;
 	cache->c_hashshift = fls(hashsize);
 	cache->hash = cache_operations->hash;
@@ -74,7 +79,6 @@ cache_init(
 	cache->compare = cache_operations->compare;
 	cache->bulkrelse = cache_operations->bulkrelse ?
 		cache_operations->bulkrelse : cache_generic_bulkrelse;
-	pthread_mutex_init(&cache->c_mutex, NULL);
 
 	for (i = 0; i < hashsize; i++) {
 		list_head_init(&cache->c_hash[i].ch_list);
@@ -82,21 +86,34 @@ cache_init(
 		pthread_mutex_init(&cache->c_hash[i].ch_mutex, NULL);
 	}
 
-	for (i = 0; i <= CACHE_DIRTY_PRIORITY; i++) {
-		list_head_init(&cache->c_mrus[i].cm_list);
-		cache->c_mrus[i].cm_count = 0;
-		pthread_mutex_init(&cache->c_mrus[i].cm_mutex, NULL);
+	for (i = 0; i < nshards; i++) {
+		shard = &cache->c_shards[i];
+		shard->cs_maxcount = maxcount;
+		pthread_mutex_init(&shard->cs_mutex, NULL);
+		for (j = 0; j <= CACHE_DIRTY_PRIORITY; j++) {
+			list_head_init(&shard->cs_mrus[j].cm_list);
+			shard->cs_mrus[j].cm_count = 0;
+			pthread_mutex_init(&shard->cs_mrus[j].cm_mutex, NULL);
+		}
 	}
 	return cache;
 }
 
+static inline struct cache_shard *
+cache_shard(
+	struct cache *		cache,
+	unsigned int		hashidx)
+{
+	return &cache->c_shards[hashidx % cache->c_nshards];
+}
+
 static void
 cache_expand(
-	struct cache *		cache)
+	struct cache_shard *	shard)
 {
-	pthread_mutex_lock(&cache->c_mutex);
-	cache->c_maxcount *= 2;
-	pthread_mutex_unlock(&cache->c_mutex);
+	pthread_mutex_lock(&shard->cs_mutex);
+	shard->cs_maxcount *= 2;
+	pthread_mutex_unlock(&shard->cs_mutex);
 }
 
 void
@@ -142,18 +159,23 @@ void
 cache_destroy(
 	struct cache *		cache)
 {
-	unsigned int		i;
+	struct cache_shard *	shard;
+	unsigned int		i, j;
 
 	cache_destroy_check(cache);
 	for (i = 0; i < cache->c_hashsize; i++) {
 		list_head_destroy(&cache->c_hash[i].ch_list);
 		pthread_mutex_destroy(&cache->c_hash[i].ch_mutex);
 	}
-	for (i = 0; i <= CACHE_DIRTY_PRIORITY; i++) {
-		list_head_destroy(&cache->c_mrus[i].cm_list);
-		pthread_mutex_destroy(&cache->c_mrus[i].cm_mutex);
+	for (i = 0; i < cache->c_nshards; i++) {
+		shard = &cache->c_shards[i];
+		for (j = 0; j <= CACHE_DIRTY_PRIORITY; j++) {
+			list_head_destroy(&shard->cs_mrus[j].cm_list);
+			pthread_mutex_destroy(&shard->cs_mrus[j].cm_mutex);
+		}
+		pthread_mutex_destroy(&shard->cs_mutex);
 	}
-	pthread_mutex_destroy(&cache->c_mutex);
+	free(cache->c_shards);
 	free(cache->c_hash);
 	free(cache);
 }
@@ -182,7 +204,8 @@ cache_add_to_dirty_mru(
 	struct cache		*cache,
 	struct cache_node	*node)
 {
-	struct cache_mru	*mru = &cache->c_mrus[CACHE_DIRTY_PRIORITY];
+	struct cache_shard	*shard = cache_shard(cache, node->cn_hashidx);
+	struct cache_mru	*mru = &shard->cs_mrus[CACHE_DIRTY_PRIORITY];
 
 	pthread_mutex_lock(&mru->cm_mutex);
 	node->cn_old_priority = node->cn_priority;
@@ -195,6 +218,7 @@ cache_add_to_dirty_mru(
 static unsigned int
 cache_shake(
 	struct cache *		cache,
+	struct cache_shard *	shard,
 	unsigned int		priority,
 	bool			purge)
 {
@@ -211,7 +235,7 @@ cache_shake(
 	if (priority > CACHE_MAX_PRIORITY && !purge)
 		priority = 0;
 
-	mru = &cache->c_mrus[priority];
+	mru = &shard->cs_mrus[priority];
 	count = 0;
 	list_head_init(&temp);
 	head = &mru->cm_list;
@@ -256,9 +280,9 @@ cache_shake(
 	if (count > 0) {
 		cache->bulkrelse(cache, &temp);
 
-		pthread_mutex_lock(&cache->c_mutex);
-		cache->c_count -= count;
-		pthread_mutex_unlock(&cache->c_mutex);
+		pthread_mutex_lock(&shard->cs_mutex);
+		shard->cs_count -= count;
+		pthread_mutex_unlock(&shard->cs_mutex);
 	}
 
 	return (count == CACHE_SHAKE_COUNT) ? priority : ++priority;
@@ -267,27 +291,28 @@ cache_shake(
 static struct cache_node *
 cache_node_allocate(
 	struct cache *		cache,
+	struct cache_shard *	shard,
 	cache_key_t		key)
 {
 	unsigned int		nodesfree;
 	struct cache_node *	node;
 
-	pthread_mutex_lock(&cache->c_mutex);
-	nodesfree = (cache->c_count < cache->c_maxcount);
+	pthread_mutex_lock(&shard->cs_mutex);
+	nodesfree = (shard->cs_count < shard->cs_maxcount);
 	if (nodesfree) {
-		cache->c_count++;
-		if (cache->c_count > cache->c_max)
-			cache->c_max = cache->c_count;
+		shard->cs_count++;
+		if (shard->cs_count > shard->cs_max)
+			shard->cs_max = shard->cs_count;
 	}
-	cache->c_misses++;
-	pthread_mutex_unlock(&cache->c_mutex);
+	pthread_mutex_unlock(&shard->cs_mutex);
+	__sync_fetch_and_add(&cache->c_misses, 1);
 	if (!nodesfree)
 		return NULL;
 	node = cache->alloc(key);
 	if (node == NULL) {
-		pthread_mutex_lock(&cache->c_mutex);
-		cache->c_count--;
-		pthread_mutex_unlock(&cache->c_mutex);
+		pthread_mutex_lock(&shard->cs_mutex);
+		shard->cs_count--;
+		pthread_mutex_unlock(&shard->cs_mutex);
 		return NULL;
 	}
 	pthread_mutex_init(&node->cn_mutex, NULL);
@@ -317,7 +342,7 @@ __cache_node_purge(
 		return 1;
 	}
 
-	mru = &cache->c_mrus[node->cn_priority];
+	mru = &cache_shard(cache, node->cn_hashidx)->cs_mrus[node->cn_priority];
 	pthread_mutex_lock(&mru->cm_mutex);
 	list_del_init(&node->cn_mru);
 	mru->cm_count--;
@@ -337,6 +362,7 @@ cache_node_get(
 {
 	struct cache_node *	node = NULL;
 	struct cache_hash *	hash;
+	struct cache_shard *	shard;
 	struct cache_mru *	mru;
 	struct list_head *	head;
 	struct list_head *	pos;
@@ -347,6 +373,7 @@ cache_node_get(
 
 	hashidx = cache->hash(key, cache->c_hashsize, cache->c_hashshift);
 	hash = cache->c_hash + hashidx;
+	shard = cache_shard(cache, hashidx);
 	head = &hash->ch_list;
 
 	for (;;) {
@@ -377,7 +404,7 @@ cache_node_get(
 			if (node->cn_count == 0) {
 				ASSERT(node->cn_priority >= 0);
 				ASSERT(!list_empty(&node->cn_mru));
-				mru = &cache->c_mrus[node->cn_priority];
+				mru = &shard->cs_mrus[node->cn_priority];
 				pthread_mutex_lock(&mru->cm_mutex);
 				mru->cm_count--;
 				list_del_init(&node->cn_mru);
@@ -394,9 +421,7 @@ cache_node_get(
 			pthread_mutex_unlock(&node->cn_mutex);
 			pthread_mutex_unlock(&hash->ch_mutex);
 
-			pthread_mutex_lock(&cache->c_mutex);
-			cache->c_hits++;
-			pthread_mutex_unlock(&cache->c_mutex);
+			__sync_fetch_and_add(&cache->c_hits, 1);
 
 			*nodep = node;
 			return 0;
@@ -404,13 +429,13 @@ next_object:
 			continue;
 		}
 		pthread_mutex_unlock(&hash->ch_mutex);
-		node = cache_node_allocate(cache, key);
+		node = cache_node_allocate(cache, shard, key);
 		if (node)
 			break;
-		priority = cache_shake(cache, priority, false);
+		priority = cache_shake(cache, shard, priority, false);
 		if (priority > CACHE_MAX_PRIORITY) {
 			priority = 0;
-			cache_expand(cache);
+			cache_expand(shard);
 		}
 	}
 
@@ -422,9 +447,9 @@ next_object:
 	pthread_mutex_unlock(&hash->ch_mutex);
 
 	if (purged) {
-		pthread_mutex_lock(&cache->c_mutex);
-		cache->c_count -= purged;
-		pthread_mutex_unlock(&cache->c_mutex);
+		pthread_mutex_lock(&shard->cs_mutex);
+		shard->cs_count -= purged;
+		pthread_mutex_unlock(&shard->cs_mutex);
 	}
 
 	*nodep = node;
@@ -441,7 +466,7 @@ cache_node_put(
 	node->cn_count--;
 
 	if (node->cn_count == 0) {
-		mru = &cache->c_mrus[node->cn_priority];
+		mru = &cache_shard(cache, node->cn_hashidx)->cs_mrus[node->cn_priority];
 		pthread_mutex_lock(&mru->cm_mutex);
 		mru->cm_count++;
 		list_add(&node->cn_mru, &mru->cm_list);
@@ -12,6 +12,7 @@ enum {
 };
 
 #define	HASH_CACHE_RATIO	8
+#define CACHE_MAX_SHARDS	16
 #define CACHE_PREFETCH_PRIORITY	8
 #define CACHE_MAX_PRIORITY	15
 #define CACHE_DIRTY_PRIORITY	(CACHE_MAX_PRIORITY + 1)
@@ -61,11 +62,21 @@ struct cache_node {
 	pthread_mutex_t		cn_mutex;	/* node mutex */
 };
 
+/*
+ * Node accounting and the MRU lists are split into shards keyed by hash
+ * bucket, so threads working on different parts of the disk do not meet
+ * on one count mutex or one set of MRU locks.
+ */
+struct cache_shard {
+	pthread_mutex_t		cs_mutex;	/* node count mutex */
+	unsigned int		cs_maxcount;	/* max shard nodes */
+	unsigned int		cs_count;	/* count of nodes */
+	unsigned int		cs_max;		/* max nodes ever used */
+	struct cache_mru	cs_mrus[CACHE_DIRTY_PRIORITY + 1];
+};
+
 struct cache {
 	int			c_flags;	/* behavioural flags */
-	unsigned int		c_maxcount;	/* max cache nodes */
-	unsigned int		c_count;	/* count of nodes */
-	pthread_mutex_t		c_mutex;	/* node count mutex */
 	cache_node_hash_t	hash;		/* node hash function */
 	cache_node_alloc_t	alloc;		/* allocation function */
 	cache_node_flush_t	flush;		/* flush dirty data function */
@@ -75,10 +86,10 @@ struct cache {
 	unsigned int		c_hashsize;	/* hash bucket count */
 	unsigned int		c_hashshift;	/* hash key shift */
 	struct cache_hash	*c_hash;	/* hash table buckets */
-	struct cache_mru	c_mrus[CACHE_DIRTY_PRIORITY + 1];
-	unsigned long long	c_misses;	/* cache misses */
-	unsigned long long	c_hits;		/* cache hits */
-	unsigned int 		c_max;		/* max nodes ever used */
+	unsigned int		c_nshards;	/* shard count */
+	struct cache_shard	*c_shards;	/* per shard accounting */
+	unsigned long long	c_misses;	/* cache misses, atomic */
+	unsigned long long	c_hits;		/* cache hits, atomic */
 };
 
 struct cache *cache_init(int, unsigned int, struct cache_operations *);
@@ -5,9 +5,11 @@
 #include "xfs_inode.h"
 
 #include "libxfs.h"		/* for LIBXFS_EXIT_ON_FAILURE */
+#include <sys/uio.h>
 
 
 #define BDSTRAT_SIZE	(256 * 1024)
+#define PREFETCH_MAX_IOVS	64
 
 #define IO_BCOMPARE_CHECK
 kmem_zone_t			*xfs_buf_zone;
@@ -179,6 +181,9 @@ libxfs_getbufr_map(struct xfs_buftarg *btp, xfs_daddr_t blkno, int bblen,
 	return bp;
 }
 extern int     use_xfs_buf_lock;
+#ifdef XFS_BUF_TRACING
+static pthread_mutex_t	lock_buf_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
 
 static struct xfs_buf *
 __cache_lookup(struct xfs_bufkey *key, unsigned int flags)
@@ -213,10 +218,10 @@ __cache_lookup(struct xfs_bufkey *key, unsigned int flags)
 		cache_node_get_priority((struct cache_node *)bp) -
 						CACHE_PREFETCH_PRIORITY);
 #ifdef XFS_BUF_TRACING
-	pthread_mutex_lock(&libxfs_bcache->c_mutex);
+	pthread_mutex_lock(&lock_buf_mutex);
 	lock_buf_count++;
 	list_add(&bp->b_lock_list, &lock_buf_list);
-	pthread_mutex_unlock(&libxfs_bcache->c_mutex);
+	pthread_mutex_unlock(&lock_buf_mutex);
 #endif
 
 	return bp;
@@ -242,11 +247,11 @@ libxfs_putbuf(xfs_buf_t *bp)
 	bp->b_error = 0;
 
 #ifdef XFS_BUF_TRACING
-	pthread_mutex_lock(&libxfs_bcache->c_mutex);
+	pthread_mutex_lock(&lock_buf_mutex);
 	lock_buf_count--;
 	ASSERT(lock_buf_count >= 0);
 	list_del_init(&bp->b_lock_list);
-	pthread_mutex_unlock(&libxfs_bcache->c_mutex);
+	pthread_mutex_unlock(&lock_buf_mutex);
 #endif
 	if (use_xfs_buf_lock) {
 		if (bp->b_recur) {
@@ -300,7 +305,6 @@ libxfs_readbufr(struct xfs_buftarg *btp, xfs_daddr_t blkno, xfs_buf_t *bp,
 	int	bytes = BBTOB(len);
 	int	error;
 
-    printf("libxfs_readbufr = \r\n");
 	error = __read_buf(fd, bp->b_addr, bytes, LIBXFS_BBTOOFF64(blkno), flags);
 	if (!error &&
 	    bp->b_target->dev == btp->dev &&
@@ -346,6 +350,96 @@ libxfs_readbuf(struct xfs_buftarg *btp, xfs_daddr_t blkno, int len, int flags,
 		libxfs_readbuf_verify(bp, ops);
 	return bp;
 }
+static int
+daddr_compare(const void *a, const void *b)
+{
+	xfs_daddr_t	da = *(const xfs_daddr_t *)a;
+	xfs_daddr_t	db = *(const xfs_daddr_t *)b;
+
+	return (da > db) - (da < db);
+}
+
+/*
+ * Read a run of buffers adjacent on disk with one preadv.  On a short read
+ * they are left as they are and the normal read path picks them up later.
+ */
+static void
+__prefetch_run(int fd, xfs_buf_t **bufs, int count)
+{
+	struct iovec	iov[PREFETCH_MAX_IOVS];
+	ssize_t		bytes = 0;
+	int		i;
+
+	for (i = 0; i < count; i++) {
+		iov[i].iov_base = bufs[i]->b_addr;
+		iov[i].iov_len = bufs[i]->b_bcount;
+		bytes += bufs[i]->b_bcount;
+	}
+	if (preadv(fd, iov, count, LIBXFS_BBTOOFF64(bufs[0]->b_bn)) != bytes)
+		return;
+	for (i = 0; i < count; i++)
+		bufs[i]->b_flags |= LIBXFS_B_UPTODATE | LIBXFS_B_UNCHECKED;
+}
+
+/*
+ * Pull a batch of same-sized buffers into the cache ahead of their use.
+ * Cached blocks and blocks locked by another thread are skipped, the rest
+ * are read sorted, adjacent ones merged.  They are left at prefetch
+ * priority so the shaker reclaims plain buffers first, and the first real
+ * lookup drops them back to normal priority and runs the verifier.
+ */
+void
+libxfs_prefetch_bufs(struct xfs_buftarg *btp, xfs_daddr_t *blknos, int count,
+		int len)
+{
+	int		fd = libxfs_device_to_fd(btp->dev);
+	struct xfs_bufkey key = {0};
+	xfs_buf_t	**bufs;
+	xfs_buf_t	*bp;
+	int		nbufs = 0;
+	int		i, run;
+
+	if (count <= 0)
+		return;
+	bufs = malloc(count * sizeof(*bufs));
+	if (!bufs)
+		return;
+	qsort(blknos, count, sizeof(*blknos), daddr_compare);
+
+	key.buftarg = btp;
+	key.bblen = len;
+	for (i = 0; i < count; i++) {
+		if (i > 0 && blknos[i] == blknos[i - 1])
+			continue;
+		key.blkno = blknos[i];
+		bp = __cache_lookup(&key, LIBXFS_GETBUF_TRYLOCK);
+		if (!bp)
+			continue;
+		if (bp->b_flags & (LIBXFS_B_UPTODATE | LIBXFS_B_DIRTY) ||
+		    bp->b_bcount != (unsigned)BBTOB(len)) {
+			libxfs_putbuf(bp);
+			continue;
+		}
+		bufs[nbufs++] = bp;
+	}
+
+	for (i = 0; i < nbufs; i += run) {
+		run = 1;
+		while (i + run < nbufs && run < PREFETCH_MAX_IOVS &&
+		       bufs[i + run]->b_bn == bufs[i + run - 1]->b_bn + len)
+			run++;
+		__prefetch_run(fd, bufs + i, run);
+	}
+
+	for (i = 0; i < nbufs; i++) {
+		cache_node_set_priority(libxfs_bcache,
+				(struct cache_node *)bufs[i],
+				CACHE_PREFETCH_PRIORITY);
+		libxfs_putbuf(bufs[i]);
+	}
+	free(bufs);
+}
+
 static int
 __write_buf(int fd, void *buf, int len, off64_t offset, int flags)
 {
@@ -197,6 +197,7 @@ libxfs_init(libxfs_init_t *a)
 	char		*rawfile;
 	int		rval = 0;
 	int		flags;
+	int		bhash_size;
 
 	dname = a->dname;
 	a->dfd = -1;
@@ -263,10 +264,14 @@ libxfs_init(libxfs_init_t *a)
 	}
 	if (needcd)
 		chdir(curdir);
-	if (!libxfs_bhash_size)
-		libxfs_bhash_size = LIBXFS_BHASHSIZE(sbp);
-    
-	libxfs_bcache = cache_init(a->bcache_flags, libxfs_bhash_size,
+	/*
+	 * The daemon opens one device after another, size the hash for
+	 * this one unless a fixed size was asked for.
+	 */
+	bhash_size = libxfs_bhash_size ? libxfs_bhash_size :
+				LIBXFS_BHASHSIZE(a->dsize);
+
+	libxfs_bcache = cache_init(a->bcache_flags, bhash_size,
 				   &libxfs_bcache_operations);
                  
 	use_xfs_buf_lock = a->usebuflock;
@@ -280,6 +285,17 @@ done:
 	return rval;
 }
 
+/* clamp a bucket count to the cache limits, as a power of two */
+unsigned int
+libxfs_bhash_roundup(long long buckets)
+{
+	unsigned int	size = LIBXFS_BHASH_MIN;
+
+	while (size < LIBXFS_BHASH_MAX && size < buckets)
+		size <<= 1;
+	return size;
+}
+
 static kmem_zone_t *
 kmem_zone_init(int size, char *name)
 {
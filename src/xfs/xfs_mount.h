@@ -148,7 +148,12 @@ typedef struct xfs_perag {
 #define LIBXFS_MOUNT_COMPAT_ATTR	0x0008
 #define LIBXFS_MOUNT_ATTR2		0x0010
 #define LIBXFS_MOUNT_WANT_CORRUPTED	0x0020
-#define LIBXFS_BHASHSIZE(sbp) 		(1<<10)
+/* one hash bucket per 64MiB of data device, dsize is in basic blocks */
+#define LIBXFS_BHASH_MIN		(1<<10)
+#define LIBXFS_BHASH_MAX		(1<<16)
+#define LIBXFS_BHASHSIZE(dsize)		libxfs_bhash_roundup((dsize) >> 17)
+
+extern unsigned int	libxfs_bhash_roundup(long long);
 
 extern xfs_mount_t	*libxfs_mount (xfs_mount_t *, xfs_sb_t *,
 				dev_t, dev_t, dev_t, int);